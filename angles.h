@@ -0,0 +1,36 @@
+// Beaglebone Blue Heading NMEA UDP Sender - angle helpers
+
+#ifndef ANGLES_H
+#define ANGLES_H
+
+#include <math.h>
+
+// Ensure we get a number in the range 0.0<=x<360.0
+static inline double wrap_360(double heading) {
+    while (heading < 0.0) {
+        heading = heading + 360.0;
+    }
+    while (heading >= 360.0) {
+        heading = heading - 360.0;
+    }
+    return heading;
+}
+
+// Wrap an angle difference into the range -180.0<=x<180.0
+static inline double wrap_180(double angle) {
+    while (angle < -180.0) {
+        angle = angle + 360.0;
+    }
+    while (angle >= 180.0) {
+        angle = angle - 360.0;
+    }
+    return angle;
+}
+
+// Round a heading to one decimal place for output, so that e.g. 359.96 goes
+// out as 0.0 rather than 360.0
+static inline double round_heading(double heading) {
+    return wrap_360(round(heading * 10.0) / 10.0);
+}
+
+#endif
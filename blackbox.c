@@ -0,0 +1,241 @@
+// Beaglebone Blue Heading NMEA UDP Sender - black box
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdarg.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "pipeline.h"
+#include "blackbox.h"
+
+#define BLACKBOX_MAGIC 0x58424248   // "HBBX"
+#define BLACKBOX_VERSION 1
+// Bytes of each sample's sentences kept, and of each note
+#define OUTPUT_LEN 128
+#define NOTE_LEN 80
+
+struct blackbox_sample {
+    // Position of this record in the ring plus one, stored last, or 0 while
+    // it is being written
+    atomic_uint_fast64_t index;
+    uint64_t timestamp_ns;
+    uint64_t arrival_ns;
+    uint32_t sequence;
+    float heading_raw;
+    float heading_mag;
+    float heading_true;
+    float pitch;
+    float roll;
+    float gnss_bias;
+    float mag_field;
+    uint8_t heading_source;
+    uint8_t imu_excluded;
+    uint16_t output_len;
+    char output[OUTPUT_LEN];
+};
+
+struct blackbox_note {
+    atomic_uint_fast64_t index;
+    uint64_t time_ns;
+    char text[NOTE_LEN];
+};
+
+struct blackbox {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t sample_size;
+    uint32_t samples;
+    uint32_t notes;
+    int32_t pid;
+    // Add to the CLOCK_MONOTONIC times to get Unix time
+    int64_t epoch_offset_ns;
+    atomic_uint_fast64_t sample_count;
+    atomic_uint_fast64_t note_count;
+    struct blackbox_sample sample[BLACKBOX_SAMPLES];
+    struct blackbox_note note[BLACKBOX_NOTES];
+};
+
+static struct blackbox *box = NULL;
+
+// Only touched by the sample path
+static enum heading_source lastSource = HEADING_SOURCE_IMU;
+
+int blackbox_open(void) {
+    char path[256];
+    char previous[272];
+    snprintf(path, sizeof(path), "/dev/shm%s", BLACKBOX_SHM_NAME);
+    snprintf(previous, sizeof(previous), "%s.prev", path);
+    rename(path, previous);
+
+    int fd = shm_open(BLACKBOX_SHM_NAME, O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(struct blackbox)) < 0) {
+        fprintf(stderr, "can't open black box %s\n", BLACKBOX_SHM_NAME);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(struct blackbox), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "can't map black box %s\n", BLACKBOX_SHM_NAME);
+        return -1;
+    }
+    struct blackbox *b = p;
+    b->magic = BLACKBOX_MAGIC;
+    b->version = BLACKBOX_VERSION;
+    b->sample_size = sizeof(struct blackbox_sample);
+    b->samples = BLACKBOX_SAMPLES;
+    b->notes = BLACKBOX_NOTES;
+    b->pid = getpid();
+    b->epoch_offset_ns = pipeline_epoch_offset();
+    box = b;
+    return 0;
+}
+
+void blackbox_note(const char *format, ...) {
+    if (box == NULL) {
+        return;
+    }
+    uint64_t n = atomic_fetch_add(&box->note_count, 1);
+    struct blackbox_note *note = &box->note[n % BLACKBOX_NOTES];
+    atomic_store_explicit(&note->index, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    note->time_ns = pipeline_now();
+    va_list args;
+    va_start(args, format);
+    vsnprintf(note->text, NOTE_LEN, format, args);
+    va_end(args);
+    atomic_store_explicit(&note->index, n + 1, memory_order_release);
+}
+
+void blackbox_record(struct sample *s) {
+    if (box == NULL) {
+        return;
+    }
+    if (s->heading_source != lastSource) {
+        static const char *sourceNames[] = { "IMU only", "GNSS blended", "predicted" };
+        blackbox_note("heading source now %s", sourceNames[s->heading_source]);
+        lastSource = s->heading_source;
+    }
+
+    uint64_t n = atomic_load_explicit(&box->sample_count, memory_order_relaxed);
+    struct blackbox_sample *r = &box->sample[n % BLACKBOX_SAMPLES];
+    atomic_store_explicit(&r->index, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    r->timestamp_ns = s->timestamp_ns;
+    r->arrival_ns = s->arrival_ns;
+    r->sequence = s->sequence;
+    r->heading_raw = (float) s->heading_raw;
+    r->heading_mag = (float) s->heading_mag;
+    r->heading_true = (float) s->heading_true;
+    r->pitch = (float) s->pitch;
+    r->roll = (float) s->roll;
+    r->gnss_bias = (float) s->gnss_bias;
+    r->mag_field = (float) s->mag_field;
+    r->heading_source = (uint8_t) s->heading_source;
+    r->imu_excluded = (uint8_t) s->imu_excluded;
+    int len = 0;
+    int i;
+    for (i = 0; i < SENTENCE_COUNT; i++) {
+        const struct slab_buffer *buf = s->sentences[i];
+        if (buf != NULL && len + buf->len <= OUTPUT_LEN) {
+            memcpy(r->output + len, buf->data, buf->len);
+            len += buf->len;
+        }
+    }
+    for (i = 0; i < s->extra_sentence_count; i++) {
+        const struct slab_buffer *buf = s->extra_sentences[i];
+        if (s->extra_sinks[i] == SAMPLE_ALL_SINKS && len + buf->len <= OUTPUT_LEN) {
+            memcpy(r->output + len, buf->data, buf->len);
+            len += buf->len;
+        }
+    }
+    r->output_len = (uint16_t) len;
+    atomic_store_explicit(&r->index, n + 1, memory_order_release);
+    atomic_store_explicit(&box->sample_count, n + 1, memory_order_release);
+}
+
+// Print a CLOCK_MONOTONIC time from the black box as UTC
+static void __print_time(FILE *f, const struct blackbox *b, uint64_t ns) {
+    int64_t unixNs = (int64_t) ns + b->epoch_offset_ns;
+    time_t seconds = (time_t) (unixNs / 1000000000LL);
+    struct tm tm;
+    gmtime_r(&seconds, &tm);
+    char when[32];
+    strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+    fprintf(f, "%s.%03d", when, (int) (unixNs / 1000000LL % 1000));
+}
+
+int blackbox_dump(const char *path, FILE *f) {
+    char live[256];
+    if (path == NULL) {
+        snprintf(live, sizeof(live), "/dev/shm%s", BLACKBOX_SHM_NAME);
+        path = live;
+    }
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "can't open black box %s\n", path);
+        return -1;
+    }
+    struct blackbox *b = malloc(sizeof(struct blackbox));
+    if (b == NULL || fread(b, sizeof(*b), 1, in) != 1 || b->magic != BLACKBOX_MAGIC
+            || b->version != BLACKBOX_VERSION || b->sample_size != sizeof(struct blackbox_sample)
+            || b->samples != BLACKBOX_SAMPLES || b->notes != BLACKBOX_NOTES) {
+        fprintf(stderr, "%s isn't a black box from this build\n", path);
+        free(b);
+        fclose(in);
+        return -1;
+    }
+    fclose(in);
+
+    uint64_t noteCount = atomic_load(&b->note_count);
+    uint64_t sampleCount = atomic_load(&b->sample_count);
+    fprintf(f, "black box of pid %d, %llu samples, %llu notes\n", b->pid,
+            (unsigned long long) sampleCount, (unsigned long long) noteCount);
+
+    uint64_t n;
+    for (n = noteCount > BLACKBOX_NOTES ? noteCount - BLACKBOX_NOTES : 0; n < noteCount; n++) {
+        const struct blackbox_note *note = &b->note[n % BLACKBOX_NOTES];
+        if (atomic_load(&note->index) != n + 1) {
+            continue;
+        }
+        __print_time(f, b, note->time_ns);
+        fprintf(f, " %.*s\n", NOTE_LEN, note->text);
+    }
+
+    static const char sourceFlags[] = { 'I', 'G', 'P' };
+    fprintf(f, "%-23s %10s %7s %7s %7s %6s %6s %6s %6s %2s %3s  %s\n", "time (UTC)", "sample", "raw", "mag",
+            "true", "pitch", "roll", "bias", "field", "s", "ex", "sent");
+    // A sample cut short by a crash, and the oldest one it was replacing, are
+    // marked as incomplete and left out
+    for (n = sampleCount > BLACKBOX_SAMPLES ? sampleCount - BLACKBOX_SAMPLES : 0; n < sampleCount; n++) {
+        const struct blackbox_sample *r = &b->sample[n % BLACKBOX_SAMPLES];
+        if (atomic_load(&r->index) != n + 1) {
+            continue;
+        }
+        __print_time(f, b, r->timestamp_ns);
+        fprintf(f, " %10u %7.1f %7.1f %7.1f %6.1f %6.1f %6.2f %6.1f %2c %3d  ", r->sequence,
+                (double) r->heading_raw, (double) r->heading_mag, (double) r->heading_true, (double) r->pitch,
+                (double) r->roll, (double) r->gnss_bias, (double) r->mag_field,
+                r->heading_source < sizeof(sourceFlags) ? sourceFlags[r->heading_source] : '?', r->imu_excluded);
+        int i;
+        for (i = 0; i < r->output_len && i < OUTPUT_LEN; i++) {
+            if (r->output[i] == '\n') {
+                fputc(' ', f);
+            } else if (r->output[i] != '\r') {
+                fputc(r->output[i], f);
+            }
+        }
+        fputc('\n', f);
+    }
+    free(b);
+    return 0;
+}
@@ -0,0 +1,35 @@
+// Beaglebone Blue Heading NMEA UDP Sender - black box
+//
+// Keeps the last few seconds of samples, the sentences sent for them and
+// recent changes of state in a fixed-size file in /dev/shm, so that after a
+// crash there is something to show what led up to it. The file is mapped at
+// startup, and from then on recording is only stores into the mapping: no
+// system calls, no locks. Each record is marked with its position in the
+// ring only once it is complete, so a record cut short by a crash is left out
+// when the black box is read.
+//
+// The systemd service copies the black box somewhere safe whenever the sender
+// stops, for reading later with --dump-blackbox.
+
+#ifndef BLACKBOX_H
+#define BLACKBOX_H
+
+#include <stdio.h>
+
+#include "sample.h"
+
+// Move any black box from a previous run aside and start a new one. Returns 0
+// on success. Without one, recording does nothing.
+int blackbox_open(void);
+
+// Pipeline stage, before the sinks. Records the sample and its sentences, and
+// notes changes in where the heading comes from.
+void blackbox_record(struct sample *s);
+
+// Note a change of state, printf style. Safe from any thread.
+void blackbox_note(const char *format, ...) __attribute__ ((format (printf, 1, 2)));
+
+// Print a black box, from path or the live one if NULL. Returns 0 on success.
+int blackbox_dump(const char *path, FILE *f);
+
+#endif
@@ -0,0 +1,273 @@
+// Beaglebone Blue Heading NMEA UDP Sender - I2C bus scheduling
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+#include <rc/bmp.h>
+
+#include "config.h"
+#include "pipeline.h"
+#include "bus.h"
+
+// What each read puts on the bus, counting the address and register bytes of
+// each transaction: the DMP FIFO count and one packet of quaternion, accel and
+// gyro, the magnetometer status and data, and the barometer's pressure and
+// temperature
+#define DMP_READ_BYTES 36
+#define DMP_READ_TRANSACTIONS 2
+#define MAG_READ_BYTES 14
+#define MAG_READ_TRANSACTIONS 2
+#define BARO_READ_BYTES 9
+#define BARO_READ_TRANSACTIONS 1
+// Time each transaction takes on top of its bits, for the start and stop
+// conditions and the kernel driver
+#define TRANSACTION_US 50.0
+// A barometer read must finish at least this long before the next interrupt
+#define GAP_GUARD_US 500
+// Smoothing of the measured barometer read time, in reads
+#define COST_SMOOTHING 16.0
+
+enum bus_device_id {
+    BUS_DMP,
+    BUS_MAG,
+    BUS_BARO,
+    BUS_DEVICES
+};
+
+struct bus_device {
+    const char *name;
+    // Reads per second wanted and planned, and how long each takes in us.
+    // The barometer's cost is measured as it goes, the others are modelled.
+    double wanted_hz;
+    double planned_hz;
+    double cost_us;
+    uint64_t reads;
+    double busy_us;
+};
+
+static struct bus_device devices[BUS_DEVICES] = {
+    { .name = "dmp" },
+    { .name = "magnetometer" },
+    { .name = "barometer" },
+};
+static int magDivider = 1;
+static uint64_t startNs = 0;
+
+// Only touched by the sample path
+static double lastMagField = 0.0;
+static uint32_t lastMagSequence = 0;
+
+// The gap after the latest sample, handed to the barometer thread by gapReady
+static sem_t gapReady;
+static volatile uint64_t gapEndNs;
+static volatile bool gapMagRead;
+
+// Latest pressure, protected by pressureLock
+static pthread_mutex_t pressureLock = PTHREAD_MUTEX_INITIALIZER;
+static int32_t pressure = 0;
+static uint64_t pressureNs = 0;
+
+static pthread_t baroThread;
+static volatile bool reading = false;
+static uint64_t skippedGap = 0;
+static uint64_t skippedBudget = 0;
+
+static double __read_cost_us(int bytes, int transactions) {
+    return bytes * 9 * 1000.0 / I2C_BUS_KHZ + transactions * TRANSACTION_US;
+}
+
+// Fraction of the bus's time the planned reads take
+static double __planned_load(void) {
+    double us = 0.0;
+    int i;
+    for (i = 0; i < BUS_DEVICES; i++) {
+        us += devices[i].planned_hz * devices[i].cost_us;
+    }
+    return us / 1e6;
+}
+
+void bus_plan(rc_mpu_config_t *conf) {
+    devices[BUS_DMP].cost_us = __read_cost_us(DMP_READ_BYTES, DMP_READ_TRANSACTIONS);
+    devices[BUS_MAG].cost_us = __read_cost_us(MAG_READ_BYTES, MAG_READ_TRANSACTIONS);
+    devices[BUS_BARO].cost_us = __read_cost_us(BARO_READ_BYTES, BARO_READ_TRANSACTIONS);
+    devices[BUS_DMP].wanted_hz = SAMPLE_RATE_HZ;
+    devices[BUS_MAG].wanted_hz = MAG_RATE_HZ;
+    devices[BUS_BARO].wanted_hz = BARO_RATE_HZ;
+
+    // The magnetometer can only be read every whole number of samples, so
+    // read it as seldom as gives at least the rate wanted
+    magDivider = (int) floor(SAMPLE_RATE_HZ / MAG_RATE_HZ);
+    if (magDivider < 1) {
+        magDivider = 1;
+    }
+    devices[BUS_DMP].planned_hz = SAMPLE_RATE_HZ;
+    devices[BUS_MAG].planned_hz = (double) SAMPLE_RATE_HZ / magDivider;
+    devices[BUS_BARO].planned_hz = BARO_RATE_HZ;
+
+    // Over budget, slow the barometer down first, then the magnetometer. The
+    // DMP sets the heading rate so it is left alone.
+    if (__planned_load() > I2C_BUS_BUDGET && devices[BUS_BARO].planned_hz > 0.0) {
+        double spare = I2C_BUS_BUDGET - __planned_load() + devices[BUS_BARO].planned_hz * devices[BUS_BARO].cost_us / 1e6;
+        devices[BUS_BARO].planned_hz = spare > 0.0 ? spare * 1e6 / devices[BUS_BARO].cost_us : 0.0;
+    }
+    while (__planned_load() > I2C_BUS_BUDGET && magDivider < SAMPLE_RATE_HZ) {
+        magDivider++;
+        devices[BUS_MAG].planned_hz = (double) SAMPLE_RATE_HZ / magDivider;
+    }
+    int i;
+    for (i = 0; i < BUS_DEVICES; i++) {
+        if (devices[i].planned_hz < devices[i].wanted_hz) {
+            fprintf(stderr, "I2C bus budget only allows reading the %s at %.1f Hz, not %.1f Hz\n",
+                    devices[i].name, devices[i].planned_hz, devices[i].wanted_hz);
+        }
+    }
+    if (__planned_load() > I2C_BUS_BUDGET) {
+        fprintf(stderr, "I2C bus will be busy %.0f%% of the time, over the budget of %.0f%%\n",
+                __planned_load() * 100.0, I2C_BUS_BUDGET * 100.0);
+    }
+
+    conf->mag_sample_rate_div = magDivider;
+    conf->read_mag_after_callback = 1;
+    startNs = pipeline_now();
+}
+
+// Barometer thread. Woken after each sample, it reads the barometer when a
+// read is due, once any magnetometer read is done, if that leaves time to
+// finish before the next interrupt and the bus has been within budget over
+// the last second. Wakes regularly so it notices when it has been asked to
+// stop.
+static void *__read_baro(__attribute__ ((unused)) void *arg) {
+    uint64_t periodNs = (uint64_t) (1e9 / devices[BUS_BARO].planned_hz);
+    uint64_t nextNs = pipeline_now();
+    uint64_t windowNs = nextNs;
+    double windowUs = 0.0;
+    double otherUs = devices[BUS_DMP].planned_hz * devices[BUS_DMP].cost_us
+            + devices[BUS_MAG].planned_hz * devices[BUS_MAG].cost_us;
+    while (reading) {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += 1;
+        if (sem_timedwait(&gapReady, &t) < 0) {
+            continue;
+        }
+        uint64_t now = pipeline_now();
+        if (now < nextNs) {
+            continue;
+        }
+        if (now - windowNs >= 1000000000ULL) {
+            windowNs = now;
+            windowUs = 0.0;
+        }
+
+        // Leave the magnetometer read to finish first
+        uint64_t start = now;
+        if (gapMagRead) {
+            start += (uint64_t) (devices[BUS_MAG].cost_us * 1000.0);
+        }
+        double cost = devices[BUS_BARO].cost_us;
+        if (start + (uint64_t) (cost * 1000.0) > gapEndNs) {
+            skippedGap++;
+            continue;
+        }
+        if (otherUs + windowUs + cost > I2C_BUS_BUDGET * 1e6) {
+            skippedBudget++;
+            continue;
+        }
+        if (start > now) {
+            struct timespec s = { start / 1000000000ULL, start % 1000000000ULL };
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &s, NULL);
+        }
+
+        rc_bmp_data_t baro;
+        uint64_t before = pipeline_now();
+        int result = rc_bmp_read(&baro);
+        uint64_t after = pipeline_now();
+        double us = (double) (after - before) / 1000.0;
+        devices[BUS_BARO].cost_us += (us - devices[BUS_BARO].cost_us) / COST_SMOOTHING;
+        devices[BUS_BARO].busy_us += us;
+        devices[BUS_BARO].reads++;
+        windowUs += us;
+        nextNs = after - nextNs > periodNs ? after + periodNs : nextNs + periodNs;
+        if (result == 0) {
+            pthread_mutex_lock(&pressureLock);
+            pressure = (int32_t) lround(baro.pressure_pa);
+            pressureNs = after;
+            pthread_mutex_unlock(&pressureLock);
+        }
+    }
+    return NULL;
+}
+
+int bus_start(void) {
+    if (devices[BUS_BARO].planned_hz <= 0.0) {
+        return 0;
+    }
+    if (rc_bmp_init(BMP_OVERSAMPLE_16, BMP_FILTER_OFF)) {
+        fprintf(stderr, "rc_bmp_init failed\n");
+        return -1;
+    }
+    sem_init(&gapReady, 0, 0);
+    reading = true;
+    if (pthread_create(&baroThread, NULL, __read_baro, NULL)) {
+        fprintf(stderr, "create barometer thread failed\n");
+        reading = false;
+        rc_bmp_power_off();
+        return -1;
+    }
+    return 0;
+}
+
+void bus_stop(void) {
+    if (reading) {
+        reading = false;
+        pthread_join(baroThread, NULL);
+        sem_destroy(&gapReady);
+        rc_bmp_power_off();
+    }
+}
+
+void bus_sample(struct sample *s) {
+    devices[BUS_DMP].reads++;
+    devices[BUS_DMP].busy_us += devices[BUS_DMP].cost_us;
+
+    // A magnetometer read after the last sample's callback shows up as a new
+    // field strength in this one
+    if (fabs(s->mag_field - lastMagField) > 0.0) {
+        lastMagField = s->mag_field;
+        lastMagSequence = s->sequence - 1;
+        devices[BUS_MAG].reads++;
+        devices[BUS_MAG].busy_us += devices[BUS_MAG].cost_us;
+    }
+
+    if (reading) {
+        gapEndNs = s->arrival_ns + 1000000000ULL / SAMPLE_RATE_HZ - GAP_GUARD_US * 1000ULL;
+        gapMagRead = (s->sequence - lastMagSequence) % magDivider == 0;
+        sem_post(&gapReady);
+    }
+
+    pthread_mutex_lock(&pressureLock);
+    s->pressure = pressure;
+    s->pressure_valid = pressureNs != 0 && pipeline_now() - pressureNs < 3e9 / devices[BUS_BARO].planned_hz;
+    pthread_mutex_unlock(&pressureLock);
+}
+
+void bus_print_stats(FILE *f) {
+    double elapsed = (double) (pipeline_now() - startNs) / 1e9;
+    double busy = 0.0;
+    fprintf(f, "i2c device       cost us  wanted Hz planned Hz  actual Hz     bus %%\n");
+    int i;
+    for (i = 0; i < BUS_DEVICES; i++) {
+        const struct bus_device *d = &devices[i];
+        fprintf(f, "%-14s %9.0f %10.1f %10.1f %10.1f %9.2f\n", d->name, d->cost_us, d->wanted_hz, d->planned_hz,
+                elapsed > 0.0 ? d->reads / elapsed : 0.0, elapsed > 0.0 ? d->busy_us / elapsed / 1e4 : 0.0);
+        busy += d->busy_us;
+    }
+    fprintf(f, "i2c bus %.2f%% busy (budget %.0f%%), barometer reads skipped: %llu no gap, %llu over budget\n",
+            elapsed > 0.0 ? busy / elapsed / 1e4 : 0.0, I2C_BUS_BUDGET * 100.0,
+            (unsigned long long) skippedGap, (unsigned long long) skippedBudget);
+    fflush(f);
+}
@@ -0,0 +1,40 @@
+// Beaglebone Blue Heading NMEA UDP Sender - I2C bus scheduling
+//
+// The DMP, the magnetometer and the barometer all share I2C_BUS. librobotcontrol
+// reads the DMP on every interrupt and the magnetometer every
+// mag_sample_rate_div interrupts, so at high sample rates the magnetometer
+// reads start to hold up the DMP. This works out from each device's read cost
+// how often the magnetometer can be read, and has librobotcontrol read it
+// after the heading has gone out rather than before. The barometer is read by
+// a thread of our own in the gap before the next interrupt, when the
+// magnetometer read (if any) is done and if the rest of the gap is long enough.
+// Both are held within I2C_BUS_BUDGET of the bus's time.
+
+#ifndef BUS_H
+#define BUS_H
+
+#include <stdio.h>
+#include <rc/mpu.h>
+
+#include "sample.h"
+
+// Work out the read rates that fit in the budget, and set the MPU config's
+// magnetometer divider accordingly. Call before initialising the MPU.
+void bus_plan(rc_mpu_config_t *conf);
+
+// Start reading the barometer, if BARO_RATE_HZ is set. Returns 0 on success.
+int bus_start(void);
+
+// Stop reading the barometer
+void bus_stop(void);
+
+// Pipeline stage, after the sinks. Counts the DMP and magnetometer reads,
+// lets the barometer thread know the gap has started, and adds the latest
+// pressure to the sample.
+void bus_sample(struct sample *s);
+
+// Print each device's read cost and the rate it is getting, and how busy
+// they keep the bus
+void bus_print_stats(FILE *f);
+
+#endif
@@ -0,0 +1,118 @@
+// Beaglebone Blue Heading NMEA UDP Sender - sample clock model
+
+#include <string.h>
+#include <math.h>
+
+#include "config.h"
+#include "clock_model.h"
+
+#define NOMINAL_PERIOD_NS (1e9 / SAMPLE_RATE_HZ)
+// Weight given to each older sample, so the fit covers about
+// CLOCK_MODEL_WINDOW samples
+#define FORGET (1.0 - 1.0 / CLOCK_MODEL_WINDOW)
+// Samples needed before the fit is trusted
+#define WARMUP_SAMPLES 10
+
+void clock_model_init(struct clock_model *m) {
+    memset(m, 0, sizeof(*m));
+    m->period_ns = NOMINAL_PERIOD_NS;
+}
+
+// Throw away the fit but keep the counters
+static void __restart(struct clock_model *m, uint64_t arrival_ns) {
+    m->s0 = m->sx = m->sy = m->sxx = m->sxy = 0.0;
+    m->residual_sq = 0.0;
+    m->period_ns = NOMINAL_PERIOD_NS;
+    m->base_ns = arrival_ns;
+    m->fitted_ns = arrival_ns - (uint64_t) NOMINAL_PERIOD_NS;
+    m->samples = 0;
+    m->consecutive_outliers = 0;
+}
+
+// Move every point k samples further into the past, so x stays relative to
+// the latest sample
+static void __shift_x(struct clock_model *m, double k) {
+    m->sxx = m->sxx - 2.0 * k * m->sx + k * k * m->s0;
+    m->sxy = m->sxy - k * m->sy;
+    m->sx = m->sx - k * m->s0;
+}
+
+// Move the y origin forward by d ns, to keep y small
+static void __shift_y(struct clock_model *m, double d) {
+    m->sy = m->sy - d * m->s0;
+    m->sxy = m->sxy - d * m->sx;
+}
+
+uint64_t clock_model_update(struct clock_model *m, uint64_t arrival_ns) {
+    if (m->samples == 0) {
+        __restart(m, arrival_ns);
+    }
+    double y = (double) (int64_t) (arrival_ns - m->base_ns);
+
+    // Where the fit expects this sample, one period after the last
+    __shift_x(m, 1.0);
+    double expected = (double) (int64_t) (m->fitted_ns - m->base_ns) + m->period_ns;
+    double residual = y - expected;
+
+    if (m->samples >= WARMUP_SAMPLES && fabs(residual) > CLOCK_MODEL_OUTLIER_US * 1000.0) {
+        // Arriving whole periods late means the MPU skipped samples (e.g. a
+        // FIFO overflow), so renumber rather than reject it
+        double skipped = round(residual / m->period_ns);
+        if (skipped >= 1.0 && fabs(residual - skipped * m->period_ns) <= CLOCK_MODEL_OUTLIER_US * 1000.0) {
+            __shift_x(m, skipped);
+            expected += skipped * m->period_ns;
+            residual = y - expected;
+            m->gaps++;
+        } else {
+            // Otherwise it's a one-off delay: give it the fitted time and leave
+            // it out of the fit. If it keeps happening, the fit is wrong, so
+            // start again.
+            m->outliers++;
+            if (++m->consecutive_outliers >= CLOCK_MODEL_MAX_OUTLIERS) {
+                m->resets++;
+                __restart(m, arrival_ns);
+                return clock_model_update(m, arrival_ns);
+            }
+            m->fitted_ns = m->base_ns + (uint64_t) (int64_t) expected;
+            return m->fitted_ns;
+        }
+    }
+    m->consecutive_outliers = 0;
+
+    // Add the point at x = 0, letting older ones fade
+    m->s0 = m->s0 * FORGET + 1.0;
+    m->sx = m->sx * FORGET;
+    m->sxx = m->sxx * FORGET;
+    m->sy = m->sy * FORGET + y;
+    m->sxy = m->sxy * FORGET;
+    m->residual_sq = m->residual_sq * FORGET + residual * residual * (1.0 - FORGET);
+    m->samples++;
+
+    // Refit. Until there are enough points, timestamps are just arrival times.
+    double denominator = m->s0 * m->sxx - m->sx * m->sx;
+    if (m->samples < WARMUP_SAMPLES || denominator <= 0.0) {
+        m->fitted_ns = arrival_ns;
+    } else {
+        m->period_ns = (m->s0 * m->sxy - m->sx * m->sy) / denominator;
+        double intercept = (m->sy - m->period_ns * m->sx) / m->s0;
+        m->fitted_ns = m->base_ns + (uint64_t) (int64_t) llround(intercept);
+    }
+
+    // Rebase y on the latest fitted time
+    __shift_y(m, (double) (int64_t) (m->fitted_ns - m->base_ns));
+    m->base_ns = m->fitted_ns;
+    return m->fitted_ns;
+}
+
+double clock_model_drift_ppm(const struct clock_model *m) {
+    // A shorter period than nominal means the MPU's clock is running fast
+    return (NOMINAL_PERIOD_NS / m->period_ns - 1.0) * 1e6;
+}
+
+void clock_model_print_stats(const struct clock_model *m, FILE *f) {
+    fprintf(f, "sample clock: period %.1f ns, drift %+.1f ppm, jitter %.0f ns rms, "
+            "%u outliers, %u gaps, %u resets\n",
+            m->period_ns, clock_model_drift_ppm(m), sqrt(m->residual_sq),
+            m->outliers, m->gaps, m->resets);
+    fflush(f);
+}
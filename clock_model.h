@@ -0,0 +1,44 @@
+// Beaglebone Blue Heading NMEA UDP Sender - sample clock model
+//
+// The MPU decides when samples are taken, using its own oscillator, which runs
+// at a slightly different rate to ours. The time each sample reaches us also
+// includes interrupt and scheduling delay, which varies. This fits a straight
+// line through (sample number, arrival time), weighted towards recent samples,
+// so each sample can be given a timestamp on that line instead: free of
+// scheduling jitter, but following the MPU's real rate. Each update is O(1).
+
+#ifndef CLOCK_MODEL_H
+#define CLOCK_MODEL_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+struct clock_model {
+    // Exponentially weighted sums over the points in the fit. x is the sample
+    // number relative to the latest sample, y is the arrival time in ns
+    // relative to base_ns.
+    double s0, sx, sy, sxx, sxy;
+    uint64_t base_ns;
+    // Latest fit: ns per sample, and the fitted time of the latest sample
+    double period_ns;
+    uint64_t fitted_ns;
+    // Weighted mean square of accepted residuals, for reporting jitter
+    double residual_sq;
+    uint32_t samples;
+    uint32_t outliers;
+    uint32_t consecutive_outliers;
+    uint32_t gaps;
+    uint32_t resets;
+};
+
+void clock_model_init(struct clock_model *m);
+
+// Add a sample that arrived at arrival_ns, and return its fitted timestamp
+uint64_t clock_model_update(struct clock_model *m, uint64_t arrival_ns);
+
+// How fast the MPU's clock runs compared with ours, in parts per million
+double clock_model_drift_ppm(const struct clock_model *m);
+
+void clock_model_print_stats(const struct clock_model *m, FILE *f);
+
+#endif
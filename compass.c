@@ -0,0 +1,192 @@
+// Beaglebone Blue Heading NMEA UDP Sender - adaptive compass fusion
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+
+#include "config.h"
+#include "angles.h"
+#include "compass.h"
+
+// How quickly we learn the usual magnetic field strength, in seconds
+#define FIELD_TIME_CONSTANT 60.0
+// Smoothing of the turn rate, in seconds
+#define TURN_RATE_TIME_CONSTANT 0.5
+
+// Headings here are in degrees in the MPU's own convention, like heading_raw
+struct compass_filter {
+    bool started;
+    double heading;
+    double lastYaw;
+    uint64_t lastNs;
+    // Usual field strength in uT
+    double fieldRef;
+    double tau;
+    // What tau is based on: turn rate in deg/s, and how far the field strength
+    // is from usual as a fraction
+    double turnRate;
+    double disturbance;
+};
+
+static struct compass_filter filter;
+
+// One step of the complementary filter: follow the DMP yaw's change since the
+// last sample, and pull towards the magnetometer heading with time constant
+// tau. tau moves between tauMin and tauMax.
+static void __fuse(struct compass_filter *f, double tauMin, double tauMax,
+        double yaw, double mag, double field, double dt) {
+    if (!f->started) {
+        f->heading = mag;
+        f->lastYaw = yaw;
+        f->fieldRef = field;
+        f->tau = tauMin;
+        f->started = true;
+        return;
+    }
+    double dYaw = wrap_180(yaw - f->lastYaw);
+    f->lastYaw = yaw;
+    f->heading = wrap_180(f->heading + dYaw);
+
+    f->turnRate += (fabs(dYaw) / dt - f->turnRate) * dt / (TURN_RATE_TIME_CONSTANT + dt);
+    f->disturbance = f->fieldRef > 0.0 ? fabs(field / f->fieldRef - 1.0) : 0.0;
+    f->fieldRef += (field - f->fieldRef) * dt / (FIELD_TIME_CONSTANT + dt);
+
+    // Lengthen the time constant at once, but shorten it again gradually, so
+    // the end of a turn or disturbance doesn't snap the heading to the mag
+    double level = fmax(f->turnRate / COMPASS_TURN_RATE_FULL, f->disturbance / COMPASS_DISTURBANCE_FULL);
+    double target = tauMin + (tauMax - tauMin) * fmin(level, 1.0);
+    if (target >= f->tau) {
+        f->tau = target;
+    } else {
+        f->tau += (target - f->tau) * dt / (COMPASS_RECOVERY_S + dt);
+    }
+
+    f->heading = wrap_180(f->heading + wrap_180(mag - f->heading) * dt / (f->tau + dt));
+}
+
+void compass_fuse(struct sample *s) {
+    double dt = 1.0 / SAMPLE_RATE_HZ;
+    if (filter.started && s->timestamp_ns > filter.lastNs) {
+        dt = (double) (s->timestamp_ns - filter.lastNs) / 1e9;
+    }
+    filter.lastNs = s->timestamp_ns;
+    __fuse(&filter, COMPASS_TIME_CONSTANT_MIN, COMPASS_TIME_CONSTANT_MAX,
+            s->dmp_yaw, s->compass_raw, s->mag_field, dt);
+    s->heading_raw = filter.heading;
+}
+
+void compass_reset(void) {
+    filter.started = false;
+}
+
+void compass_print_stats(FILE *f) {
+    fprintf(f, "compass fusion: time constant %.1f s, turn rate %.1f deg/s, field %.1f uT (%+.0f%% from usual)\n",
+            filter.tau, filter.turnRate, filter.fieldRef * (1.0 + filter.disturbance), filter.disturbance * 100.0);
+    fflush(f);
+}
+
+// Synthetic recording for compass_benchmark(). Each two-minute cycle is steady,
+// then turns 90 degrees at 10 deg/s, then steady, then turns back at 15 deg/s.
+// The DMP yaw has a 2% scale error and drifts at 0.3 deg/min; the magnetometer
+// has 1.5 degrees of noise and an error of 0.3 s times the turn rate while
+// turning. In the third cycle, something magnetic nearby shifts the
+// magnetometer by 20 degrees and the field strength by 40% for 15 s.
+#define BENCH_CYCLES 10
+#define BENCH_CYCLE_S 120.0
+
+struct bench_point {
+    double heading;
+    double yaw;
+    double mag;
+    double field;
+    // 0 steady, 1 turning or just after, 2 disturbed
+    int phase;
+};
+
+static double __gaussian(uint32_t *random) {
+    double u[2];
+    int i;
+    for (i = 0; i < 2; i++) {
+        *random ^= *random << 13;
+        *random ^= *random >> 17;
+        *random ^= *random << 5;
+        u[i] = ((double) *random + 1.0) / 4294967297.0;
+    }
+    return sqrt(-2.0 * log(u[0])) * cos(2.0 * M_PI * u[1]);
+}
+
+static struct bench_point __bench_point(long n, uint32_t *random) {
+    double t = (double) n / SAMPLE_RATE_HZ;
+    double c = fmod(t, BENCH_CYCLE_S);
+    int cycle = (int) (t / BENCH_CYCLE_S);
+    double rate = 0.0;
+    double heading;
+    if (c < 60.0) {
+        heading = 0.0;
+    } else if (c < 69.0) {
+        rate = 10.0;
+        heading = (c - 60.0) * rate;
+    } else if (c < 100.0) {
+        heading = 90.0;
+    } else if (c < 106.0) {
+        rate = -15.0;
+        heading = 90.0 + (c - 100.0) * rate;
+    } else {
+        heading = 0.0;
+    }
+    struct bench_point p;
+    p.heading = wrap_180(heading + 30.0);
+    p.yaw = wrap_180(heading * 1.02 + t * 0.3 / 60.0 + 0.01 * __gaussian(random) + 100.0);
+    p.mag = wrap_180(p.heading + 1.5 * __gaussian(random) + 0.3 * rate);
+    p.field = 50.0 * (1.0 + 0.01 * __gaussian(random));
+    p.phase = (c >= 60.0 && c < 79.0) || (c >= 100.0 && c < 116.0) ? 1 : 0;
+    if (cycle == 2 && c >= 30.0 && c < 45.0) {
+        p.mag = wrap_180(p.mag + 20.0);
+        p.field *= 1.4;
+        p.phase = 2;
+    }
+    return p;
+}
+
+static void __bench_run(FILE *f, const char *name, double tauMin, double tauMax) {
+    struct compass_filter bf = { 0 };
+    uint32_t random = 2463534242U;
+    double sumSq[2] = { 0.0, 0.0 };
+    long count[2] = { 0, 0 };
+    double disturbedMax = 0.0;
+    double dt = 1.0 / SAMPLE_RATE_HZ;
+    long total = (long) (BENCH_CYCLES * BENCH_CYCLE_S * SAMPLE_RATE_HZ);
+    long n;
+    for (n = 0; n < total; n++) {
+        struct bench_point p = __bench_point(n, &random);
+        __fuse(&bf, tauMin, tauMax, p.yaw, p.mag, p.field, dt);
+        // Let the first cycle settle
+        if (n < (long) (BENCH_CYCLE_S * SAMPLE_RATE_HZ)) {
+            continue;
+        }
+        double error = fabs(wrap_180(bf.heading - p.heading));
+        if (p.phase == 2) {
+            disturbedMax = fmax(disturbedMax, error);
+        } else {
+            sumSq[p.phase] += error * error;
+            count[p.phase]++;
+        }
+    }
+    fprintf(f, "%-24s %12.2f %12.2f %14.2f\n", name,
+            sqrt(sumSq[0] / (double) count[0]), sqrt(sumSq[1] / (double) count[1]), disturbedMax);
+}
+
+void compass_benchmark(FILE *f) {
+    static const double fixed[] = { 0.5, 1.0, 2.0, 5.0, 10.0, 20.0, 40.0 };
+    fprintf(f, "%-24s %12s %12s %14s\n", "compass fusion", "steady rms", "turning rms", "disturbed max");
+    char name[32];
+    unsigned int i;
+    for (i = 0; i < sizeof(fixed) / sizeof(fixed[0]); i++) {
+        snprintf(name, sizeof(name), "fixed %.1f s", fixed[i]);
+        __bench_run(f, name, fixed[i], fixed[i]);
+    }
+    snprintf(name, sizeof(name), "adaptive %.1f-%.1f s", COMPASS_TIME_CONSTANT_MIN, COMPASS_TIME_CONSTANT_MAX);
+    __bench_run(f, name, COMPASS_TIME_CONSTANT_MIN, COMPASS_TIME_CONSTANT_MAX);
+    fflush(f);
+}
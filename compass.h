@@ -0,0 +1,33 @@
+// Beaglebone Blue Heading NMEA UDP Sender - adaptive compass fusion
+//
+// librobotcontrol blends the gyro-based DMP yaw with the magnetometer heading
+// using one fixed time constant: long, and the heading is slow to recover from
+// gyro drift; short, and magnetometer noise and disturbances come straight
+// through. This does the blend itself, varying the time constant with the
+// turn rate and with how far the magnetic field strength is from normal, so
+// the gyro is trusted in turns and disturbances and the magnetometer when
+// steady and clean.
+
+#ifndef COMPASS_H
+#define COMPASS_H
+
+#include <stdio.h>
+
+#include "sample.h"
+
+// Pipeline stage. Replaces the sample's raw heading with our own fusion of its
+// DMP yaw and magnetometer heading.
+void compass_fuse(struct sample *s);
+
+// Start again from the next sample, e.g. after the MPU is restarted
+void compass_reset(void);
+
+// Print the fusion's current time constant and what it is based on
+void compass_print_stats(FILE *f);
+
+// Run the fusion over a synthetic recording with turns and a magnetic
+// disturbance, for a range of fixed time constants and the adaptive one, and
+// print the errors of each
+void compass_benchmark(FILE *f);
+
+#endif
@@ -0,0 +1,271 @@
+// Beaglebone Blue Heading NMEA UDP Sender - build configuration
+//
+// If using this for yourself, you may need to customise the #define values
+// in this file to reflect the orientation of your board in your robot, and
+// where the data should be sent.
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+// The code treats the Beaglebone Blue's +X direction as the heading of the robot. If your
+// board is fitted in a different orientation, or is not exactly lined up, set the
+// HEADING_OFFSET value here. This value will be added (i.e. clockwise rotation) to the
+// magnetometer-based heading to give the result. So if +X points to the left of your robot,
+// this should be 90. If +X points to the right, -90. And if +X points backwards, 180.
+#define HEADING_OFFSET 90.0
+// The magnetometer produces readings based on magnetic north, whereas the HDT message
+// produced by this code should contain a heading based on true north. Enter your local
+// magnetic declination here to apply this offset. Positive declination is when mag
+// north is east/clockwise of true north.
+#define LOCAL_MAGNETIC_DECLINATION 0.1
+// This code sends the heading data to the host and port specified here.
+#define UDP_SEND_SERVER "127.0.0.1"
+#define UDP_SEND_PORT 2021
+// Set the sample rate between 4 & 200 Hz. HDT messages will be sent at this rate. 10 Hz
+// recommended.
+#define SAMPLE_RATE_HZ 10
+// Set the I2C bus on which to communicate with the 9DOF MPU. For the Beaglebone Blue and
+// Beaglebone Black Robotics Cape, this is 2.
+#define I2C_BUS 2
+// Set a GPIO pin to use for an interrupt, in the DMP mode the MPU controls timing and
+// will interrupt us when it has new data
+#define GPIO_INT_PIN_CHIP 3
+#define GPIO_INT_PIN_PIN  21
+// Real-time priority (1-99) for the thread that handles MPU interrupts, so that
+// other busy processes can't delay the heading output. 0 leaves it at normal
+// priority.
+#define DMP_INTERRUPT_PRIORITY 0
+// How long we aim to take from the MPU interrupt to the heading being sent, in
+// microseconds. The self test (--selftest) says whether this is achievable.
+#define LATENCY_TARGET_US 5000
+// Set to 1 to run the self test every time we start, printing the results
+// (to the journal when running as a service) before starting normally
+#define SELFTEST_AT_STARTUP 0
+// Compass fusion. librobotcontrol blends the gyro and magnetometer headings
+// with a fixed time constant, which either lags or is noisy. Set
+// COMPASS_ADAPTIVE to 1 to blend them here instead, with a time constant (in
+// seconds) that moves from the MIN when steady up to the MAX when turning at
+// COMPASS_TURN_RATE_FULL deg/s, or when the magnetic field strength is off its
+// usual value by the fraction COMPASS_DISTURBANCE_FULL. It comes back down over
+// COMPASS_RECOVERY_S. `--bench` shows how well different values do.
+#define COMPASS_ADAPTIVE 0
+#define COMPASS_TIME_CONSTANT_MIN 2.0
+#define COMPASS_TIME_CONSTANT_MAX 20.0
+#define COMPASS_TURN_RATE_FULL 10.0
+#define COMPASS_DISTURBANCE_FULL 0.2
+#define COMPASS_RECOVERY_S 3.0
+// I2C bus scheduling. The DMP, the magnetometer and the barometer share
+// I2C_BUS, which runs at I2C_BUS_KHZ. The magnetometer is read every few
+// samples, just often enough for MAG_RATE_HZ, and after the heading has gone
+// out, so raising SAMPLE_RATE_HZ doesn't mean more magnetometer reads getting
+// in the DMP's way. The barometer is read BARO_RATE_HZ times a second (0 for
+// never) in the gap before the next sample, and the pressure added to XDR.
+// Both are slowed down if need be to keep the bus busy no more than
+// I2C_BUS_BUDGET of the time.
+#define I2C_BUS_KHZ 400
+#define I2C_BUS_BUDGET 0.3
+#define MAG_RATE_HZ 2.5
+#define BARO_RATE_HZ 0
+// Redundant IMUs (--imu). The heading from each extra IMU votes with the MPU's.
+// A unit whose heading, smoothed over IMU_RESIDUAL_TIME_S seconds, is more than
+// IMU_FAULT_DEG from the median of the others is left out of the heading, until
+// it has been back within IMU_RECOVER_DEG for IMU_RECOVER_S seconds.
+#define IMU_FAULT_DEG 10.0
+#define IMU_RECOVER_DEG 3.0
+#define IMU_RESIDUAL_TIME_S 1.0
+#define IMU_RECOVER_S 5.0
+// Set to 1 to work out the heading in fixed point rather than floating point,
+// from the MPU's reading through to the sentences sent, so the same readings
+// give exactly the same output on any machine. Also --fixed-point. Not
+// available with COMPASS_ADAPTIVE or --imu. `--bench` compares the two.
+#define FIXED_POINT 0
+// Plugins loaded with --plugin are called in the sample path, and each call
+// should take no more than PLUGIN_BUDGET_US. A plugin that goes over
+// PLUGIN_OVERRUNS times in a row, or ten times over in one call, is moved to
+// its own thread, and given samples through a queue of PLUGIN_QUEUE_LEN.
+#define PLUGIN_BUDGET_US 100
+#define PLUGIN_OVERRUNS 3
+#define PLUGIN_QUEUE_LEN 32
+// Talker ID to use at the start of each NMEA sentence. "GP" is used for compatibility
+// with `gpsd`, which will ignore other talker IDs. "HE" would be more correct.
+#define TALKER_ID "GP"
+
+// The NMEA sentences that are sent each sample, in the order they appear in the
+// datagram. Set the second value to 1 to enable a sentence or 0 to disable it.
+//   HDT - true heading
+//   HDM - magnetic heading, i.e. without LOCAL_MAGNETIC_DECLINATION applied
+//   THS - true heading with a mode flag, "A" when corrected by GNSS or "E" when IMU only
+//   XDR - pitch and roll of the board, in degrees, as transducer measurements, and
+//         the air pressure in bar if BARO_RATE_HZ is set
+//   GGA - dead-reckoned position, see POSITION_CORRECTION_S below
+//   RMC - dead-reckoned position, speed and track, see POSITION_CORRECTION_S below
+//   MWD - true wind direction and speed, see WIND_INPUT_PORT below
+//   MWV - true wind angle and speed, relative to the bow, see WIND_INPUT_PORT below
+// In the normal build these are only defaults and can be changed at startup with
+// the --sentences option. In the specialised build (`make specialised`) they are
+// fixed here, so disabled sentences are compiled out of the sample path entirely.
+#define OUTPUT_SENTENCES(X) \
+    X(HDT, 1) \
+    X(HDM, 0) \
+    X(THS, 0) \
+    X(XDR, 0) \
+    X(GGA, 0) \
+    X(RMC, 0) \
+    X(MWD, 0) \
+    X(MWV, 0)
+
+// If you have a dual-antenna GNSS compass, set the UDP port it sends NMEA HDT or THS
+// sentences to here, and its heading will be blended with the MPU's. The MPU still
+// sets the rate and latency of the output, the GNSS corrects its drift over time.
+// GGA, RMC and VHW sent to the same port are used for dead-reckoned position.
+// 0 disables this.
+#define GNSS_INPUT_PORT 0
+// Typical delay between the GNSS measuring a heading and it arriving here, in ms
+#define GNSS_LATENCY_MS 150
+// Time constant of the blend in seconds. Longer is smoother, shorter follows the
+// GNSS more closely.
+#define GNSS_TIME_CONSTANT 10.0
+// If no GNSS heading has arrived for this many seconds, the last correction is
+// held and output is flagged as IMU only
+#define GNSS_TIMEOUT 3.0
+// Dead-reckoned position, sent as GGA and RMC when they are in the sentences.
+// The GNSS receiver's own GGA and RMC fixes, sent to GNSS_INPUT_PORT a few times
+// a second, are carried forward every sample along the heading at the speed
+// over ground, or at the speed through the water from VHW if there is none.
+// Output is marked as estimated (GGA quality 6, RMC mode E). The difference
+// between each fix and the estimate is taken out with a time constant of
+// POSITION_CORRECTION_S seconds, unless it is over POSITION_JUMP_M metres, when
+// the estimate jumps to the fix. With no fix for POSITION_TIMEOUT_S seconds,
+// no position is sent.
+#define POSITION_CORRECTION_S 1.0
+#define POSITION_JUMP_M 50.0
+#define POSITION_TIMEOUT_S 5.0
+
+// True wind. Set the UDP port a wind instrument sends apparent wind (MWV) to,
+// along with boat speed through the water (VHW) or over ground (VTG), and MWD
+// and MWV sentences with the true wind are sent whenever a reading arrives,
+// worked out with the heading sampled closest to when the wind was measured.
+// That is taken to be WIND_LATENCY_MS before it arrives. Boat speed older than
+// WIND_SPEED_TIMEOUT_S is not used. 0 disables this.
+#define WIND_INPUT_PORT 0
+#define WIND_LATENCY_MS 100
+#define WIND_SPEED_TIMEOUT_S 3.0
+
+// Sample clock model. Each sample is timestamped from a line fitted through the
+// arrival times of about the last CLOCK_MODEL_WINDOW samples, which removes
+// scheduling jitter but follows any drift in the MPU's clock. A sample arriving
+// more than CLOCK_MODEL_OUTLIER_US away from the line is left out of the fit,
+// and after CLOCK_MODEL_MAX_OUTLIERS in a row the fit starts again.
+#define CLOCK_MODEL_WINDOW 600
+#define CLOCK_MODEL_OUTLIER_US 3000
+#define CLOCK_MODEL_MAX_OUTLIERS 10
+
+// Set to 1 to schedule UDP output with SO_TXTIME. Each datagram is handed to the
+// kernel TXTIME_LEAD_US early with a launch time on a fixed grid, one sample
+// period apart and offset by TXTIME_PHASE_US, and the kernel sends it at exactly
+// that time. The lead must cover the worst delay between the MPU interrupt and
+// our sending. Needs the etf or fq qdisc on the outgoing interface, e.g.
+// `tc qdisc replace dev eth0 root fq`. Without one, datagrams are sent
+// immediately as normal.
+#define TXTIME_ENABLE 0
+#define TXTIME_LEAD_US 5000
+#define TXTIME_PHASE_US 0
+
+// InfluxDB output (--influx URL). Samples are written as line protocol to this
+// measurement, which can include tags, e.g. "heading,boat=myboat". They are sent
+// in batches of INFLUX_BATCH_SAMPLES. The fields written can be changed with
+// --influx-fields; available are heading, heading_mag, pitch, roll, gnss_bias,
+// source, imu_voters and imu_excluded. For HTTP URLs without a path, the
+// database below is used, and if you use InfluxDB 2 you can give a token.
+#define INFLUX_MEASUREMENT "heading"
+#define INFLUX_BATCH_SAMPLES 10
+#define INFLUX_DEFAULT_FIELDS "heading,pitch,roll"
+#define INFLUX_DATABASE "boat"
+#define INFLUX_TOKEN ""
+
+// MQTT output (--mqtt HOST:PORT[/TOPIC_PREFIX]). Heading, pitch and roll are
+// published at QoS 0 to TOPIC_PREFIX/heading, /pitch and /roll every sample.
+// Set MQTT_BATCH_SAMPLES above 1 to instead publish that many samples at a time
+// to TOPIC_PREFIX/samples, one "time_ms,heading,pitch,roll" line per sample.
+#define MQTT_TOPIC_PREFIX "boat"
+#define MQTT_CLIENT_ID "heading_nmea_udp_sender"
+#define MQTT_KEEPALIVE_S 30
+#define MQTT_BATCH_SAMPLES 1
+
+// Capture of everything sent (--pcap FILE), for opening in Wireshark. A new
+// file is started when the current one reaches PCAP_ROTATE_KB, and this many
+// old ones are kept as FILE.1, FILE.2 and so on.
+#define PCAP_ROTATE_KB 10240
+#define PCAP_ROTATE_FILES 4
+// While capturing, events are looked for in each sample and indexed in FILE.idx
+// beside each capture file (FILE.1.idx and so on for older ones), with where
+// in the capture they are. An event is a turn faster than EVENT_TURN_RATE_DPS
+// (smoothed over EVENT_TURN_TIME_S), the magnetic field strength moving more
+// than EVENT_MAG_DISTURBANCE (as a fraction) from its average over
+// EVENT_MAG_TIME_S, a gap of more than EVENT_STALL_SAMPLES sample periods
+// between samples, or the heading changing by more than EVENT_JUMP_DEG from
+// one sample to the next. --events FILE.idx lists them.
+#define EVENT_TURN_RATE_DPS 15.0
+#define EVENT_TURN_TIME_S 0.5
+#define EVENT_MAG_DISTURBANCE 0.2
+#define EVENT_MAG_TIME_S 30.0
+#define EVENT_STALL_SAMPLES 3
+#define EVENT_JUMP_DEG 10.0
+
+// Failover between two instances (--failover). The standby takes over if the
+// active one hasn't produced a sample for this many sample periods, or at once
+// if it exits. It predicts the heading from the last one for at most
+// FAILOVER_MAX_PREDICT_S while its own MPU starts up. An active instance that
+// hasn't produced its first sample within FAILOVER_STARTUP_S, say because it
+// has hung starting the MPU, is taken over from too. The heartbeat is in
+// /dev/shm under this name.
+#define FAILOVER_TIMEOUT_SAMPLES 2
+#define FAILOVER_MAX_PREDICT_S 10.0
+#define FAILOVER_STARTUP_S 30.0
+#define FAILOVER_SHM_NAME "/heading_nmea_udp_sender"
+
+// Black box. The last BLACKBOX_SAMPLES samples with the sentences sent for
+// them, and the last BLACKBOX_NOTES changes of state such as load shedding,
+// are kept in /dev/shm under this name, where they outlast a crash. The one
+// from the previous run is moved to the same name with ".prev" on the end at
+// startup. --dump-blackbox [FILE] prints either.
+#define BLACKBOX_SAMPLES 1000
+#define BLACKBOX_NOTES 256
+#define BLACKBOX_SHM_NAME "/heading_nmea_udp_sender.blackbox"
+
+// Gateway mode (--gateway PORT). Each worker receives up to GATEWAY_BATCH
+// datagrams at a time, of up to GATEWAY_MAX_DATAGRAM bytes.
+#define GATEWAY_BATCH 64
+#define GATEWAY_MAX_DATAGRAM 1500
+
+// Load shedding. Once a second, if processing samples took more than
+// SHED_BUDGET_HIGH of the sample period on average, or the CPU pressure in
+// /proc/pressure/cpu ("some avg10", in percent) is over SHED_PSI_HIGH, one more
+// kind of optional work is dropped: first sentences other than
+// SHED_KEEP_SENTENCES, then InfluxDB and MQTT output, then --pcap capture, then
+// stage timing, then --plugin plugins. They are restored one at a time once
+// both have been below the LOW values for SHED_RESTORE_S seconds.
+#define SHED_ENABLE 1
+#define SHED_BUDGET_HIGH 0.2
+#define SHED_BUDGET_LOW 0.05
+#define SHED_PSI_HIGH 40.0
+#define SHED_PSI_LOW 10.0
+#define SHED_RESTORE_S 10
+#define SHED_KEEP_SENTENCES SENTENCE_BIT(SENTENCE_HDT)
+
+// Set to 1 to time every pipeline stage on every sample. Send the process SIGUSR1
+// to print the timings (they appear in the journal when running as a service).
+// Costs a clock read per stage, so set to 0 on a heavily loaded board.
+#define STAGE_TIMING 1
+
+// Soak test settings (--soak DAYS). The test runs this many times faster than
+// real time, and fails if memory use grows by more than the given amount after
+// the first simulated hour, if 99% of samples don't get from the MPU to the
+// sinks within the given time, or if the heading sent differs from the
+// synthetic heading by more than the given number of degrees.
+#define SOAK_SPEEDUP 100
+#define SOAK_MAX_RSS_GROWTH_KB 64
+#define SOAK_MAX_P99_LATENCY_US 2000
+#define SOAK_MAX_HEADING_ERROR 0.001
+
+#endif
@@ -0,0 +1,199 @@
+// Beaglebone Blue Heading NMEA UDP Sender - event index
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+
+#include "config.h"
+#include "angles.h"
+#include "pipeline.h"
+#include "events.h"
+
+// Events waiting for the pcap writer thread to write their datagram. Events
+// are rare, so this only fills if the writer is stuck, and then they are
+// dropped.
+#define EVENT_RING_LEN 64
+// A turn or disturbance has to fall back below this fraction of its threshold
+// before another one is noted
+#define TURN_END 0.8
+#define MAG_END 0.5
+
+static const char *typeNames[EVENT_TYPES] = {
+    "turn", "magnetic disturbance", "dmp stall", "heading jump"
+};
+static const char *typeUnits[EVENT_TYPES] = {
+    "deg/s", "", "ms", "deg"
+};
+
+struct pending_event {
+    unsigned int capture;
+    struct event_record record;
+};
+
+// Single producer (the sample path), single consumer (the pcap writer thread)
+static struct pending_event ring[EVENT_RING_LEN];
+static atomic_uint ringHead = 0;
+static atomic_uint ringTail = 0;
+static uint64_t dropped = 0;
+
+static FILE *indexFile = NULL;
+
+// Detector state, only touched by the sample path
+static bool haveLast = false;
+static double lastHeading;
+static uint64_t lastArrivalNs;
+static uint64_t lastTimestampNs;
+static double turnRate = 0.0;
+static bool turning = false;
+static double magMean = 0.0;
+static bool disturbed = false;
+
+static void __note(const struct sample *s, unsigned int capture, enum event_type type, double value) {
+    unsigned int head = atomic_load_explicit(&ringHead, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ringTail, memory_order_acquire) >= EVENT_RING_LEN) {
+        dropped++;
+        return;
+    }
+    struct pending_event *e = &ring[head % EVENT_RING_LEN];
+    e->capture = capture;
+    e->record = (struct event_record) {
+        .time_ns = (uint64_t) ((int64_t) s->timestamp_ns + pipeline_epoch_offset()),
+        .sequence = s->sequence,
+        .type = (uint16_t) type,
+        .value = (float) value,
+    };
+    atomic_store_explicit(&ringHead, head + 1, memory_order_release);
+}
+
+void events_detect(const struct sample *s, unsigned int capture, bool record) {
+    if (!haveLast) {
+        haveLast = true;
+        lastHeading = s->heading_true;
+        lastArrivalNs = s->arrival_ns;
+        lastTimestampNs = s->timestamp_ns;
+        return;
+    }
+    double dt = (double) (s->timestamp_ns - lastTimestampNs) / 1e9;
+    if (dt <= 0.0) {
+        dt = 1.0 / SAMPLE_RATE_HZ;
+    }
+
+    // A jump is noted on its own, and left out of the turn rate
+    double change = wrap_180(s->heading_true - lastHeading);
+    if (fabs(change) > EVENT_JUMP_DEG) {
+        if (record) {
+            __note(s, capture, EVENT_HEADING_JUMP, change);
+        }
+    } else {
+        turnRate += (change / dt - turnRate) * dt / (EVENT_TURN_TIME_S + dt);
+    }
+    if (!turning && fabs(turnRate) > EVENT_TURN_RATE_DPS) {
+        turning = true;
+        if (record) {
+            __note(s, capture, EVENT_TURN, turnRate);
+        }
+    } else if (turning && fabs(turnRate) < EVENT_TURN_RATE_DPS * TURN_END) {
+        turning = false;
+    }
+
+    // The magnetometer may not have been read yet in the first few samples
+    double deviation = magMean > 0.0 ? (s->mag_field - magMean) / magMean : 0.0;
+    if (magMean <= 0.0) {
+        magMean = s->mag_field;
+    } else if (!disturbed && fabs(deviation) > EVENT_MAG_DISTURBANCE) {
+        disturbed = true;
+        if (record) {
+            __note(s, capture, EVENT_MAGNETIC, deviation);
+        }
+    } else if (disturbed && fabs(deviation) < EVENT_MAG_DISTURBANCE * MAG_END) {
+        disturbed = false;
+    }
+    magMean += (s->mag_field - magMean) * dt / (EVENT_MAG_TIME_S + dt);
+
+    uint64_t gapNs = s->arrival_ns - lastArrivalNs;
+    if (gapNs > EVENT_STALL_SAMPLES * 1000000000ULL / SAMPLE_RATE_HZ && record) {
+        __note(s, capture, EVENT_DMP_STALL, (double) gapNs / 1e6);
+    }
+
+    lastHeading = s->heading_true;
+    lastArrivalNs = s->arrival_ns;
+    lastTimestampNs = s->timestamp_ns;
+}
+
+int events_open(const char *path) {
+    indexFile = fopen(path, "w");
+    if (indexFile == NULL) {
+        return -1;
+    }
+    struct event_index_header h = {
+        .magic = EVENT_INDEX_MAGIC,
+        .version = EVENT_INDEX_VERSION,
+        .record_size = sizeof(struct event_record),
+    };
+    fwrite(&h, sizeof(h), 1, indexFile);
+    return 0;
+}
+
+void events_write(unsigned int capture, uint32_t offset) {
+    unsigned int tail = atomic_load_explicit(&ringTail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ringHead, memory_order_acquire);
+    while (tail != head && (int) (ring[tail % EVENT_RING_LEN].capture - capture) <= 0) {
+        struct event_record *r = &ring[tail % EVENT_RING_LEN].record;
+        r->offset = offset;
+        if (indexFile != NULL) {
+            fwrite(r, sizeof(*r), 1, indexFile);
+        }
+        tail++;
+        atomic_store_explicit(&ringTail, tail, memory_order_release);
+    }
+}
+
+void events_flush(void) {
+    if (indexFile != NULL) {
+        fflush(indexFile);
+    }
+}
+
+void events_close(void) {
+    if (indexFile != NULL) {
+        fclose(indexFile);
+        indexFile = NULL;
+    }
+    if (dropped > 0) {
+        fprintf(stderr, "%llu events dropped from the index\n", (unsigned long long) dropped);
+        dropped = 0;
+    }
+}
+
+int events_list(const char *path, FILE *f) {
+    FILE *in = fopen(path, "r");
+    if (in == NULL) {
+        fprintf(stderr, "can't open event index %s\n", path);
+        return -1;
+    }
+    struct event_index_header h;
+    if (fread(&h, sizeof(h), 1, in) != 1 || h.magic != EVENT_INDEX_MAGIC
+            || h.version != EVENT_INDEX_VERSION || h.record_size != sizeof(struct event_record)) {
+        fprintf(stderr, "%s isn't an event index\n", path);
+        fclose(in);
+        return -1;
+    }
+    fprintf(f, "%-23s %-20s %10s %-5s %10s %10s\n", "time (UTC)", "event", "value", "", "sample", "offset");
+    struct event_record r;
+    while (fread(&r, sizeof(r), 1, in) == 1) {
+        time_t seconds = (time_t) (r.time_ns / 1000000000ULL);
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        char when[32];
+        strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", &tm);
+        fprintf(f, "%s.%03d %-20s %10.2f %-5s %10u %10u\n", when, (int) (r.time_ns / 1000000ULL % 1000),
+                r.type < EVENT_TYPES ? typeNames[r.type] : "unknown", (double) r.value,
+                r.type < EVENT_TYPES ? typeUnits[r.type] : "", r.sequence, r.offset);
+    }
+    fclose(in);
+    return 0;
+}
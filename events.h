@@ -0,0 +1,77 @@
+// Beaglebone Blue Heading NMEA UDP Sender - event index
+//
+// While capturing with --pcap, each sample is run past a few detectors for
+// things worth finding again later: hard turns, magnetic disturbances, stalls
+// of the DMP and jumps in the heading. Each detector keeps a few numbers of
+// state, so this costs the same small amount every sample. An event is noted
+// with the capture datagram it goes with, and when the pcap writer thread
+// writes that datagram, it writes the event and the datagram's offset in the
+// file to an index beside it. Tools can then read the index and seek straight
+// to each event instead of reading the whole capture.
+//
+// The index is an event_index_header followed by event_records, in the
+// machine's byte order.
+
+#ifndef EVENTS_H
+#define EVENTS_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "sample.h"
+
+#define EVENT_INDEX_MAGIC 0x49454e48    // "HNEI"
+#define EVENT_INDEX_VERSION 1
+
+enum event_type {
+    EVENT_TURN,             // value is the turn rate in degrees/s, + to starboard
+    EVENT_MAGNETIC,         // value is the field strength's change as a fraction of its average
+    EVENT_DMP_STALL,        // value is the gap since the last sample in ms
+    EVENT_HEADING_JUMP,     // value is the change in heading in degrees
+    EVENT_TYPES
+};
+
+struct event_index_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+};
+
+struct event_record {
+    // Unix time of the sample the event was found in, in ns
+    uint64_t time_ns;
+    // Offset in the capture file of the pcap record of the first datagram
+    // sent after it was found
+    uint32_t offset;
+    uint32_t sequence;
+    uint16_t type;
+    uint16_t reserved;
+    float value;
+};
+
+// Run the detectors on a sample, noting any events against capture, the ring
+// position of the next datagram to be captured. Only the sample path may call
+// this.
+void events_detect(const struct sample *s, unsigned int capture, bool record);
+
+// Start a new index at path. Returns 0 on success, leaving the caller to
+// report a failure.
+int events_open(const char *path);
+
+// Write the events noted against captures up to and including capture, which
+// is about to be written at offset in the capture file. Only the pcap writer
+// thread may call this and the two below.
+void events_write(unsigned int capture, uint32_t offset);
+
+// Flush the index so it can be read while we are still running
+void events_flush(void);
+
+// Close the index. Events noted against captures that haven't been written
+// yet are kept for the next one.
+void events_close(void);
+
+// Print the events in an index. Returns 0 on success.
+int events_list(const char *path, FILE *f);
+
+#endif
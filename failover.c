@@ -0,0 +1,274 @@
+// Beaglebone Blue Heading NMEA UDP Sender - hot-standby failover
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "config.h"
+#include "angles.h"
+#include "pipeline.h"
+#include "failover.h"
+
+// Smoothing of the rate of turn used for prediction, in seconds
+#define RATE_TIME_CONSTANT 0.5
+// Attempts at reading a consistent sample from the heartbeat. By the time the
+// standby reads it the active instance should have stopped writing, so only a
+// writer that died or was stopped part way through uses them all up.
+#define SNAPSHOT_TRIES 1000
+
+// The shared heartbeat
+struct heartbeat {
+    // Bumped by each instance that becomes active
+    atomic_uint term;
+    atomic_int pid;
+    // Set once the active instance has produced a sample this term
+    atomic_bool beating;
+    // When the active instance last produced a sample, or became active if it
+    // hasn't yet, CLOCK_MONOTONIC ns
+    atomic_uint_fast64_t beat_ns;
+    // The last sample, under a sequence lock: seq is odd while it is written
+    atomic_uint seq;
+    uint64_t timestamp_ns;
+    double heading_raw;
+    double rate;
+    double pitch;
+    double roll;
+};
+
+// The last sample from the heartbeat, for prediction
+struct snapshot {
+    uint64_t timestamp_ns;
+    double heading_raw;
+    double rate;
+    double pitch;
+    double roll;
+};
+
+static struct heartbeat *hb = NULL;
+static unsigned int ourTerm = 0;
+
+// Rate of turn, worked out by the active instance
+static double lastHeading = 0.0;
+static uint64_t lastTimestampNs = 0;
+static double rate = 0.0;
+
+// Prediction after taking over
+static struct snapshot last;
+static uint64_t takeoverNs = 0;
+static rc_mpu_data_t *predictData = NULL;
+static void (*predictHandle)(void) = NULL;
+static pthread_mutex_t predictLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t predictThread;
+static volatile bool predicting = false;
+
+static uint64_t __timeout_ns(void) {
+    return (uint64_t) FAILOVER_TIMEOUT_SAMPLES * 1000000000ULL / SAMPLE_RATE_HZ;
+}
+
+// Read the last sample from the heartbeat. Returns false if it couldn't be
+// read consistently, as when the active instance stopped part way through
+// writing it.
+static bool __read_snapshot(struct snapshot *s) {
+    int i;
+    for (i = 0; i < SNAPSHOT_TRIES; i++) {
+        unsigned int seq = atomic_load_explicit(&hb->seq, memory_order_acquire);
+        if (seq & 1) {
+            continue;
+        }
+        s->timestamp_ns = hb->timestamp_ns;
+        s->heading_raw = hb->heading_raw;
+        s->rate = hb->rate;
+        s->pitch = hb->pitch;
+        s->roll = hb->roll;
+        atomic_thread_fence(memory_order_acquire);
+        if (atomic_load_explicit(&hb->seq, memory_order_relaxed) == seq) {
+            return true;
+        }
+    }
+    return false;
+}
+
+int failover_init(void) {
+    int fd = shm_open(FAILOVER_SHM_NAME, O_RDWR | O_CREAT, 0600);
+    if (fd < 0 || ftruncate(fd, sizeof(struct heartbeat)) < 0) {
+        fprintf(stderr, "can't open failover heartbeat %s\n", FAILOVER_SHM_NAME);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(struct heartbeat), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        fprintf(stderr, "can't map failover heartbeat %s\n", FAILOVER_SHM_NAME);
+        return -1;
+    }
+    hb = p;
+    return 0;
+}
+
+// Whether the active instance is still there. It has failed if its process
+// has gone, if it has stopped producing samples, or if it never started. The
+// heartbeat is stamped when it becomes active, so a live process that hangs
+// before its first sample is still timed out.
+static bool __active_alive(void) {
+    int pid = atomic_load(&hb->pid);
+    if (pid <= 0 || pid == getpid() || (kill(pid, 0) < 0 && errno == ESRCH)) {
+        return false;
+    }
+    uint64_t timeoutNs = atomic_load(&hb->beating) ? __timeout_ns() : (uint64_t) (FAILOVER_STARTUP_S * 1e9);
+    return pipeline_now() - atomic_load(&hb->beat_ns) < timeoutNs;
+}
+
+bool failover_other_active(void) {
+    return __active_alive();
+}
+
+void failover_take_over(void) {
+    takeoverNs = pipeline_now();
+    atomic_store(&hb->beating, false);
+    atomic_store(&hb->beat_ns, takeoverNs);
+    atomic_store(&hb->pid, getpid());
+    // An instance that died part way through writing a sample leaves seq odd,
+    // even across restarts, as the heartbeat outlives it
+    atomic_store(&hb->seq, (atomic_load(&hb->seq) + 1) & ~1u);
+    ourTerm = atomic_fetch_add(&hb->term, 1) + 1;
+}
+
+int failover_standby(volatile int *running) {
+    // Check four times per sample period, so a failure is noticed quickly
+    struct timespec interval = { 0, 250000000L / SAMPLE_RATE_HZ };
+    while (*running) {
+        nanosleep(&interval, NULL);
+        if (!__active_alive()) {
+            int pid = atomic_load(&hb->pid);
+            bool beating = atomic_load(&hb->beating) && __read_snapshot(&last);
+            failover_take_over();
+            if (beating) {
+                fprintf(stderr, "taking over from pid %d, %.0f ms after its last sample\n",
+                        pid, (double) (takeoverNs - last.timestamp_ns) / 1e6);
+            } else {
+                // It never produced a sample we can read, so there is nothing
+                // to predict from
+                fprintf(stderr, "taking over from pid %d with no sample to predict from\n", pid);
+                last.timestamp_ns = 0;
+            }
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Send a predicted sample every period, carrying on the last heading at the
+// last rate of turn, until the MPU is running or FAILOVER_MAX_PREDICT_S has
+// passed
+static void *__predict(__attribute__ ((unused)) void *arg) {
+    uint64_t periodNs = 1000000000ULL / SAMPLE_RATE_HZ;
+    uint64_t next = pipeline_now();
+    while (predicting) {
+        struct timespec t = { next / 1000000000ULL, next % 1000000000ULL };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+        pthread_mutex_lock(&predictLock);
+        double elapsed = (double) (pipeline_now() - last.timestamp_ns) / 1e9;
+        if (predicting && elapsed > FAILOVER_MAX_PREDICT_S) {
+            fprintf(stderr, "MPU not running after %.0f s, stopped predicting heading\n", elapsed);
+            predicting = false;
+        }
+        if (predicting) {
+            double heading = wrap_180(last.heading_raw + last.rate * elapsed);
+            predictData->compass_heading = heading * DEG_TO_RAD;
+            predictData->compass_heading_raw = predictData->compass_heading;
+            predictData->dmp_TaitBryan[TB_YAW_Z] = predictData->compass_heading;
+            predictData->dmp_TaitBryan[TB_PITCH_X] = last.pitch * DEG_TO_RAD;
+            predictData->dmp_TaitBryan[TB_ROLL_Y] = last.roll * DEG_TO_RAD;
+            predictHandle();
+        }
+        pthread_mutex_unlock(&predictLock);
+        next += periodNs;
+    }
+    return NULL;
+}
+
+bool failover_predict_start(rc_mpu_data_t *data, void (*handle)(void)) {
+    if (last.timestamp_ns == 0) {
+        return false;
+    }
+    predictData = data;
+    predictHandle = handle;
+    predicting = true;
+    if (pthread_create(&predictThread, NULL, __predict, NULL)) {
+        fprintf(stderr, "failed to start predicting heading\n");
+        predicting = false;
+        predictHandle = NULL;
+        return false;
+    }
+    return true;
+}
+
+bool failover_sensor_live(void) {
+    if (predictHandle == NULL) {
+        return false;
+    }
+    pthread_mutex_lock(&predictLock);
+    predicting = false;
+    pthread_mutex_unlock(&predictLock);
+    pthread_join(predictThread, NULL);
+    predictHandle = NULL;
+    fprintf(stderr, "MPU running %.1f s after taking over\n", (double) (pipeline_now() - takeoverNs) / 1e9);
+    return true;
+}
+
+void failover_heartbeat(struct sample *s) {
+    // Fence ourselves off if another instance has taken over. Leave the MPU
+    // alone on the way out, as the new active instance may be using it.
+    if (atomic_load(&hb->term) != ourTerm) {
+        fprintf(stderr, "another instance has taken over, stopping\n");
+        _exit(EXIT_FAILURE);
+    }
+
+    if (predicting) {
+        s->heading_source = HEADING_SOURCE_PREDICTED;
+    }
+
+    if (lastTimestampNs != 0 && s->timestamp_ns > lastTimestampNs) {
+        double dt = (double) (s->timestamp_ns - lastTimestampNs) / 1e9;
+        rate += (wrap_180(s->heading_raw - lastHeading) / dt - rate) * dt / (RATE_TIME_CONSTANT + dt);
+    }
+    lastHeading = s->heading_raw;
+    lastTimestampNs = s->timestamp_ns;
+
+    unsigned int seq = atomic_load_explicit(&hb->seq, memory_order_relaxed);
+    atomic_store_explicit(&hb->seq, seq + 1, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    hb->timestamp_ns = s->timestamp_ns;
+    hb->heading_raw = s->heading_raw;
+    hb->rate = rate;
+    hb->pitch = s->pitch;
+    hb->roll = s->roll;
+    atomic_store_explicit(&hb->seq, seq + 2, memory_order_release);
+    atomic_store(&hb->beat_ns, pipeline_now());
+    atomic_store(&hb->beating, true);
+}
+
+void failover_close(void) {
+    if (predictHandle != NULL) {
+        pthread_mutex_lock(&predictLock);
+        predicting = false;
+        pthread_mutex_unlock(&predictLock);
+        pthread_join(predictThread, NULL);
+        predictHandle = NULL;
+    }
+    if (hb != NULL) {
+        munmap(hb, sizeof(struct heartbeat));
+        hb = NULL;
+    }
+}
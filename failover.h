@@ -0,0 +1,54 @@
+// Beaglebone Blue Heading NMEA UDP Sender - hot-standby failover
+//
+// Two instances run with --failover. The first to start is active: it reads
+// the MPU and publishes a heartbeat with its latest heading in shared memory
+// on every sample. The other stands by, watching the heartbeat. If the active
+// instance dies or stops producing samples, the standby takes over within
+// FAILOVER_TIMEOUT_SAMPLES sample periods: it sends a heading predicted from
+// the last one and its rate of turn straight away, while it brings up the MPU,
+// then switches to real samples. Each takeover bumps a term number in shared
+// memory, and an instance that finds the term has moved on since it became
+// active exits at once without touching the MPU, so two instances never both
+// send.
+
+#ifndef FAILOVER_H
+#define FAILOVER_H
+
+#include <stdbool.h>
+#include <rc/mpu.h>
+
+#include "sample.h"
+
+// Map the shared heartbeat. Returns 0 on success.
+int failover_init(void);
+
+// Whether another instance is currently active
+bool failover_other_active(void);
+
+// Become the active instance
+void failover_take_over(void);
+
+// Wait until the active instance fails, then take over. Returns 0 having
+// taken over, or -1 if *running was cleared first.
+int failover_standby(volatile int *running);
+
+// Start sending predicted samples, by setting *data and calling handle() once
+// per sample period on a thread of its own, until the MPU is running. data
+// must not be the one the MPU writes to. Only after failover_standby().
+// Returns true if predicted samples are being sent.
+bool failover_predict_start(rc_mpu_data_t *data, void (*handle)(void));
+
+// Call with each real sample before handling it. The first call stops the
+// predicted samples, waiting for the last to finish, and returns true so the
+// caller can switch to the real readings and reset anything that shouldn't
+// carry over from them.
+bool failover_sensor_live(void);
+
+// Pipeline stage. Publishes the sample in the heartbeat, or exits if another
+// instance has taken over.
+void failover_heartbeat(struct sample *s);
+
+// Stop predicting and unmap the heartbeat
+void failover_close(void);
+
+#endif
@@ -0,0 +1,64 @@
+// Beaglebone Blue Heading NMEA UDP Sender - fast number formatting
+//
+// Minimal replacements for printf's %u and %.Nf, for sinks that format a lot
+// of numbers per sample. No locale, no parsing of a format string. Each writes
+// to p, which must have room, and returns the end of what it wrote.
+
+#ifndef FASTFMT_H
+#define FASTFMT_H
+
+#include <stdint.h>
+#include <math.h>
+
+static inline char *fmt_uint(char *p, uint64_t v) {
+    char digits[20];
+    int n = 0;
+    do {
+        digits[n++] = (char) ('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    while (n > 0) {
+        *p++ = digits[--n];
+    }
+    return p;
+}
+
+static inline char *fmt_int(char *p, int64_t v) {
+    if (v < 0) {
+        *p++ = '-';
+        return fmt_uint(p, (uint64_t) -v);
+    }
+    return fmt_uint(p, (uint64_t) v);
+}
+
+// Fixed point with the given number of decimal places (0-6), rounded to
+// nearest. Non-finite values come out as 0.
+static inline char *fmt_fixed(char *p, double v, int decimals) {
+    static const uint64_t scales[] = { 1, 10, 100, 1000, 10000, 100000, 1000000 };
+    uint64_t scale = scales[decimals];
+    if (!isfinite(v)) {
+        v = 0.0;
+    }
+    if (v < 0.0) {
+        v = -v;
+        // Don't write "-0.0"
+        if (v * (double) scale >= 0.5) {
+            *p++ = '-';
+        }
+    }
+    uint64_t scaled = (uint64_t) (v * (double) scale + 0.5);
+    p = fmt_uint(p, scaled / scale);
+    if (decimals > 0) {
+        uint64_t frac = scaled % scale;
+        *p++ = '.';
+        int i;
+        for (i = decimals - 1; i >= 0; i--) {
+            p[i] = (char) ('0' + frac % 10);
+            frac /= 10;
+        }
+        p += decimals;
+    }
+    return p;
+}
+
+#endif
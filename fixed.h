@@ -0,0 +1,59 @@
+// Beaglebone Blue Heading NMEA UDP Sender - fixed-point angles
+//
+// With FIXED_POINT (or --fixed-point), the heading path works in binary angles
+// instead of doubles: a uint32_t in which the full circle is 2^32, so adding
+// an offset wraps by itself and rounding to tenths of a degree is a multiply
+// and a shift. Apart from converting the MPU's and barometer's readings on the
+// way in, nothing from there to the digits sent uses floating point, so the
+// same readings give exactly the same sentences on the BeagleBone and on x86.
+// GNSS headings are converted from their digits, without floating point.
+
+#ifndef FIXED_H
+#define FIXED_H
+
+#include <stdint.h>
+#include <math.h>
+
+typedef uint32_t bam_t;
+
+#define BAM_PER_TURN 4294967296.0
+
+// A binary angle from degrees, for constants from config.h
+#define BAM_FROM_DEG(deg) ((bam_t) (int64_t) ((deg) * (BAM_PER_TURN / 360.0)))
+
+// A binary angle from a reading in radians, rounded to the nearest
+static inline bam_t bam_from_rad(double rad) {
+    return (bam_t) llround(rad * (BAM_PER_TURN / (2.0 * M_PI)));
+}
+
+// A binary angle from a whole number of 1/scale degrees, such as a heading
+// read with nmea_scaled(), rounded to the nearest. scale must be under 10^7.
+static inline bam_t bam_from_scaled(int64_t v, int64_t scale) {
+    int64_t turn = 360 * scale;
+    v %= turn;
+    if (v < 0) {
+        v += turn;
+    }
+    return (bam_t) ((((uint64_t) v << 32) + (uint64_t) turn / 2) / (uint64_t) turn);
+}
+
+// An angle in tenths of a degree, rounded to the nearest, as 0 to 3599 for a
+// heading or -1800 to 1800 for an angle either side of zero
+static inline int32_t bam_tenths(bam_t a) {
+    return (int32_t) ((((uint64_t) a * 3600 + 0x80000000ULL) >> 32) % 3600);
+}
+
+static inline int32_t bam_tenths_signed(bam_t a) {
+    return (int32_t) (((int64_t) (int32_t) a * 3600 + 0x80000000LL) >> 32);
+}
+
+// Back to degrees, for anything outside the heading path that wants a double
+static inline double bam_to_deg(bam_t a) {
+    return (double) a * (360.0 / BAM_PER_TURN);
+}
+
+static inline double bam_to_deg_signed(bam_t a) {
+    return (double) (int32_t) a * (360.0 / BAM_PER_TURN);
+}
+
+#endif
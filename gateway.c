@@ -0,0 +1,371 @@
+// Beaglebone Blue Heading NMEA UDP Sender - gateway mode
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "pipeline.h"
+#include "gateway.h"
+
+#define ROUTES_MAX 1024
+#define BOAT_ID_LEN 32
+// Hash table of boats, at least twice as many slots as there can be boats
+#define TABLE_SIZE 2048
+// Most datagrams queued for one sendmmsg()
+#define SEND_BATCH 1024
+
+struct route {
+    char boat[BOAT_ID_LEN];
+    struct sockaddr_in dest;
+};
+
+// A boat's destinations are dests[first] to dests[first + count - 1]: its
+// own routes followed by the "*" ones. Empty slots have len 0.
+struct boat {
+    char id[BOAT_ID_LEN];
+    int len;
+    int first;
+    int count;
+};
+
+struct worker {
+    int index;
+    pthread_t thread;
+    int fd;
+    struct mmsghdr recvMessages[GATEWAY_BATCH];
+    struct iovec recvIov[GATEWAY_BATCH];
+    struct sockaddr_in recvAddr[GATEWAY_BATCH];
+    // The part of each receive buffer that was filled, for sending
+    struct iovec sendIov[GATEWAY_BATCH];
+    struct mmsghdr sendMessages[SEND_BATCH];
+    int sendCount;
+    // Written only by the worker, once per batch
+    atomic_uint_fast64_t received;
+    atomic_uint_fast64_t sent;
+    atomic_uint_fast64_t unrouted;
+    atomic_uint_fast64_t errors;
+    char buf[GATEWAY_BATCH][GATEWAY_MAX_DATAGRAM];
+} __attribute__ ((aligned(64)));
+
+static struct route routes[ROUTES_MAX];
+static int routeCount = 0;
+
+// Built by gateway_start() and never changed while the workers run
+static struct boat table[TABLE_SIZE];
+static struct sockaddr_in *dests = NULL;
+static int wildcardFirst = 0;
+static int wildcardCount = 0;
+
+static struct worker *workers = NULL;
+static int workerCount = 0;
+static volatile bool relaying = false;
+
+// For rates in gateway_print_stats()
+static uint64_t lastStatsNs = 0;
+static uint64_t lastReceived = 0;
+static uint64_t lastSent = 0;
+
+static uint32_t __hash(const char *id, int len) {
+    uint32_t h = 2166136261U;
+    int i;
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) id[i]) * 16777619U;
+    }
+    return h;
+}
+
+static struct boat *__find_boat(const char *id, int len) {
+    uint32_t i = __hash(id, len) & (TABLE_SIZE - 1);
+    while (table[i].len != 0) {
+        if (table[i].len == len && memcmp(table[i].id, id, len) == 0) {
+            return &table[i];
+        }
+        i = (i + 1) & (TABLE_SIZE - 1);
+    }
+    return &table[i];
+}
+
+// Which boat a datagram is from: the "s:" source in its TAG block if it has
+// one, otherwise its IP address. Returns the length of the ID put in id.
+static int __boat_id(const char *buf, int len, const struct sockaddr_in *from, char *id) {
+    if (len > 0 && buf[0] == '\\') {
+        const char *end = memchr(buf + 1, '\\', len - 1);
+        const char *p = buf + 1;
+        while (end != NULL && p + 2 < end) {
+            const char *fieldEnd = p;
+            while (fieldEnd < end && *fieldEnd != ',' && *fieldEnd != '*') {
+                fieldEnd++;
+            }
+            if (p[0] == 's' && p[1] == ':' && fieldEnd - p - 2 < BOAT_ID_LEN) {
+                int n = fieldEnd - p - 2;
+                memcpy(id, p + 2, n);
+                return n;
+            }
+            if (fieldEnd == end || *fieldEnd == '*') {
+                break;
+            }
+            p = fieldEnd + 1;
+        }
+    }
+    inet_ntop(AF_INET, &from->sin_addr, id, BOAT_ID_LEN);
+    return strlen(id);
+}
+
+// Send everything queued. A failure stops sendmmsg() part way, so skip the
+// failed one and carry on with the rest.
+static void __flush(struct worker *w, uint64_t *sent, uint64_t *errors) {
+    int done = 0;
+    while (done < w->sendCount) {
+        int n = sendmmsg(w->fd, &w->sendMessages[done], w->sendCount - done, 0);
+        if (n < 0) {
+            (*errors)++;
+            done++;
+            continue;
+        }
+        *sent += n;
+        done += n;
+    }
+    w->sendCount = 0;
+}
+
+static void *__work(void *arg) {
+    struct worker *w = arg;
+    uint64_t received = 0, sent = 0, unrouted = 0, errors = 0;
+    char id[BOAT_ID_LEN];
+    while (relaying) {
+        int i;
+        for (i = 0; i < GATEWAY_BATCH; i++) {
+            w->recvMessages[i].msg_hdr.msg_namelen = sizeof(w->recvAddr[i]);
+        }
+        int count = recvmmsg(w->fd, w->recvMessages, GATEWAY_BATCH, MSG_WAITFORONE, NULL);
+        if (count <= 0) {
+            continue;
+        }
+        received += count;
+
+        for (i = 0; i < count; i++) {
+            int len = w->recvMessages[i].msg_len;
+            int idLen = __boat_id(w->buf[i], len, &w->recvAddr[i], id);
+            struct boat *b = __find_boat(id, idLen);
+            int first = b->len != 0 ? b->first : wildcardFirst;
+            int destCount = b->len != 0 ? b->count : wildcardCount;
+            if (destCount == 0) {
+                unrouted++;
+                continue;
+            }
+            w->sendIov[i].iov_base = w->buf[i];
+            w->sendIov[i].iov_len = len;
+            int j;
+            for (j = 0; j < destCount; j++) {
+                if (w->sendCount == SEND_BATCH) {
+                    __flush(w, &sent, &errors);
+                }
+                struct msghdr *msg = &w->sendMessages[w->sendCount++].msg_hdr;
+                msg->msg_name = &dests[first + j];
+                msg->msg_namelen = sizeof(dests[first + j]);
+                msg->msg_iov = &w->sendIov[i];
+                msg->msg_iovlen = 1;
+            }
+        }
+        // Everything must go before the receive buffers are reused
+        __flush(w, &sent, &errors);
+
+        atomic_store_explicit(&w->received, received, memory_order_relaxed);
+        atomic_store_explicit(&w->sent, sent, memory_order_relaxed);
+        atomic_store_explicit(&w->unrouted, unrouted, memory_order_relaxed);
+        atomic_store_explicit(&w->errors, errors, memory_order_relaxed);
+    }
+    return NULL;
+}
+
+int gateway_add_route(const char *spec) {
+    if (routeCount >= ROUTES_MAX) {
+        fprintf(stderr, "too many routes, %s not added\n", spec);
+        return -1;
+    }
+    struct route *r = &routes[routeCount];
+    char host[48];
+    int port;
+    if (sscanf(spec, "%31[^=]=%47[^:]:%d", r->boat, host, &port) < 3 || port <= 0 || port > 65535
+            || inet_pton(AF_INET, host, &r->dest.sin_addr) != 1) {
+        fprintf(stderr, "bad route %s, expected BOAT=HOST:PORT\n", spec);
+        return -1;
+    }
+    r->dest.sin_family = AF_INET;
+    r->dest.sin_port = htons(port);
+    routeCount++;
+    return 0;
+}
+
+// Build the boat table from the routes
+static int __build_table(void) {
+    int boats = 0;
+    int i, j;
+    for (i = 0; i < routeCount; i++) {
+        if (strcmp(routes[i].boat, "*") == 0) {
+            wildcardCount++;
+        } else {
+            struct boat *b = __find_boat(routes[i].boat, strlen(routes[i].boat));
+            if (b->len == 0) {
+                snprintf(b->id, sizeof(b->id), "%s", routes[i].boat);
+                b->len = strlen(b->id);
+                boats++;
+            }
+            b->count++;
+        }
+    }
+    // Each boat also gets a copy of the wildcard destinations, so one slice
+    // of dests covers all of a boat's
+    int total = routeCount + boats * wildcardCount;
+    dests = calloc(total > 0 ? total : 1, sizeof(*dests));
+    int next = 0;
+    for (i = 0; i < TABLE_SIZE; i++) {
+        struct boat *b = &table[i];
+        if (b->len == 0) {
+            continue;
+        }
+        b->first = next;
+        for (j = 0; j < routeCount; j++) {
+            if (strcmp(routes[j].boat, b->id) == 0) {
+                dests[next++] = routes[j].dest;
+            }
+        }
+        for (j = 0; j < routeCount; j++) {
+            if (strcmp(routes[j].boat, "*") == 0) {
+                dests[next++] = routes[j].dest;
+            }
+        }
+        b->count = next - b->first;
+    }
+    wildcardFirst = next;
+    for (j = 0; j < routeCount; j++) {
+        if (strcmp(routes[j].boat, "*") == 0) {
+            dests[next++] = routes[j].dest;
+        }
+    }
+    return boats;
+}
+
+int gateway_start(int port, int count) {
+    if (routeCount == 0) {
+        fprintf(stderr, "gateway needs at least one --route\n");
+        return -1;
+    }
+    int cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (count <= 0) {
+        count = cpus > 0 ? cpus : 1;
+    }
+    int boats = __build_table();
+    workers = aligned_alloc(64, count * sizeof(*workers));
+    if (workers == NULL) {
+        fprintf(stderr, "can't allocate gateway workers\n");
+        return -1;
+    }
+    memset(workers, 0, count * sizeof(*workers));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+    int one = 1;
+    relaying = true;
+    for (workerCount = 0; workerCount < count; workerCount++) {
+        struct worker *w = &workers[workerCount];
+        w->index = workerCount;
+        if ((w->fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0
+                || setsockopt(w->fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0
+                || bind(w->fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            fprintf(stderr, "create gateway socket on port %d failed\n", port);
+            if (w->fd >= 0) {
+                close(w->fd);
+            }
+            gateway_stop();
+            return -1;
+        }
+        // The receive timeout lets workers notice when they are asked to stop
+        setsockopt(w->fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        int i;
+        for (i = 0; i < GATEWAY_BATCH; i++) {
+            w->recvIov[i].iov_base = w->buf[i];
+            w->recvIov[i].iov_len = GATEWAY_MAX_DATAGRAM;
+            w->recvMessages[i].msg_hdr.msg_iov = &w->recvIov[i];
+            w->recvMessages[i].msg_hdr.msg_iovlen = 1;
+            w->recvMessages[i].msg_hdr.msg_name = &w->recvAddr[i];
+        }
+        if (pthread_create(&w->thread, NULL, __work, w)) {
+            fprintf(stderr, "create gateway worker thread failed\n");
+            close(w->fd);
+            gateway_stop();
+            return -1;
+        }
+        // Keep each worker on its own CPU where there are enough
+        if (cpus > 1) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(workerCount % cpus, &set);
+            pthread_setaffinity_np(w->thread, sizeof(set), &set);
+        }
+    }
+    lastStatsNs = pipeline_now();
+    fprintf(stderr, "gateway on port %d: %d workers, %d boats, %d routes\n", port, workerCount, boats, routeCount);
+    return 0;
+}
+
+void gateway_print_stats(FILE *f) {
+    fprintf(f, "%-12s %14s %14s %12s %12s\n", "worker", "received", "sent", "unrouted", "errors");
+    uint64_t totals[4] = { 0, 0, 0, 0 };
+    int i;
+    for (i = 0; i < workerCount; i++) {
+        struct worker *w = &workers[i];
+        uint64_t counts[4] = {
+            atomic_load_explicit(&w->received, memory_order_relaxed),
+            atomic_load_explicit(&w->sent, memory_order_relaxed),
+            atomic_load_explicit(&w->unrouted, memory_order_relaxed),
+            atomic_load_explicit(&w->errors, memory_order_relaxed),
+        };
+        fprintf(f, "%-12d %14llu %14llu %12llu %12llu\n", i, (unsigned long long) counts[0],
+                (unsigned long long) counts[1], (unsigned long long) counts[2], (unsigned long long) counts[3]);
+        int j;
+        for (j = 0; j < 4; j++) {
+            totals[j] += counts[j];
+        }
+    }
+    fprintf(f, "%-12s %14llu %14llu %12llu %12llu\n", "total", (unsigned long long) totals[0],
+            (unsigned long long) totals[1], (unsigned long long) totals[2], (unsigned long long) totals[3]);
+    uint64_t now = pipeline_now();
+    double seconds = (double) (now - lastStatsNs) / 1e9;
+    fprintf(f, "%.0f received/s, %.0f sent/s over the last %.1f s\n",
+            (double) (totals[0] - lastReceived) / seconds, (double) (totals[1] - lastSent) / seconds, seconds);
+    lastStatsNs = now;
+    lastReceived = totals[0];
+    lastSent = totals[1];
+    fflush(f);
+}
+
+void gateway_stop(void) {
+    relaying = false;
+    int i;
+    for (i = 0; i < workerCount; i++) {
+        pthread_join(workers[i].thread, NULL);
+        close(workers[i].fd);
+    }
+    workerCount = 0;
+    free(workers);
+    workers = NULL;
+    free(dests);
+    dests = NULL;
+}
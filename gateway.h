@@ -0,0 +1,36 @@
+// Beaglebone Blue Heading NMEA UDP Sender - gateway mode
+//
+// For the shore side: instead of reading an MPU, receive the NMEA heading
+// streams of many boats on one UDP port and pass each datagram on to the
+// clients subscribed to that boat. A boat is identified by the source in the
+// NMEA TAG block in front of its sentences (e.g. "\s:boat1*hh\$GPHDT..."),
+// or failing that by its IP address.
+//
+// Each worker thread has its own SO_REUSEPORT socket on the port, so the
+// kernel spreads boats across them and each boat's datagrams stay in order on
+// one worker. Workers receive in batches with recvmmsg() and send everything a
+// batch fans out to with sendmmsg(), straight from the receive buffers. The
+// routing table is fixed before the workers start, and each worker keeps its
+// own counters, so they share nothing that needs a lock.
+
+#ifndef GATEWAY_H
+#define GATEWAY_H
+
+#include <stdio.h>
+
+// Add a route from a "BOAT=HOST:PORT" spec, sending boat BOAT's datagrams to
+// HOST:PORT. BOAT can be a TAG block source, an IP address, or "*" for every
+// boat. Returns 0 on success.
+int gateway_add_route(const char *spec);
+
+// Start the given number of workers receiving on port, or one per CPU if
+// workers is 0. Returns 0 on success.
+int gateway_start(int port, int workers);
+
+// Print per-worker and total counters, and rates since the last call
+void gateway_print_stats(FILE *f);
+
+// Stop the workers
+void gateway_stop(void);
+
+#endif
@@ -0,0 +1,220 @@
+// Beaglebone Blue Heading NMEA UDP Sender - GNSS heading blend
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "angles.h"
+#include "gnss.h"
+#include "nmea.h"
+#include "pipeline.h"
+#include "position.h"
+#include "fixed.h"
+
+// IMU heading history, one entry per sample, long enough to look back past
+// GNSS_LATENCY_MS at the highest sample rate
+#define HISTORY_LEN 256
+// Decimal places of GNSS heading kept in fixed point
+#define HEADING_DECIMALS 4
+#define HEADING_SCALE 10000
+
+// Latest fix from the receiver thread, protected by fixLock
+static pthread_mutex_t fixLock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t fixSequence = 0;
+static double fixHeading;
+static bam_t fixHeadingBam;
+static uint64_t fixTimeNs;
+
+static int gnssSocket = -1;
+static pthread_t receiverThread;
+static volatile bool receiving = false;
+
+// Blend state, only touched by the sample path
+static double history[HISTORY_LEN];
+static bam_t historyBam[HISTORY_LEN];
+static uint32_t historyCount = 0;
+static uint32_t lastFixSequence = 0;
+static uint64_t lastFixTimeNs = 0;
+static double bias = 0.0;
+static int32_t biasBam = 0;
+static bool haveBias = false;
+
+// If a sentence is a valid HDT, or THS that isn't flagged invalid, return its
+// heading in *heading, and as a binary angle straight from its digits in
+// *headingBam
+static bool __parse_heading(const struct nmea_sentence *sentence, double *heading, bam_t *headingBam) {
+    bool ths = nmea_is(sentence, "THS");
+    if (!ths && !nmea_is(sentence, "HDT")) {
+        return false;
+    }
+    struct nmea_field field = nmea_field(sentence, 1);
+    int64_t scaled;
+    if (!nmea_decimal(field, heading) || !nmea_scaled(field, HEADING_DECIMALS, &scaled)) {
+        return false;
+    }
+    *headingBam = bam_from_scaled(scaled, HEADING_SCALE);
+    return !ths || nmea_char(nmea_field(sentence, 2)) != 'V';
+}
+
+// Receiver thread. Takes every valid heading from each datagram, and passes
+// everything on for dead reckoning. The socket has a receive timeout so this
+// notices when it has been asked to stop.
+static void *__receive(__attribute__ ((unused)) void *arg) {
+    char buf[512];
+    struct nmea_parser parser;
+    nmea_init(&parser);
+    while (receiving) {
+        ssize_t len = recv(gnssSocket, buf, sizeof(buf), 0);
+        if (len < 0) {
+            continue;
+        }
+        uint64_t now = pipeline_now();
+        nmea_feed(&parser, buf, len);
+        struct nmea_sentence sentence;
+        while (nmea_next(&parser, &sentence)) {
+            double heading;
+            bam_t headingBam;
+            if (__parse_heading(&sentence, &heading, &headingBam)) {
+                pthread_mutex_lock(&fixLock);
+                fixHeading = heading;
+                fixHeadingBam = headingBam;
+                fixTimeNs = now;
+                fixSequence++;
+                pthread_mutex_unlock(&fixLock);
+            } else {
+                position_input(&sentence, now);
+            }
+        }
+    }
+    return NULL;
+}
+
+int gnss_start(void) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(GNSS_INPUT_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((gnssSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0
+            || bind(gnssSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "create GNSS input socket failed\n");
+        return -1;
+    }
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(gnssSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    receiving = true;
+    if (pthread_create(&receiverThread, NULL, __receive, NULL)) {
+        fprintf(stderr, "create GNSS receiver thread failed\n");
+        close(gnssSocket);
+        return -1;
+    }
+    return 0;
+}
+
+void gnss_stop(void) {
+    if (gnssSocket >= 0) {
+        receiving = false;
+        pthread_join(receiverThread, NULL);
+        close(gnssSocket);
+        gnssSocket = -1;
+    }
+}
+
+// The fixed-point version of the bias filter below, with the gain in Q16
+static void __update_bias_fixed(int32_t error, uint64_t dtNs) {
+    if (!haveBias) {
+        biasBam = error;
+        haveBias = true;
+        return;
+    }
+    if (dtNs > (uint64_t) (GNSS_TIMEOUT * 1e9)) {
+        dtNs = (uint64_t) (GNSS_TIMEOUT * 1e9);
+    }
+    uint64_t timeConstantNs = (uint64_t) (GNSS_TIME_CONSTANT * 1e9);
+    int64_t gain = (int64_t) ((dtNs << 16) / (timeConstantNs + dtNs));
+    biasBam += (int32_t) (((int64_t) (int32_t) (error - biasBam) * gain) >> 16);
+}
+
+void gnss_blend(struct sample *s) {
+    if (pipeline_fixed_point) {
+        historyBam[historyCount % HISTORY_LEN] = s->heading_true_bam;
+    } else {
+        history[historyCount % HISTORY_LEN] = s->heading_true;
+    }
+    historyCount++;
+
+    uint32_t sequence;
+    double gnssHeading;
+    bam_t gnssHeadingBam;
+    uint64_t gnssTimeNs;
+    pthread_mutex_lock(&fixLock);
+    sequence = fixSequence;
+    gnssHeading = fixHeading;
+    gnssHeadingBam = fixHeadingBam;
+    gnssTimeNs = fixTimeNs;
+    pthread_mutex_unlock(&fixLock);
+
+    if (sequence != lastFixSequence) {
+        lastFixSequence = sequence;
+
+        // The GNSS heading was measured GNSS_LATENCY_MS before it arrived, so
+        // compare it with the IMU heading from that many samples ago
+        uint64_t measuredNs = gnssTimeNs - (uint64_t) GNSS_LATENCY_MS * 1000000ULL;
+        uint32_t back = 0;
+        if (s->timestamp_ns > measuredNs) {
+            back = (uint32_t) ((s->timestamp_ns - measuredNs) * SAMPLE_RATE_HZ / 1000000000ULL);
+        }
+        if (back >= historyCount) {
+            back = historyCount - 1;
+        }
+        if (back >= HISTORY_LEN) {
+            back = HISTORY_LEN - 1;
+        }
+        uint32_t index = (historyCount - 1 - back) % HISTORY_LEN;
+
+        // First-order filter on the bias, with time constant GNSS_TIME_CONSTANT.
+        // The first fix sets it directly so we don't wait minutes to converge.
+        if (pipeline_fixed_point) {
+            __update_bias_fixed((int32_t) (gnssHeadingBam - historyBam[index]), gnssTimeNs - lastFixTimeNs);
+        } else {
+            double error = wrap_180(gnssHeading - history[index]);
+            if (!haveBias) {
+                bias = error;
+                haveBias = true;
+            } else {
+                double dt = (double) (gnssTimeNs - lastFixTimeNs) / 1e9;
+                if (dt > GNSS_TIMEOUT) {
+                    dt = GNSS_TIMEOUT;
+                }
+                bias = wrap_180(bias + wrap_180(error - bias) * dt / (GNSS_TIME_CONSTANT + dt));
+            }
+        }
+        lastFixTimeNs = gnssTimeNs;
+    }
+
+    // Keep applying the last bias if the GNSS goes quiet, but flag the output
+    // as IMU-only so consumers know it is no longer being corrected. A
+    // predicted heading stays flagged as predicted.
+    if (haveBias && pipeline_fixed_point) {
+        s->heading_true_bam += (bam_t) biasBam;
+        s->heading_mag_bam += (bam_t) biasBam;
+        s->heading_true = bam_to_deg(s->heading_true_bam);
+        s->heading_mag = bam_to_deg(s->heading_mag_bam);
+        bias = bam_to_deg_signed((bam_t) biasBam);
+    } else if (haveBias) {
+        s->heading_true = wrap_360(s->heading_true + bias);
+        s->heading_mag = wrap_360(s->heading_mag + bias);
+    }
+    bool fresh = haveBias && (int64_t) (s->timestamp_ns - lastFixTimeNs) < (int64_t) (GNSS_TIMEOUT * 1e9);
+    if (s->heading_source != HEADING_SOURCE_PREDICTED) {
+        s->heading_source = fresh ? HEADING_SOURCE_BLENDED : HEADING_SOURCE_IMU;
+    }
+    s->gnss_bias = bias;
+}
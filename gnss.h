@@ -0,0 +1,23 @@
+// Beaglebone Blue Heading NMEA UDP Sender - GNSS heading blend
+//
+// Receives HDT or THS sentences from a dual-antenna GNSS compass over UDP, and
+// blends them with the IMU heading. The IMU provides the rate and latency, the
+// GNSS corrects its slow drift. Other sentences on the same input go to the
+// dead reckoning in position.h.
+
+#ifndef GNSS_H
+#define GNSS_H
+
+#include "sample.h"
+
+// Start listening for GNSS heading on GNSS_INPUT_PORT. Returns 0 on success.
+int gnss_start(void);
+
+// Stop listening
+void gnss_stop(void);
+
+// Pipeline stage. Corrects the sample's heading by the current IMU bias
+// estimate and sets its heading source.
+void gnss_blend(struct sample *s);
+
+#endif
@@ -9,55 +9,67 @@
 // by e.g. adding `udp://0.0.0.0:2021` to its list of sources.
 //
 // If using this for yourself, you may need to customise the #define values
-// near the top of the file to reflect the orientation of your board in your
-// robot.
+// in config.h to reflect the orientation of your board in your robot.
 //
 // Must be run as root.
 
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdarg.h>
 #include <string.h>
+#include <strings.h>
 #include <signal.h>
+#include <sched.h>
 #include <math.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <unistd.h>
+#include <time.h>
 #include <rc/mpu.h>
 #include <rc/time.h>
 
-// The code treats the Beaglebone Blue's +X direction as the heading of the robot. If your
-// board is fitted in a different orientation, or is not exactly lined up, set the
-// HEADING_OFFSET value here. This value will be added (i.e. clockwise rotation) to the
-// magnetometer-based heading to give the result. So if +X points to the left of your robot,
-// this should be 90. If +X points to the right, -90. And if +X points backwards, 180.
-#define HEADING_OFFSET 90.0
-// The magnetometer produces readings based on magnetic north, whereas the HDT message
-// produced by this code should contain a heading based on true north. Enter your local
-// magnetic declination here to apply this offset. Positive declination is when mag
-// north is east/clockwise of true north.
-#define LOCAL_MAGNETIC_DECLINATION 0.1
-// This code sends the heading data to the host and port specified here.
-#define UDP_SEND_SERVER "127.0.0.1"
-#define UDP_SEND_PORT 2021
-// Set the sample rate between 4 & 200 Hz. HDT messages will be sent at this rate. 10 Hz
-// recommended.
-#define SAMPLE_RATE_HZ 10
-// Set the I2C bus on which to communicate with the 9DOF MPU. For the Beaglebone Blue and
-// Beaglebone Black Robotics Cape, this is 2.
-#define I2C_BUS 2
-// Set a GPIO pin to use for an interrupt, in the DMP mode the MPU controls timing and
-// will interrupt us when it has new data
-#define GPIO_INT_PIN_CHIP 3
-#define GPIO_INT_PIN_PIN  21
-
+#include "config.h"
+#include "angles.h"
+#include "sample.h"
+#include "pipeline.h"
+#include "gnss.h"
+#include "sinks.h"
+#include "soak.h"
+#include "influx.h"
+#include "mqtt.h"
+#include "pcap.h"
+#include "nmea.h"
+#include "clock_model.h"
+#include "selftest.h"
+#include "compass.h"
+#include "failover.h"
+#include "gateway.h"
+#include "loadshed.h"
+#include "position.h"
+#include "wind.h"
+#include "bus.h"
+#include "imu.h"
+#include "plugin.h"
+#include "template.h"
+#include "events.h"
+#include "blackbox.h"
 
 // Globals to pass data between threads
 rc_mpu_data_t data;
-int udpsocket;
-struct sockaddr_in server;
+static struct sample sample;
+static struct clock_model clockModel;
+static bool failover = false;
+
+// After taking over with --failover, the predicted readings and the sample
+// they are handled in, kept apart from the MPU's until its first sample
+static rc_mpu_data_t predicted;
+static struct sample predictedSample;
+// Where the source stage takes its readings from. Only changed while no
+// sample is being handled.
+static const rc_mpu_data_t *readings = &data;
 
 // interrupt handler to catch ctrl-c
 static int running = 0;
@@ -66,49 +78,663 @@ static void __signal_handler(__attribute__ ((unused)) int dummy) {
     return;
 }
 
+// SIGUSR1 asks for the pipeline timing statistics to be printed
+static volatile sig_atomic_t statsRequested = 0;
+static void __stats_signal_handler(__attribute__ ((unused)) int dummy) {
+    statsRequested = 1;
+}
+
+// SIGUSR2 asks for a self test
+static volatile sig_atomic_t selftestRequested = 0;
+static void __selftest_signal_handler(__attribute__ ((unused)) int dummy) {
+    selftestRequested = 1;
+}
+
+// Sentence selection. SENTENCE_ENABLED() tells the sample path whether to
+// format a sentence. In the specialised build that is a compile-time
+// constant, so the compiler drops disabled sentences and leaves enabled ones
+// as straight-line code. Otherwise it is a flag set at startup from the
+// sentences the sinks want.
+#ifdef SPECIALISED_PIPELINE
+static const bool sentence_enabled[SENTENCE_COUNT] = {
+#else
+static bool sentence_enabled[SENTENCE_COUNT] = {
+#endif
+#define X(name, enabled) (enabled),
+    OUTPUT_SENTENCES(X)
+#undef X
+};
+#define SENTENCE_ENABLED(name) (sentence_enabled[SENTENCE_##name])
+
+// Format a complete NMEA sentence into a fresh buffer for the sample, given a
+// printf-style format for the part between the talker ID and the checksum.
+// Adds the "$", talker ID, checksum and line ending.
+static void __format_sentence(struct sample *s, enum sentence id, const char *format, ...)
+    __attribute__ ((format (printf, 3, 4)));
+static void __format_sentence(struct sample *s, enum sentence id, const char *format, ...) {
+    if (SHED_ENABLE && loadshed_drop_sentence(id)) {
+        return;
+    }
+    struct slab_buffer *buf = slab_get();
+    if (buf == NULL) {
+        return;
+    }
+    int pos = snprintf(buf->data, SLAB_BUFFER_LEN, "$" TALKER_ID);
+    va_list args;
+    va_start(args, format);
+    pos += vsnprintf(buf->data + pos, SLAB_BUFFER_LEN - pos, format, args);
+    va_end(args);
+    if (pos >= SLAB_BUFFER_LEN - 5) {
+        slab_release(buf);
+        return;
+    }
+
+    // Calculate checksum over everything between the "$" and the "*"
+    int crc = 0;
+    int i;
+    for (i = 1; i < pos; i++) {
+        crc ^= buf->data[i];
+    }
+    buf->len = pos + snprintf(buf->data + pos, SLAB_BUFFER_LEN - pos, "*%02X\r\n", crc);
+    s->sentences[id] = buf;
+}
+
+// Source stage. Stamps the sample and takes the readings we need from the MPU,
+// or the predicted ones.
+static void __stage_source(struct sample *s) {
+    s->sequence++;
+    s->arrival_ns = pipeline_now();
+    s->timestamp_ns = clock_model_update(&clockModel, s->arrival_ns);
+    s->heading_raw = readings->compass_heading * RAD_TO_DEG;
+    s->dmp_yaw = readings->dmp_TaitBryan[TB_YAW_Z] * RAD_TO_DEG;
+    s->compass_raw = readings->compass_heading_raw * RAD_TO_DEG;
+    s->mag_field = sqrt(readings->mag[0] * readings->mag[0] + readings->mag[1] * readings->mag[1]
+            + readings->mag[2] * readings->mag[2]);
+    s->pitch = readings->dmp_TaitBryan[TB_PITCH_X] * RAD_TO_DEG;
+    s->roll = readings->dmp_TaitBryan[TB_ROLL_Y] * RAD_TO_DEG;
+    s->heading_source = HEADING_SOURCE_IMU;
+    if (pipeline_fixed_point) {
+        s->heading_raw_bam = bam_from_rad(readings->compass_heading);
+        s->pitch_bam = bam_from_rad(readings->dmp_TaitBryan[TB_PITCH_X]);
+        s->roll_bam = bam_from_rad(readings->dmp_TaitBryan[TB_ROLL_Y]);
+    }
+}
+
+// Orientation stage. Get a heading value based on filtered compass heading
+// reported by MPU. Requires inversion so that clockwise is positive, and
+// HEADING_OFFSET to turn the board's +X axis into the robot's heading.
+static void __stage_orientation(struct sample *s) {
+    if (pipeline_fixed_point) {
+        s->heading_mag_bam = BAM_FROM_DEG(HEADING_OFFSET) - s->heading_raw_bam;
+        s->heading_mag = bam_to_deg(s->heading_mag_bam);
+        return;
+    }
+    s->heading_mag = wrap_360(-s->heading_raw + HEADING_OFFSET);
+}
+
+// Calibration stage. Apply magnetic declination to get true heading.
+static void __stage_calibration(struct sample *s) {
+    if (pipeline_fixed_point) {
+        s->heading_true_bam = s->heading_mag_bam + BAM_FROM_DEG(LOCAL_MAGNETIC_DECLINATION);
+        s->heading_true = bam_to_deg(s->heading_true_bam);
+        return;
+    }
+    s->heading_true = wrap_360(s->heading_mag + LOCAL_MAGNETIC_DECLINATION);
+}
+
+// Formatter stages, one per sentence type in OUTPUT_SENTENCES. Each formats
+// its sentence once, for all the sinks that want it. In fixed point, the
+// heading path's angles are printed as whole tenths of a degree.
+static void __format_HDT(struct sample *s) {
+    if (pipeline_fixed_point) {
+        int32_t t = bam_tenths(s->heading_true_bam);
+        __format_sentence(s, SENTENCE_HDT, "HDT,%d.%d,T", t / 10, t % 10);
+        return;
+    }
+    __format_sentence(s, SENTENCE_HDT,
+            "HDT,%03.1f,T", round_heading(s->heading_true));
+}
+
+static void __format_HDM(struct sample *s) {
+    if (pipeline_fixed_point) {
+        int32_t t = bam_tenths(s->heading_mag_bam);
+        __format_sentence(s, SENTENCE_HDM, "HDM,%d.%d,M", t / 10, t % 10);
+        return;
+    }
+    __format_sentence(s, SENTENCE_HDM,
+            "HDM,%03.1f,M", round_heading(s->heading_mag));
+}
+
+static void __format_THS(struct sample *s) {
+    char mode = s->heading_source == HEADING_SOURCE_BLENDED ? 'A' : 'E';
+    if (pipeline_fixed_point) {
+        int32_t t = bam_tenths(s->heading_true_bam);
+        __format_sentence(s, SENTENCE_THS, "THS,%03d.%d,%c", t / 10, t % 10, mode);
+        return;
+    }
+    __format_sentence(s, SENTENCE_THS,
+            "THS,%05.1f,%c", round_heading(s->heading_true), mode);
+}
+
+static void __format_XDR(struct sample *s) {
+    if (pipeline_fixed_point) {
+        int32_t p = bam_tenths_signed(s->pitch_bam);
+        int32_t r = bam_tenths_signed(s->roll_bam);
+        if (s->pressure_valid) {
+            // Bar to 5 places is whole pascals
+            __format_sentence(s, SENTENCE_XDR, "XDR,A,%s%d.%d,D,PITCH,A,%s%d.%d,D,ROLL,P,%d.%05d,B,BARO",
+                    p < 0 ? "-" : "", abs(p) / 10, abs(p) % 10, r < 0 ? "-" : "", abs(r) / 10, abs(r) % 10,
+                    (int) (s->pressure / 100000), (int) (s->pressure % 100000));
+        } else {
+            __format_sentence(s, SENTENCE_XDR, "XDR,A,%s%d.%d,D,PITCH,A,%s%d.%d,D,ROLL",
+                    p < 0 ? "-" : "", abs(p) / 10, abs(p) % 10, r < 0 ? "-" : "", abs(r) / 10, abs(r) % 10);
+        }
+        return;
+    }
+    if (s->pressure_valid) {
+        __format_sentence(s, SENTENCE_XDR,
+                "XDR,A,%.1f,D,PITCH,A,%.1f,D,ROLL,P,%.5f,B,BARO", s->pitch, s->roll, s->pressure / 1e5);
+    } else {
+        __format_sentence(s, SENTENCE_XDR,
+                "XDR,A,%.1f,D,PITCH,A,%.1f,D,ROLL", s->pitch, s->roll);
+    }
+}
+
+// Position as "ddmm.mmmmm,N" or "dddmm.mmmmm,E", rounded in whole units so
+// minutes never come out as 60. buf needs 24 bytes to hold the longest output
+// for any value llround can give.
+static void __format_coordinate(char *buf, size_t len, double degrees, int width, char positive, char negative) {
+    long long units = llround(fabs(degrees) * 6000000.0);
+    snprintf(buf, len, "%0*lld%02lld.%05lld,%c", width, units / 6000000, units / 100000 % 60, units % 100000,
+             degrees < 0.0 ? negative : positive);
+}
+
+// UTC time as "hhmmss.ss"
+static void __format_time(char *buf, size_t len, int64_t utcNs) {
+    int64_t centiseconds = utcNs / 10000000LL % 8640000LL;
+    snprintf(buf, len, "%02d%02d%02d.%02d", (int) (centiseconds / 360000), (int) (centiseconds / 6000 % 60),
+             (int) (centiseconds / 100 % 60), (int) (centiseconds % 100));
+}
+
+// Dead-reckoned position, with fix quality 6 for estimated
+static void __format_GGA(struct sample *s) {
+    if (!s->position_valid) {
+        return;
+    }
+    char time[16], lat[24], lon[24];
+    __format_time(time, sizeof(time), s->utc_ns);
+    __format_coordinate(lat, sizeof(lat), s->latitude, 2, 'N', 'S');
+    __format_coordinate(lon, sizeof(lon), s->longitude, 3, 'E', 'W');
+    __format_sentence(s, SENTENCE_GGA,
+            "GGA,%s,%s,%s,6,%02d,%.1f,%.1f,M,%.1f,M,,", time, lat, lon,
+            s->satellites, s->hdop, s->altitude, s->geoid_separation);
+}
+
+// Dead-reckoned position, speed and track, with mode E for estimated
+static void __format_RMC(struct sample *s) {
+    if (!s->position_valid) {
+        return;
+    }
+    char time[16], lat[24], lon[24];
+    __format_time(time, sizeof(time), s->utc_ns);
+    __format_coordinate(lat, sizeof(lat), s->latitude, 2, 'N', 'S');
+    __format_coordinate(lon, sizeof(lon), s->longitude, 3, 'E', 'W');
+    time_t seconds = (time_t) (s->utc_ns / 1000000000LL);
+    struct tm date;
+    gmtime_r(&seconds, &date);
+    __format_sentence(s, SENTENCE_RMC,
+            "RMC,%s,A,%s,%s,%.1f,%05.1f,%02d%02d%02d,,,E", time, lat, lon,
+            s->speed, round_heading(s->track), date.tm_mday, date.tm_mon + 1, date.tm_year % 100);
+}
+
+// True wind direction and speed, in knots and m/s
+static void __format_MWD(struct sample *s) {
+    if (!s->wind_valid) {
+        return;
+    }
+    __format_sentence(s, SENTENCE_MWD,
+            "MWD,%.1f,T,%.1f,M,%.1f,N,%.1f,M", round_heading(s->wind_direction), round_heading(s->wind_direction_mag),
+            s->wind_speed, s->wind_speed * 1852.0 / 3600.0);
+}
+
+// True wind angle from the bow and speed, with reference T for true
+static void __format_MWV(struct sample *s) {
+    if (!s->wind_valid) {
+        return;
+    }
+    __format_sentence(s, SENTENCE_MWV,
+            "MWV,%.1f,T,%.1f,N,A", round_heading(s->wind_angle), s->wind_speed);
+}
+
+// The processing stages, in the order they run. Each is
+// STAGE(name, function, enabled), with one formatter stage per sentence.
+#define FORMAT_STAGE(name, enabled) STAGE("format " #name, __format_##name, SENTENCE_ENABLED(name))
+#define PIPELINE_STAGES \
+    STAGE("source", __stage_source, true) \
+    STAGE("compass fusion", compass_fuse, COMPASS_ADAPTIVE) \
+    STAGE("failover", failover_heartbeat, failover) \
+    STAGE("orientation", __stage_orientation, true) \
+    STAGE("imu vote", imu_vote, imu_count() > 0) \
+    STAGE("calibration", __stage_calibration, true) \
+    STAGE("gnss blend", gnss_blend, GNSS_INPUT_PORT != 0) \
+    STAGE("dead reckoning", position_dead_reckon, GNSS_INPUT_PORT != 0 && (SENTENCE_ENABLED(GGA) || SENTENCE_ENABLED(RMC))) \
+    STAGE("true wind", wind_true, WIND_INPUT_PORT != 0) \
+    OUTPUT_SENTENCES(FORMAT_STAGE) \
+    STAGE("templates", template_format, template_count() > 0) \
+    STAGE("plugins", plugin_run, plugin_count() > 0) \
+    STAGE("black box", blackbox_record, true) \
+    STAGE("sinks", sinks_send, true) \
+    STAGE("i2c bus", bus_sample, true) \
+    STAGE("load shed", loadshed_measure, SHED_ENABLE)
+
+// Set up the pipeline from the stages that are enabled. Called once at startup
+// after the command line has been read.
+static void __build_pipeline(void) {
+#define STAGE(name, fn, enabled) if (enabled) { pipeline_add(name, fn); }
+    PIPELINE_STAGES
+#undef STAGE
+}
+
+// Run a sample through the pipeline
+static void __run_pipeline(struct sample *s) {
+#ifdef SPECIALISED_PIPELINE
+    // Same stages as the pipeline, but called directly so the compiler can
+    // inline them and drop the ones that are disabled.
+    uint64_t lastNs = 0;
+#if STAGE_TIMING
+    lastNs = pipeline_now();
+#endif
+    int stage = 0;
+#define STAGE(name, fn, enabled) if (enabled) { pipeline_run_stage(stage++, fn, s, &lastNs); }
+    PIPELINE_STAGES
+#undef STAGE
+#else
+    pipeline_run(s);
+#endif
+}
+
 // Handle data function. Called back at a predefined interval by the MPU
 // when it has new data.
 static void __handle_data(void) {
-    // Get a heading value based on filtered compass heading reported by MPU
-    // Requires inversion so that clockwise is positive
-    double heading = -data.compass_heading * RAD_TO_DEG;
+    __run_pipeline(&sample);
+}
+
+// Called once per sample period with predicted readings after taking over
+// from another instance, until the MPU is running
+static void __handle_predicted(void) {
+    __run_pipeline(&predictedSample);
+}
 
-    // Apply offsets
-    heading = heading + HEADING_OFFSET;
-    heading = heading + LOCAL_MAGNETIC_DECLINATION;
+// DMP callback when running with --failover. After taking over from another
+// instance, the first real sample stops the predicted ones. Only then does
+// the pipeline switch to the MPU's readings, carrying on the sequence numbers.
+// The predicted samples were timed by our own clock, so the clock model
+// starts again.
+static void __handle_data_failover(void) {
+    if (failover_sensor_live()) {
+        readings = &data;
+        sample.sequence = predictedSample.sequence;
+        clock_model_init(&clockModel);
+        compass_reset();
+    }
+    __handle_data();
+}
+
+// Work out which sentences need formatting from what the sinks want. Returns
+// 0 on success or -1 if a sink wants a sentence that isn't built in, or a
+// position or wind with nowhere to get readings from.
+static int __select_sentences(void) {
+    uint32_t wanted = sinks_wanted_sentences();
+    int i;
+    for (i = 0; i < SENTENCE_COUNT; i++) {
+#ifdef SPECIALISED_PIPELINE
+        if ((wanted & SENTENCE_BIT(i)) && !sentence_enabled[i]) {
+            fprintf(stderr, "%s is disabled in config.h for the specialised build\n", sentence_names[i]);
+            return -1;
+        }
+#else
+        sentence_enabled[i] = (wanted & SENTENCE_BIT(i)) != 0;
+#endif
+    }
+    if (GNSS_INPUT_PORT == 0 && (wanted & (SENTENCE_BIT(SENTENCE_GGA) | SENTENCE_BIT(SENTENCE_RMC)))) {
+        fprintf(stderr, "GGA and RMC need GNSS_INPUT_PORT set in config.h for position fixes\n");
+        return -1;
+    }
+    if (WIND_INPUT_PORT == 0 && (wanted & (SENTENCE_BIT(SENTENCE_MWD) | SENTENCE_BIT(SENTENCE_MWV)))) {
+        fprintf(stderr, "MWD and MWV need WIND_INPUT_PORT set in config.h for wind readings\n");
+        return -1;
+    }
+    return 0;
+}
 
-    // Ensure we get a number in the range 0.0<=x<360.0
-    while (heading < 0.0) {
-        heading = heading + 360.0;
+// Benchmark mode. Runs the sample path the given number of times on a
+// synthetic, slowly rotating heading without touching the MPU, and prints the
+// mean time per sample. Compare a normal and a specialised build with this.
+static void __benchmark(long samples) {
+    struct timespec start, end;
+    long i;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < samples; i++) {
+        data.compass_heading = (double) (i % 3600) * 0.1 * DEG_TO_RAD - M_PI;
+        data.compass_heading_raw = data.compass_heading;
+        data.dmp_TaitBryan[TB_YAW_Z] = data.compass_heading;
+        data.mag[0] = 30.0;
+        data.mag[2] = -40.0;
+        data.dmp_TaitBryan[TB_PITCH_X] = 0.05;
+        data.dmp_TaitBryan[TB_ROLL_Y] = -0.02;
+        __handle_data();
     }
-    while (heading >= 360.0) {
-        heading = heading - 360.0;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsedNs = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+#ifdef SPECIALISED_PIPELINE
+    printf("specialised build: ");
+#else
+    printf("runtime-configurable build: ");
+#endif
+    printf("%ld samples, %d sinks, %.0f ns/sample\n", samples, sinks_count(), elapsedNs / (double) samples);
+    pipeline_print_stats(stdout);
+    sinks_print_stats(stdout);
+    clock_model_print_stats(&clockModel, stdout);
+}
+
+// Time the heading path, from the MPU's readings to formatted HDT, HDM, THS
+// and XDR, in floating and fixed point on the same synthetic readings, and
+// count the samples where the two print different tenths of a degree
+static void __benchmark_fixed_point(long samples) {
+    static const enum sentence ids[] = { SENTENCE_HDT, SENTENCE_HDM, SENTENCE_THS, SENTENCE_XDR };
+    static const int idCount = sizeof(ids) / sizeof(ids[0]);
+    static const stage_fn stages[] = {
+        __stage_source, __stage_orientation, __stage_calibration,
+        __format_HDT, __format_HDM, __format_THS, __format_XDR,
+    };
+    bool wasFixed = pipeline_fixed_point;
+    double ns[2];
+    long mismatches = 0;
+    int32_t maxDifference = 0;
+    int mode;
+    for (mode = 0; mode < 2; mode++) {
+        pipeline_fixed_point = mode == 1;
+        struct sample s = sample;
+        struct timespec start, end;
+        long i;
+        unsigned int j;
+        int k;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < samples; i++) {
+            data.compass_heading = (double) (i % 36000) * 0.01 * DEG_TO_RAD - M_PI;
+            data.dmp_TaitBryan[TB_PITCH_X] = sin((double) i * 0.001) * 0.5;
+            data.dmp_TaitBryan[TB_ROLL_Y] = cos((double) i * 0.0007) * 0.3;
+            for (j = 0; j < sizeof(stages) / sizeof(stages[0]); j++) {
+                stages[j](&s);
+            }
+            for (k = 0; k < idCount; k++) {
+                if (s.sentences[ids[k]] != NULL) {
+                    slab_release(s.sentences[ids[k]]);
+                    s.sentences[ids[k]] = NULL;
+                }
+            }
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        ns[mode] = ((double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec)) / samples;
     }
 
-    // Build NMEA message content
-    char message[20], messageInner[14];
-    sprintf(messageInner, "GPHDT,%03.1f,T", heading);
+    // Compare the tenths each would print, without the timing
+    long i;
+    for (i = 0; i < samples; i++) {
+        struct sample s = sample;
+        data.compass_heading = (double) (i % 36000) * 0.01 * DEG_TO_RAD - M_PI;
+        data.dmp_TaitBryan[TB_PITCH_X] = sin((double) i * 0.001) * 0.5;
+        data.dmp_TaitBryan[TB_ROLL_Y] = cos((double) i * 0.0007) * 0.3;
+        pipeline_fixed_point = false;
+        __stage_source(&s);
+        __stage_orientation(&s);
+        __stage_calibration(&s);
+        int32_t floating[4] = {
+            (int32_t) lround(round_heading(s.heading_true) * 10.0) % 3600,
+            (int32_t) lround(round_heading(s.heading_mag) * 10.0) % 3600,
+            (int32_t) lround(s.pitch * 10.0), (int32_t) lround(s.roll * 10.0),
+        };
+        pipeline_fixed_point = true;
+        __stage_source(&s);
+        __stage_orientation(&s);
+        __stage_calibration(&s);
+        int32_t fixed[4] = {
+            bam_tenths(s.heading_true_bam), bam_tenths(s.heading_mag_bam),
+            bam_tenths_signed(s.pitch_bam), bam_tenths_signed(s.roll_bam),
+        };
+        bool mismatch = false;
+        int k;
+        for (k = 0; k < 4; k++) {
+            int32_t difference = abs(fixed[k] - floating[k]);
+            if (k < 2 && difference > 1800) {
+                difference = 3600 - difference;
+            }
+            if (difference != 0) {
+                mismatch = true;
+            }
+            if (difference > maxDifference) {
+                maxDifference = difference;
+            }
+        }
+        mismatches += mismatch;
+    }
+    pipeline_fixed_point = wasFixed;
+    printf("heading path: %.0f ns/sample floating point, %.0f ns/sample fixed point, "
+            "%ld of %ld samples differ, by up to %.1f degrees\n",
+            ns[0], ns[1], mismatches, samples, maxDifference / 10.0);
+}
 
-    // Calculate checksum
-    int crc = 0;
-    int i;
-    for (i = 0; i < 14; i ++) {
-        crc ^= messageInner[i];
+// Time the NMEA parser on a typical GNSS receiver datagram, with every
+// sentence's first field parsed as a number
+static void __benchmark_nmea(long sentences) {
+    static const char *lines[] = {
+        "GPGGA,123519,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,",
+        "GPRMC,123519,A,4807.038,N,01131.000,E,022.4,084.4,230394,003.1,W",
+        "GPHDT,274.1,T",
+        "GPTHS,274.1,A",
+    };
+    char buf[512];
+    int len = 0;
+    unsigned int i;
+    for (i = 0; i < sizeof(lines) / sizeof(lines[0]); i++) {
+        int crc = 0;
+        const char *c;
+        for (c = lines[i]; *c != '\0'; c++) {
+            crc ^= *c;
+        }
+        len += snprintf(buf + len, sizeof(buf) - len, "$%s*%02X\r\n", lines[i], crc);
     }
 
-    // Assemble full message
-    sprintf(message, "$%s*%02X\r\n", messageInner, crc);
+    struct nmea_parser parser;
+    nmea_init(&parser);
+    struct nmea_sentence sentence;
+    long parsed = 0;
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (parsed < sentences) {
+        nmea_feed(&parser, buf, len);
+        while (nmea_next(&parser, &sentence)) {
+            double value;
+            parsed += nmea_decimal(nmea_field(&sentence, 1), &value);
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double elapsedNs = (double) (end.tv_sec - start.tv_sec) * 1e9 + (double) (end.tv_nsec - start.tv_nsec);
+    printf("nmea parser: %ld sentences, %.0f ns/sentence, %.2f million sentences/s\n",
+            parsed, elapsedNs / (double) parsed, (double) parsed * 1e3 / elapsedNs);
+}
 
-    // Send packet
-    sendto(udpsocket, message, (strlen(message)+1), 0, (struct sockaddr *)&server, sizeof(server));
+static void __usage(const char *name) {
+    fprintf(stderr, "usage: %s [--sentences HDT,HDM,THS,XDR,GGA,RMC,MWD,MWV] [--udp HOST:PORT[/SENTENCES]]...\n"
+            "       [--influx URL [--influx-fields FIELDS]] [--mqtt HOST:PORT[/TOPIC_PREFIX]]\n"
+            "       [--pcap FILE] [--failover] [--imu DEVICE[,OFFSET]]... [--fixed-point]\n"
+            "       [--template TEMPLATE]... [--plugin PATH[,ARGS]]...\n"
+            "       [--bench SAMPLES] [--soak DAYS] [--selftest]\n"
+            "   or: %s --gateway PORT --route BOAT=HOST:PORT... [--workers N]\n"
+            "   or: %s --events FILE.idx\n"
+            "   or: %s --dump-blackbox [FILE]\n", name, name, name, name);
 }
 
 // Main function
-int main()  {
+int main(int argc, char *argv[])  {
+    long benchSamples = 0;
+    double soakDays = 0.0;
+    bool selftest = false;
+    uint32_t defaultSentences = 0;
+    const char *udpSpecs[SINKS_MAX];
+    int udpSpecCount = 0;
+    const char *influxUrl = NULL;
+    const char *influxFields = NULL;
+    const char *mqttBroker = NULL;
+    const char *pcapPath = NULL;
+    const char *eventsPath = NULL;
+    const char *blackboxPath = NULL;
+    bool dumpBlackbox = false;
+    int gatewayPort = 0;
+    int gatewayWorkers = 0;
+    int i;
+#define X(name, enabled) if (enabled) { defaultSentences |= SENTENCE_BIT(SENTENCE_##name); }
+    OUTPUT_SENTENCES(X)
+#undef X
+    for (i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--sentences") == 0 && i + 1 < argc) {
+#ifdef SPECIALISED_PIPELINE
+            fprintf(stderr, "--sentences is not available in the specialised build, edit config.h instead\n");
+            return -1;
+#endif
+            if (sentences_parse(argv[++i], &defaultSentences)) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--udp") == 0 && i + 1 < argc && udpSpecCount < SINKS_MAX) {
+            udpSpecs[udpSpecCount++] = argv[++i];
+        } else if (strcmp(argv[i], "--influx") == 0 && i + 1 < argc) {
+            influxUrl = argv[++i];
+        } else if (strcmp(argv[i], "--influx-fields") == 0 && i + 1 < argc) {
+            influxFields = argv[++i];
+        } else if (strcmp(argv[i], "--mqtt") == 0 && i + 1 < argc) {
+            mqttBroker = argv[++i];
+        } else if (strcmp(argv[i], "--pcap") == 0 && i + 1 < argc) {
+            pcapPath = argv[++i];
+        } else if (strcmp(argv[i], "--events") == 0 && i + 1 < argc) {
+            eventsPath = argv[++i];
+        } else if (strcmp(argv[i], "--dump-blackbox") == 0) {
+            dumpBlackbox = true;
+            if (i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0) {
+                blackboxPath = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--bench") == 0 && i + 1 < argc) {
+            benchSamples = atol(argv[++i]);
+        } else if (strcmp(argv[i], "--soak") == 0 && i + 1 < argc) {
+            soakDays = atof(argv[++i]);
+        } else if (strcmp(argv[i], "--selftest") == 0) {
+            selftest = true;
+        } else if (strcmp(argv[i], "--failover") == 0) {
+            failover = true;
+        } else if (strcmp(argv[i], "--fixed-point") == 0) {
+            pipeline_fixed_point = true;
+        } else if (strcmp(argv[i], "--template") == 0 && i + 1 < argc) {
+            if (template_add(argv[++i])) {
+                plugin_close();
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--plugin") == 0 && i + 1 < argc) {
+            if (plugin_add(argv[++i])) {
+                plugin_close();
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--imu") == 0 && i + 1 < argc) {
+            if (imu_add(argv[++i])) {
+                return -1;
+            }
+        } else if (strcmp(argv[i], "--gateway") == 0 && i + 1 < argc) {
+            gatewayPort = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            gatewayWorkers = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--route") == 0 && i + 1 < argc) {
+            if (gateway_add_route(argv[++i])) {
+                return -1;
+            }
+        } else {
+            __usage(argv[0]);
+            return -1;
+        }
+    }
+
+    // Listing a capture's events or reading the black box needs nothing else
+    if (eventsPath != NULL) {
+        plugin_close();
+        return events_list(eventsPath, stdout);
+    }
+    if (dumpBlackbox) {
+        plugin_close();
+        return blackbox_dump(blackboxPath, stdout);
+    }
+
     // Set up interrupt handler
     signal(SIGINT, __signal_handler);
+    signal(SIGUSR1, __stats_signal_handler);
+    signal(SIGUSR2, __selftest_signal_handler);
     running = 1;
 
+    // The compass fusion and the IMU vote work on the floating-point heading,
+    // so would be skipped over by the fixed-point one
+    if (pipeline_fixed_point && (COMPASS_ADAPTIVE || imu_count() > 0)) {
+        fprintf(stderr, "fixed point is not available with COMPASS_ADAPTIVE or --imu\n");
+        return -1;
+    }
+
+    // Gateway mode relays other boats' heading instead of reading the MPU
+    if (gatewayPort > 0) {
+        if (gateway_start(gatewayPort, gatewayWorkers)) {
+            return -1;
+        }
+        while (running) {
+            rc_usleep(100000);
+            if (statsRequested) {
+                statsRequested = 0;
+                gateway_print_stats(stderr);
+            }
+        }
+        gateway_print_stats(stderr);
+        gateway_stop();
+        return 0;
+    }
+
+    // Create UDP sinks, sending to the destination in config.h if none were
+    // given. Exit on failure.
+    if (udpSpecCount == 0) {
+        char spec[64];
+        snprintf(spec, sizeof(spec), "%s:%d", UDP_SEND_SERVER, UDP_SEND_PORT);
+        if (sinks_add_udp(spec, defaultSentences)) {
+            return -1;
+        }
+    }
+    for (i = 0; i < udpSpecCount; i++) {
+        if (sinks_add_udp(udpSpecs[i], defaultSentences)) {
+            sinks_close();
+            return -1;
+        }
+    }
+    if (influxUrl != NULL && influx_add(influxUrl, influxFields)) {
+        sinks_close();
+        return -1;
+    }
+    if (mqttBroker != NULL && mqtt_add(mqttBroker)) {
+        sinks_close();
+        return -1;
+    }
+    if (pcapPath != NULL && pcap_add(pcapPath)) {
+        sinks_close();
+        return -1;
+    }
+    if (__select_sentences()) {
+        sinks_close();
+        return -1;
+    }
+
+    clock_model_init(&clockModel);
+    __build_pipeline();
+
     // Set up MPU config
     rc_mpu_config_t conf = rc_mpu_default_config();
     conf.i2c_bus = I2C_BUS;
@@ -116,34 +742,182 @@ int main()  {
     conf.gpio_interrupt_pin = GPIO_INT_PIN_PIN;
     conf.enable_magnetometer = 1;
     conf.dmp_sample_rate = SAMPLE_RATE_HZ;
+    if (DMP_INTERRUPT_PRIORITY > 0) {
+        conf.dmp_interrupt_sched_policy = SCHED_FIFO;
+        conf.dmp_interrupt_priority = DMP_INTERRUPT_PRIORITY;
+    }
 
-    // Enable MPU, exit on failure
-    if (rc_mpu_initialize_dmp(&data, conf)){
-        fprintf(stderr,"rc_mpu_initialize_dmp failed\n");
+    // Fit the magnetometer and barometer reads around the DMP's
+    bus_plan(&conf);
+
+    // Self test mode
+    if (selftest) {
+        int result = selftest_run(&data, &conf, stdout);
+        sinks_close();
+        return result;
+    }
+
+    // Benchmark mode doesn't need the MPU
+    if (benchSamples > 0) {
+        __benchmark(benchSamples);
+        __benchmark_fixed_point(benchSamples);
+        __benchmark_nmea(benchSamples * 10);
+        compass_benchmark(stdout);
+        if (template_count() > 0) {
+            template_print_stats(stdout);
+        }
+        if (plugin_count() > 0) {
+            plugin_print_stats(stdout);
+        }
+        plugin_close();
+        sinks_close();
+        return 0;
+    }
+
+    // So does the soak test
+    if (soakDays > 0.0) {
+        int result = soak_run(soakDays, &data, __handle_data);
+        plugin_close();
+        sinks_close();
+        return result;
+    }
+
+    // With failover, stand by until any active instance fails. Don't touch
+    // the MPU before then, as the active instance is using it.
+    bool tookOver = false;
+    if (failover) {
+        if (failover_init()) {
+            sinks_close();
+            return -1;
+        }
+        if (failover_other_active()) {
+            fprintf(stderr, "another instance is active, standing by\n");
+            if (failover_standby(&running)) {
+                failover_close();
+                sinks_close();
+                return 0;
+            }
+            tookOver = true;
+        } else {
+            failover_take_over();
+        }
+    }
+
+    // Start recording the black box now this is the active instance, keeping
+    // the one from any instance we have taken over from as the previous one
+    if (blackbox_open() == 0) {
+        blackbox_note(tookOver ? "pid %d took over" : "pid %d started", (int) getpid());
+    }
+
+    // Not after taking over, as the sinks are waiting
+    if (SELFTEST_AT_STARTUP && !tookOver) {
+        selftest_run(&data, &conf, stderr);
+    }
+
+    // Start listening for GNSS heading if we are blending it in
+    if (GNSS_INPUT_PORT != 0 && gnss_start()) {
+        failover_close();
+        sinks_close();
         return -1;
     }
 
-    // Create UDP sockets, exit on failure
-    if ((udpsocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) >= 0) {
-        server.sin_family      = AF_INET;
-        server.sin_port        = htons(UDP_SEND_PORT);
-        server.sin_addr.s_addr = inet_addr(UDP_SEND_SERVER);
-    } else {
-        fprintf(stderr,"create socket failed\n");
+    // And for wind
+    if (WIND_INPUT_PORT != 0 && wind_start()) {
+        gnss_stop();
+        failover_close();
+        sinks_close();
+        return -1;
+    }
+
+    // Start reading the barometer and any extra IMUs
+    if (bus_start() || imu_start()) {
+        bus_stop();
+        wind_stop();
+        gnss_stop();
+        failover_close();
+        sinks_close();
+        return -1;
+    }
+
+    // After taking over, everything but the MPU is running, so send predicted
+    // heading through the whole pipeline until the MPU is running too
+    if (tookOver) {
+        readings = &predicted;
+        if (!failover_predict_start(&predicted, __handle_predicted)) {
+            readings = &data;
+        }
+    }
+
+    // Enable MPU, exit on failure
+    if (rc_mpu_initialize_dmp(&data, conf)){
+        fprintf(stderr,"rc_mpu_initialize_dmp failed\n");
+        failover_close();
+        imu_stop();
+        bus_stop();
+        wind_stop();
+        gnss_stop();
+        sinks_close();
         return -1;
     }
 
     // Set the DMP callback method - the MPU will control the timing
     // from now on.
-    rc_mpu_set_dmp_callback(&__handle_data);
+    rc_mpu_set_dmp_callback(failover ? &__handle_data_failover : &__handle_data);
 
-    // Wait until we need to quit, nothing else to do
+    // Wait until we need to quit, checking the load once a second, printing
+    // stats whenever SIGUSR1 asks for them and running the self test when
+    // SIGUSR2 does
+    int ticks = 0;
     while (running) {
         rc_usleep(100000);
+        if (SHED_ENABLE && ++ticks % 10 == 0) {
+            loadshed_update();
+        }
+        if (statsRequested) {
+            statsRequested = 0;
+            pipeline_print_stats(stderr);
+            sinks_print_stats(stderr);
+            clock_model_print_stats(&clockModel, stderr);
+            selftest_print_stats(stderr);
+            if (COMPASS_ADAPTIVE) {
+                compass_print_stats(stderr);
+            }
+            if (SHED_ENABLE) {
+                loadshed_print_stats(stderr);
+            }
+            if (GNSS_INPUT_PORT != 0 && (SENTENCE_ENABLED(GGA) || SENTENCE_ENABLED(RMC))) {
+                position_print_stats(stderr);
+            }
+            if (WIND_INPUT_PORT != 0) {
+                wind_print_stats(stderr);
+            }
+            bus_print_stats(stderr);
+            if (imu_count() > 0) {
+                imu_print_stats(stderr);
+            }
+            if (template_count() > 0) {
+                template_print_stats(stderr);
+            }
+            if (plugin_count() > 0) {
+                plugin_print_stats(stderr);
+            }
+        }
+        if (selftestRequested) {
+            // The DMP has the I2C bus, so leave that out
+            selftestRequested = 0;
+            selftest_run(&data, NULL, stderr);
+        }
     }
 
     // Disable MPU & close sockets
+    blackbox_note("stopping");
+    imu_stop();
+    bus_stop();
     rc_mpu_power_off();
-    close(udpsocket);
+    plugin_close();
+    gnss_stop();
+    wind_stop();
+    failover_close();
+    sinks_close();
     return 0;
 }
@@ -0,0 +1,366 @@
+// Beaglebone Blue Heading NMEA UDP Sender - redundant IMUs
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "angles.h"
+#include "pipeline.h"
+#include "blackbox.h"
+#include "imu.h"
+
+// Readings kept per unit. The vote only looks back over half of them, so the
+// thread can't be overwriting one while it is being read.
+#define RING_LEN 16
+#define LOOK_BACK (RING_LEN / 2)
+// A unit with no reading within this many sample periods of the MPU's has
+// nothing to vote with
+#define STALE_PERIODS 3
+// Time constant of each unit's usual magnetic field strength, in seconds
+#define FIELD_TIME_CONSTANT 60.0
+
+#define DEG_RAD (M_PI / 180.0)
+
+enum axis {
+    ACCEL_X, ACCEL_Y, ACCEL_Z,
+    MAGN_X, MAGN_Y, MAGN_Z,
+    AXES
+};
+
+static const char *axisNames[AXES] = {
+    "accel_x", "accel_y", "accel_z", "magn_x", "magn_y", "magn_z"
+};
+
+struct imu_reading {
+    uint64_t timestamp_ns;
+    double heading;
+    double field;
+};
+
+// Unit 0 is the MPU, the rest are read from IIO
+struct imu_unit {
+    char name[64];
+    double offset;
+    int fd[AXES];
+    double scale[AXES];
+    pthread_t thread;
+    struct imu_reading ring[RING_LEN];
+    atomic_uint count;
+    // Health, only touched by the sample path
+    double field_mean;
+    double residual;
+    bool excluded;
+    uint64_t agreeing_since_ns;
+    unsigned int exclusions;
+    uint64_t stale;
+    uint64_t voted;
+};
+
+static struct imu_unit units[IMU_MAX + 1] = { { .name = "mpu" } };
+static int unitCount = 1;
+static volatile bool reading = false;
+static uint64_t lastNs = 0;
+
+// Read a number from a sysfs attribute that is kept open
+static bool __read_value(int fd, double *value) {
+    char buf[32];
+    ssize_t len = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        return false;
+    }
+    buf[len] = '\0';
+    *value = strtod(buf, NULL);
+    return true;
+}
+
+// An axis's scale, from in_accel_x_scale or the shared in_accel_scale, or 1
+// if the device has neither
+static double __read_scale(const char *dir, const char *axis) {
+    char path[160];
+    double scale = 1.0;
+    snprintf(path, sizeof(path), "%s/in_%s_scale", dir, axis);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        snprintf(path, sizeof(path), "%s/in_%.*s_scale", dir, (int) (strchr(axis, '_') - axis), axis);
+        fd = open(path, O_RDONLY);
+    }
+    if (fd >= 0) {
+        __read_value(fd, &scale);
+        close(fd);
+    }
+    return scale;
+}
+
+int imu_add(const char *spec) {
+    if (unitCount > IMU_MAX) {
+        fprintf(stderr, "at most %d extra IMUs\n", IMU_MAX);
+        return -1;
+    }
+    struct imu_unit *u = &units[unitCount];
+    char dir[128];
+    const char *comma = strchr(spec, ',');
+    int len = comma != NULL ? (int) (comma - spec) : (int) strlen(spec);
+    snprintf(dir, sizeof(dir), "%s%.*s", spec[0] == '/' ? "" : "/sys/bus/iio/devices/", len, spec);
+    snprintf(u->name, sizeof(u->name), "%.*s", len, spec);
+    u->offset = comma != NULL ? atof(comma + 1) : 0.0;
+
+    int i;
+    for (i = 0; i < AXES; i++) {
+        char path[160];
+        snprintf(path, sizeof(path), "%s/in_%s_raw", dir, axisNames[i]);
+        if ((u->fd[i] = open(path, O_RDONLY)) < 0) {
+            fprintf(stderr, "can't open IMU %s\n", path);
+            while (--i >= 0) {
+                close(u->fd[i]);
+            }
+            return -1;
+        }
+        u->scale[i] = __read_scale(dir, axisNames[i]);
+    }
+    unitCount++;
+    return 0;
+}
+
+int imu_count(void) {
+    return unitCount - 1;
+}
+
+// Tilt-compensated magnetic heading in degrees, clockwise from the unit's +X
+// axis, with the accelerometer giving which way is down
+static double __heading(const double *v) {
+    double roll = atan2(v[ACCEL_Y], v[ACCEL_Z]);
+    double pitch = atan2(-v[ACCEL_X], v[ACCEL_Y] * sin(roll) + v[ACCEL_Z] * cos(roll));
+    double x = v[MAGN_X] * cos(pitch) + (v[MAGN_Y] * sin(roll) + v[MAGN_Z] * cos(roll)) * sin(pitch);
+    double y = v[MAGN_Y] * cos(roll) - v[MAGN_Z] * sin(roll);
+    return wrap_360(atan2(-y, x) / DEG_RAD);
+}
+
+// Reader thread, one per unit. Reads every axis once a sample period and
+// timestamps the reading with the middle of the time it took.
+static void *__read(void *arg) {
+    struct imu_unit *u = arg;
+    uint64_t periodNs = 1000000000ULL / SAMPLE_RATE_HZ;
+    uint64_t next = pipeline_now();
+    while (reading) {
+        struct timespec t = { next / 1000000000ULL, next % 1000000000ULL };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL);
+        next += periodNs;
+
+        double v[AXES];
+        uint64_t before = pipeline_now();
+        bool ok = true;
+        int i;
+        for (i = 0; i < AXES && ok; i++) {
+            ok = __read_value(u->fd[i], &v[i]);
+            v[i] *= u->scale[i];
+        }
+        if (!ok) {
+            continue;
+        }
+        unsigned int count = atomic_load_explicit(&u->count, memory_order_relaxed);
+        struct imu_reading *r = &u->ring[count % RING_LEN];
+        r->timestamp_ns = before + (pipeline_now() - before) / 2;
+        r->heading = wrap_360(__heading(v) + u->offset);
+        r->field = sqrt(v[MAGN_X] * v[MAGN_X] + v[MAGN_Y] * v[MAGN_Y] + v[MAGN_Z] * v[MAGN_Z]);
+        atomic_store_explicit(&u->count, count + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+int imu_start(void) {
+    reading = true;
+    int i;
+    for (i = 1; i < unitCount; i++) {
+        if (pthread_create(&units[i].thread, NULL, __read, &units[i])) {
+            fprintf(stderr, "create IMU thread failed\n");
+            reading = false;
+            while (--i >= 1) {
+                pthread_join(units[i].thread, NULL);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void imu_stop(void) {
+    int i;
+    if (reading) {
+        reading = false;
+        for (i = 1; i < unitCount; i++) {
+            pthread_join(units[i].thread, NULL);
+        }
+    }
+    for (i = 1; i < unitCount; i++) {
+        int a;
+        for (a = 0; a < AXES; a++) {
+            close(units[i].fd[a]);
+        }
+    }
+    unitCount = 1;
+}
+
+// A unit's reading closest in time to t, or NULL if it has none close enough
+static const struct imu_reading *__closest(const struct imu_unit *u, uint64_t t) {
+    unsigned int count = atomic_load_explicit(&u->count, memory_order_acquire);
+    const struct imu_reading *best = NULL;
+    uint64_t bestNs = (uint64_t) STALE_PERIODS * 1000000000ULL / SAMPLE_RATE_HZ;
+    unsigned int i;
+    for (i = 1; i <= LOOK_BACK && i <= count; i++) {
+        const struct imu_reading *r = &u->ring[(count - i) % RING_LEN];
+        uint64_t dt = r->timestamp_ns > t ? r->timestamp_ns - t : t - r->timestamp_ns;
+        if (dt < bestNs) {
+            best = r;
+            bestNs = dt;
+        }
+    }
+    return best;
+}
+
+// Median of up to IMU_MAX + 1 values, sorting them in place
+static double __median(double *v, int n) {
+    int i, j;
+    for (i = 1; i < n; i++) {
+        double x = v[i];
+        for (j = i; j > 0 && v[j - 1] > x; j--) {
+            v[j] = v[j - 1];
+        }
+        v[j] = x;
+    }
+    return n % 2 ? v[n / 2] : (v[n / 2 - 1] + v[n / 2]) / 2.0;
+}
+
+void imu_vote(struct sample *s) {
+    double dt = lastNs != 0 && s->timestamp_ns > lastNs ? (double) (s->timestamp_ns - lastNs) / 1e9 : 0.0;
+    lastNs = s->timestamp_ns;
+
+    // Every unit's heading as an offset from the MPU's, so they can be
+    // averaged without worrying about north
+    double offset[IMU_MAX + 1];
+    double field[IMU_MAX + 1];
+    bool present[IMU_MAX + 1];
+    offset[0] = 0.0;
+    field[0] = s->mag_field;
+    present[0] = true;
+    int i;
+    for (i = 1; i < unitCount; i++) {
+        const struct imu_reading *r = __closest(&units[i], s->timestamp_ns);
+        present[i] = r != NULL;
+        if (r != NULL) {
+            offset[i] = wrap_180(r->heading - s->heading_mag);
+            field[i] = r->field;
+        } else {
+            units[i].stale++;
+        }
+    }
+
+    // The consensus is the median of the units in the vote, or of all of them
+    // if none are
+    double in[IMU_MAX + 1];
+    int inCount = 0;
+    int round;
+    for (round = 0; round < 2 && inCount == 0; round++) {
+        for (i = 0; i < unitCount; i++) {
+            if (present[i] && (round == 1 || !units[i].excluded)) {
+                in[inCount++] = offset[i];
+            }
+        }
+    }
+    double consensus = __median(in, inCount);
+
+    // Smooth each unit's residual from the consensus, and track its usual
+    // field strength so we can tell which unit is disturbed
+    double disturbance[IMU_MAX + 1];
+    int faulty = 0;
+    int presentCount = 0;
+    for (i = 0; i < unitCount; i++) {
+        struct imu_unit *u = &units[i];
+        if (!present[i]) {
+            continue;
+        }
+        presentCount++;
+        u->residual += (wrap_180(offset[i] - consensus) - u->residual) * dt / (IMU_RESIDUAL_TIME_S + dt);
+        u->field_mean = u->field_mean > 0.0 ? u->field_mean + (field[i] - u->field_mean) * dt / (FIELD_TIME_CONSTANT + dt)
+                                            : field[i];
+        disturbance[i] = u->field_mean > 0.0 ? fabs(field[i] / u->field_mean - 1.0) : 0.0;
+        faulty += fabs(u->residual) > IMU_FAULT_DEG;
+    }
+
+    // Leave out units that disagree, but if that is all of them (as it will
+    // be with two that disagree) keep the least disturbed one. Let them back
+    // in once they have agreed for IMU_RECOVER_S.
+    int keep = -1;
+    if (faulty > 0 && faulty == presentCount) {
+        for (i = 0; i < unitCount; i++) {
+            if (present[i] && (keep < 0 || disturbance[i] < disturbance[keep])) {
+                keep = i;
+            }
+        }
+    }
+    double sum = 0.0;
+    int voters = 0;
+    uint32_t excluded = 0;
+    for (i = 0; i < unitCount; i++) {
+        struct imu_unit *u = &units[i];
+        if (!present[i]) {
+            excluded |= 1U << i;
+            continue;
+        }
+        double r = fabs(u->residual);
+        if (!u->excluded) {
+            if (r > IMU_FAULT_DEG && i != keep) {
+                u->excluded = true;
+                u->exclusions++;
+                fprintf(stderr, "IMU %s is %.1f degrees from the others, leaving it out\n", u->name, u->residual);
+                blackbox_note("IMU %s left out, %.1f degrees off", u->name, u->residual);
+            }
+        } else if (r <= IMU_RECOVER_DEG || i == keep) {
+            if (u->agreeing_since_ns == 0) {
+                u->agreeing_since_ns = s->timestamp_ns;
+            }
+            if (i == keep || s->timestamp_ns - u->agreeing_since_ns >= (uint64_t) (IMU_RECOVER_S * 1e9)) {
+                u->excluded = false;
+                u->agreeing_since_ns = 0;
+                fprintf(stderr, "IMU %s agrees again, back in\n", u->name);
+                blackbox_note("IMU %s back in", u->name);
+            }
+        } else {
+            u->agreeing_since_ns = 0;
+        }
+        // A unit that has just gone wrong isn't left out until its residual
+        // builds up, so don't let it pull the heading away in the meantime
+        if (u->excluded || fabs(wrap_180(offset[i] - consensus)) > IMU_FAULT_DEG) {
+            excluded |= 1U << i;
+        } else {
+            sum += offset[i];
+            voters++;
+            u->voted++;
+        }
+    }
+
+    if (voters > 0) {
+        s->heading_mag = wrap_360(s->heading_mag + sum / voters);
+    }
+    s->imu_voters = voters;
+    s->imu_excluded = (int) excluded;
+}
+
+void imu_print_stats(FILE *f) {
+    fprintf(f, "imu                     residual     field  in vote  excluded    votes    stale\n");
+    int i;
+    for (i = 0; i < unitCount; i++) {
+        const struct imu_unit *u = &units[i];
+        fprintf(f, "%-22s %9.2f %9.1f %8s %9u %8llu %8llu\n", u->name, u->residual, u->field_mean,
+                u->excluded ? "no" : "yes", u->exclusions, (unsigned long long) u->voted, (unsigned long long) u->stale);
+    }
+    fflush(f);
+}
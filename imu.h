@@ -0,0 +1,47 @@
+// Beaglebone Blue Heading NMEA UDP Sender - redundant IMUs
+//
+// With only the one MPU, a fault in it or a magnetic disturbance near it goes
+// straight into the heading. This reads up to IMU_MAX more IMUs through the
+// kernel's IIO interface (so anything with an IIO driver, including a second
+// MPU-9250 on another I2C bus), each with its own thread sampling at the
+// sample rate into its own ring. Each sample, a voting stage takes every
+// unit's reading closest in time to the MPU's, and compares each unit's
+// heading with the median. A unit that stays too far from it is left out of
+// the heading until it agrees again, and the heading is the mean of the units
+// still in. The vote looks at a fixed number of readings per unit, so it takes
+// the same time every sample.
+
+#ifndef IMU_H
+#define IMU_H
+
+#include <stdio.h>
+
+#include "sample.h"
+
+// Extra IMUs that can be added, on top of the MPU
+#define IMU_MAX 3
+
+// Add an IMU from a "DEVICE[,OFFSET]" spec. DEVICE is an IIO device directory,
+// either a full path or a name under /sys/bus/iio/devices such as
+// "iio:device1", with in_accel_*_raw and in_magn_*_raw attributes. OFFSET is
+// added to the unit's heading to line it up with the MPU's, as HEADING_OFFSET
+// is for the MPU. Returns 0 on success.
+int imu_add(const char *spec);
+
+// How many extra IMUs have been added
+int imu_count(void);
+
+// Start a thread reading each IMU. Returns 0 on success.
+int imu_start(void);
+
+// Stop them
+void imu_stop(void);
+
+// Pipeline stage, after orientation. Votes on the magnetic heading and
+// records which units are in the vote.
+void imu_vote(struct sample *s);
+
+// Print each unit's residual from the consensus and its health
+void imu_print_stats(FILE *f);
+
+#endif
@@ -0,0 +1,228 @@
+// Beaglebone Blue Heading NMEA UDP Sender - InfluxDB sink
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "fastfmt.h"
+#include "pipeline.h"
+#include "sinks.h"
+#include "tcp.h"
+#include "influx.h"
+
+#define INFLUX_BUFFER_LEN 4096
+// Flush early if there might not be room for another line
+#define INFLUX_MAX_LINE_LEN 256
+
+// Fields that can be written, taken straight from the sample record
+struct influx_field {
+    const char *name;
+    size_t offset;
+    // Decimal places, or -1 for an integer field
+    int decimals;
+};
+
+static const struct influx_field fields[] = {
+    { "heading",     offsetof(struct sample, heading_true),   1 },
+    { "heading_mag", offsetof(struct sample, heading_mag),    1 },
+    { "pitch",       offsetof(struct sample, pitch),          1 },
+    { "roll",        offsetof(struct sample, roll),           1 },
+    { "gnss_bias",   offsetof(struct sample, gnss_bias),      2 },
+    { "source",      offsetof(struct sample, heading_source), -1 },
+    { "imu_voters",  offsetof(struct sample, imu_voters),     -1 },
+    { "imu_excluded", offsetof(struct sample, imu_excluded),  -1 },
+};
+#define FIELD_COUNT ((int) (sizeof(fields) / sizeof(fields[0])))
+
+struct influx_state {
+    bool http;
+    int udpSocket;
+    struct sockaddr_in addr;
+    struct tcp_client tcp;
+    char request[256];
+    int requestLen;
+    const struct influx_field *fields[FIELD_COUNT];
+    int fieldCount;
+    // Offset from CLOCK_MONOTONIC sample times to Unix time
+    int64_t epochOffsetNs;
+    int lines;
+    int len;
+    char buf[INFLUX_BUFFER_LEN];
+};
+
+static void __flush(struct sink *sink, struct influx_state *st) {
+    if (st->lines == 0) {
+        return;
+    }
+    if (st->http) {
+        // Send the request headers and batch together, if we're connected. If
+        // not, the batch is dropped rather than holding up the sample path.
+        if (tcp_ready(&st->tcp)) {
+            tcp_drain(&st->tcp);
+        }
+        if (st->tcp.connected) {
+            char header[64];
+            struct iovec iov[3];
+            iov[0].iov_base = st->request;
+            iov[0].iov_len = st->requestLen;
+            iov[1].iov_base = header;
+            iov[1].iov_len = snprintf(header, sizeof(header), "Content-Length: %d\r\n\r\n", st->len);
+            iov[2].iov_base = st->buf;
+            iov[2].iov_len = st->len;
+            int sent = tcp_send(&st->tcp, iov, 3);
+            if (sent > 0) {
+                sink->sent++;
+                sink->bytes += sent;
+            } else {
+                sink->errors++;
+            }
+        } else {
+            sink->errors++;
+        }
+    } else {
+        if (sendto(st->udpSocket, st->buf, st->len, 0, (struct sockaddr *)&st->addr, sizeof(st->addr)) < 0) {
+            sink->errors++;
+        } else {
+            sink->sent++;
+            sink->bytes += st->len;
+        }
+    }
+    st->lines = 0;
+    st->len = 0;
+}
+
+static void __send(struct sink *sink, const struct sample *s,
+        __attribute__ ((unused)) const struct iovec *iov, __attribute__ ((unused)) int iovcnt) {
+    struct influx_state *st = sink->state;
+    if (st->lines == 0) {
+        st->epochOffsetNs = pipeline_epoch_offset();
+    }
+
+    // measurement[,tags] field=value,field=value timestamp. The measurement's
+    // sizeof counts its terminator, which is where the space goes.
+    char *p = st->buf + st->len;
+    memcpy(p, INFLUX_MEASUREMENT " ", sizeof(INFLUX_MEASUREMENT));
+    p += sizeof(INFLUX_MEASUREMENT);
+    int i;
+    for (i = 0; i < st->fieldCount; i++) {
+        const struct influx_field *f = st->fields[i];
+        if (i > 0) {
+            *p++ = ',';
+        }
+        size_t nameLen = strlen(f->name);
+        memcpy(p, f->name, nameLen);
+        p += nameLen;
+        *p++ = '=';
+        if (f->decimals < 0) {
+            p = fmt_int(p, *(const int *) ((const char *) s + f->offset));
+            *p++ = 'i';
+        } else {
+            p = fmt_fixed(p, *(const double *) ((const char *) s + f->offset), f->decimals);
+        }
+    }
+    *p++ = ' ';
+    p = fmt_uint(p, (uint64_t) ((int64_t) s->timestamp_ns + st->epochOffsetNs));
+    *p++ = '\n';
+    st->len = p - st->buf;
+    st->lines++;
+
+    if (st->lines >= INFLUX_BATCH_SAMPLES || st->len > INFLUX_BUFFER_LEN - INFLUX_MAX_LINE_LEN) {
+        __flush(sink, st);
+    }
+}
+
+static void __close(struct sink *sink) {
+    struct influx_state *st = sink->state;
+    __flush(sink, st);
+    if (st->http) {
+        tcp_close(&st->tcp);
+    } else {
+        close(st->udpSocket);
+    }
+    free(st);
+    sink->state = NULL;
+}
+
+int influx_add(const char *url, const char *fieldList) {
+    struct influx_state *st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        fprintf(stderr, "can't allocate InfluxDB sink %s\n", url);
+        return -1;
+    }
+    char host[48];
+    char path[128] = "/write?db=" INFLUX_DATABASE "&precision=ns";
+    int port;
+    if (sscanf(url, "udp://%47[^:]:%d", host, &port) == 2) {
+        st->http = false;
+    } else if (sscanf(url, "http://%47[^:]:%d%127s", host, &port, path) >= 2) {
+        st->http = true;
+    } else {
+        fprintf(stderr, "bad InfluxDB URL %s, expected udp://HOST:PORT or http://HOST:PORT/PATH\n", url);
+        free(st);
+        return -1;
+    }
+
+    // Pick out the fields
+    char copy[128];
+    snprintf(copy, sizeof(copy), "%s", fieldList != NULL ? fieldList : INFLUX_DEFAULT_FIELDS);
+    char *saveptr;
+    char *name;
+    for (name = strtok_r(copy, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+        int i;
+        for (i = 0; i < FIELD_COUNT && strcmp(name, fields[i].name) != 0; i++) {
+        }
+        if (i == FIELD_COUNT || st->fieldCount == FIELD_COUNT) {
+            fprintf(stderr, "unknown InfluxDB field %s\n", name);
+            free(st);
+            return -1;
+        }
+        st->fields[st->fieldCount++] = &fields[i];
+    }
+
+    if (st->http) {
+        if (tcp_init(&st->tcp, host, port)) {
+            free(st);
+            return -1;
+        }
+        st->requestLen = snprintf(st->request, sizeof(st->request),
+                "POST %s HTTP/1.1\r\nHost: %s:%d\r\nContent-Type: text/plain\r\n%s%s%s",
+                path, host, port,
+                INFLUX_TOKEN[0] != '\0' ? "Authorization: Token " : "", INFLUX_TOKEN,
+                INFLUX_TOKEN[0] != '\0' ? "\r\n" : "");
+        tcp_ready(&st->tcp);
+    } else {
+        if (inet_pton(AF_INET, host, &st->addr.sin_addr) != 1) {
+            fprintf(stderr, "bad InfluxDB address %s, expected an IPv4 address\n", host);
+            free(st);
+            return -1;
+        }
+        st->addr.sin_family = AF_INET;
+        st->addr.sin_port   = htons(port);
+        if ((st->udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+            fprintf(stderr, "create InfluxDB socket failed\n");
+            free(st);
+            return -1;
+        }
+    }
+
+    char sinkName[64];
+    snprintf(sinkName, sizeof(sinkName), "influx %s:%d", host, port);
+    struct sink *sink = sinks_add(sinkName, 0);
+    if (sink == NULL) {
+        __close(&(struct sink) { .state = st });
+        return -1;
+    }
+    sink->send = __send;
+    sink->close = __close;
+    sink->low_priority = true;
+    sink->state = st;
+    return 0;
+}
@@ -0,0 +1,17 @@
+// Beaglebone Blue Heading NMEA UDP Sender - InfluxDB sink
+//
+// Writes samples straight to InfluxDB (or Telegraf's influxdb listener) as line
+// protocol, so nothing has to parse NMEA to chart heading and attitude. Lines
+// are batched INFLUX_BATCH_SAMPLES at a time, each with its own nanosecond
+// timestamp.
+
+#ifndef INFLUX_H
+#define INFLUX_H
+
+// Add an InfluxDB sink. url is "udp://HOST:PORT" or
+// "http://HOST:PORT/PATH?QUERY", e.g. "http://127.0.0.1:8086/write?db=boat".
+// fields is a comma-separated list of the fields to write, or NULL for
+// INFLUX_DEFAULT_FIELDS. Returns 0 on success.
+int influx_add(const char *url, const char *fields);
+
+#endif
@@ -0,0 +1,119 @@
+// Beaglebone Blue Heading NMEA UDP Sender - load shedding
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "pipeline.h"
+#include "sinks.h"
+#include "pcap.h"
+#include "blackbox.h"
+#include "plugin.h"
+#include "loadshed.h"
+
+static const char *levelNames[SHED_LEVELS] = {
+    "none", "sentences", "sinks", "capture", "timing", "plugins"
+};
+
+static volatile int level = SHED_NONE;
+
+// Written by the sample path, collected once a second. Microseconds so that a
+// second's worth fits in 32 bits, which is atomic on the BeagleBone too.
+static atomic_uint busyUs = 0;
+static atomic_uint busySamples = 0;
+static atomic_uint sentencesShed = 0;
+
+// Only touched by loadshed_update() and loadshed_print_stats()
+static double budget = 0.0;
+static double pressure = 0.0;
+static bool pressureAvailable = true;
+static int calmSeconds = 0;
+static unsigned int levelEntered[SHED_LEVELS];
+
+void loadshed_measure(struct sample *s) {
+    atomic_fetch_add_explicit(&busyUs, (unsigned int) ((pipeline_now() - s->arrival_ns) / 1000), memory_order_relaxed);
+    atomic_fetch_add_explicit(&busySamples, 1, memory_order_relaxed);
+}
+
+bool loadshed_drop_sentence(enum sentence id) {
+    if (level < SHED_SENTENCES || (SHED_KEEP_SENTENCES & SENTENCE_BIT(id))) {
+        return false;
+    }
+    atomic_fetch_add_explicit(&sentencesShed, 1, memory_order_relaxed);
+    return true;
+}
+
+bool loadshed_drop_extra_sentence(void) {
+    if (level < SHED_SENTENCES) {
+        return false;
+    }
+    atomic_fetch_add_explicit(&sentencesShed, 1, memory_order_relaxed);
+    return true;
+}
+
+// The "some avg10" CPU pressure in percent: how much of the last ten seconds
+// something runnable was waiting for the CPU
+static void __read_pressure(void) {
+    FILE *f = fopen("/proc/pressure/cpu", "r");
+    if (f == NULL) {
+        pressureAvailable = false;
+        return;
+    }
+    if (fscanf(f, "some avg10=%lf", &pressure) != 1) {
+        pressure = 0.0;
+    }
+    fclose(f);
+}
+
+// Make a level take effect in the modules that do the work
+static void __apply(int newLevel) {
+    level = newLevel;
+    sinks_shed_low_priority(newLevel >= SHED_SINKS);
+    pcap_pause(newLevel >= SHED_CAPTURE);
+    pipeline_timing = newLevel < SHED_TIMING;
+    plugin_shed(newLevel >= SHED_PLUGINS);
+}
+
+void loadshed_update(void) {
+    unsigned int us = atomic_exchange(&busyUs, 0);
+    unsigned int samples = atomic_exchange(&busySamples, 0);
+    budget = samples > 0 ? (double) us * SAMPLE_RATE_HZ / 1e6 / (double) samples : 0.0;
+    if (pressureAvailable) {
+        __read_pressure();
+    }
+
+    // Shed one more kind of work each second while overloaded, and restore one
+    // each SHED_RESTORE_S seconds while calm
+    if (budget > SHED_BUDGET_HIGH || pressure > SHED_PSI_HIGH) {
+        calmSeconds = 0;
+        if (level < SHED_LEVELS - 1) {
+            __apply(level + 1);
+            levelEntered[level]++;
+            fprintf(stderr, "overloaded (%.0f%% of sample period, %.0f%% CPU pressure), shedding %s\n",
+                    budget * 100.0, pressure, levelNames[level]);
+            blackbox_note("overloaded, shedding %s", levelNames[level]);
+        }
+    } else if (budget < SHED_BUDGET_LOW && pressure < SHED_PSI_LOW && level > SHED_NONE) {
+        if (++calmSeconds >= SHED_RESTORE_S) {
+            calmSeconds = 0;
+            fprintf(stderr, "load back to normal, restoring %s\n", levelNames[level]);
+            blackbox_note("restoring %s", levelNames[level]);
+            __apply(level - 1);
+        }
+    } else {
+        calmSeconds = 0;
+    }
+}
+
+void loadshed_print_stats(FILE *f) {
+    fprintf(f, "load shedding: level %s, %.1f%% of sample period, %.1f%% CPU pressure%s, %u sentences shed\n",
+            levelNames[level], budget * 100.0, pressure, pressureAvailable ? "" : " (unavailable)",
+            atomic_load(&sentencesShed));
+    int i;
+    for (i = SHED_SENTENCES; i < SHED_LEVELS; i++) {
+        fprintf(f, "  shed %-10s %u times\n", levelNames[i], levelEntered[i]);
+    }
+    fflush(f);
+}
@@ -0,0 +1,53 @@
+// Beaglebone Blue Heading NMEA UDP Sender - load shedding
+//
+// When the CPU is overloaded, everything we do competes equally with the
+// heading itself. This watches how much of each sample period goes on
+// processing a sample, and the kernel's CPU pressure figure, and when either
+// is too high drops optional work one kind at a time in order of importance:
+//
+//   1. sentences other than SHED_KEEP_SENTENCES
+//   2. low-priority sinks (InfluxDB and MQTT)
+//   3. pcap capture
+//   4. stage timing statistics
+//   5. plugins
+//
+// Each comes back, most important first, once things have been calm for
+// SHED_RESTORE_S seconds.
+
+#ifndef LOADSHED_H
+#define LOADSHED_H
+
+#include <stdio.h>
+#include <stdbool.h>
+
+#include "sample.h"
+
+enum shed_level {
+    SHED_NONE,
+    SHED_SENTENCES,
+    SHED_SINKS,
+    SHED_CAPTURE,
+    SHED_TIMING,
+    SHED_PLUGINS,
+    SHED_LEVELS
+};
+
+// Pipeline stage, last in the pipeline. Measures how long the sample took.
+void loadshed_measure(struct sample *s);
+
+// Whether to skip formatting a sentence for this sample, counting it if so
+bool loadshed_drop_sentence(enum sentence id);
+
+// The same for a template or plugin sentence, which is never one of
+// SHED_KEEP_SENTENCES
+bool loadshed_drop_extra_sentence(void);
+
+// Look at the last second's measurements and CPU pressure, and shed or
+// restore work. Call once a second.
+void loadshed_update(void);
+
+// Print the current level, what it is based on, and how often each level has
+// been entered
+void loadshed_print_stats(FILE *f);
+
+#endif
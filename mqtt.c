@@ -0,0 +1,253 @@
+// Beaglebone Blue Heading NMEA UDP Sender - MQTT sink
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "config.h"
+#include "fastfmt.h"
+#include "pipeline.h"
+#include "sinks.h"
+#include "tcp.h"
+#include "mqtt.h"
+
+#define MQTT_CONNECT 0x10
+#define MQTT_PUBLISH 0x30
+#define MQTT_PINGREQ 0xC0
+
+// Room in front of each encoded topic for the fixed header, which is one type
+// byte plus up to four bytes of remaining length
+#define HEADER_ROOM 5
+#define TOPIC_LEN 96
+
+// A topic with its length prefix encoded once at startup, ready to have a
+// fixed header written in front of it per message
+struct mqtt_topic {
+    char buf[HEADER_ROOM + 2 + TOPIC_LEN];
+    int len;
+};
+
+// Per-sample topics, each publishing one value from the sample record
+struct mqtt_value {
+    const char *name;
+    size_t offset;
+};
+
+static const struct mqtt_value values[] = {
+    { "heading",  offsetof(struct sample, heading_true) },
+    { "pitch",    offsetof(struct sample, pitch) },
+    { "roll",     offsetof(struct sample, roll) },
+};
+#define VALUE_COUNT ((int) (sizeof(values) / sizeof(values[0])))
+
+struct mqtt_state {
+    struct tcp_client tcp;
+    uint32_t lastConnects;
+    uint64_t lastSendNs;
+    struct mqtt_topic topics[VALUE_COUNT];
+    // Batching, when MQTT_BATCH_SAMPLES > 1
+    struct mqtt_topic batchTopic;
+    int64_t epochOffsetNs;
+    int batchSamples;
+    int batchLen;
+    char batch[MQTT_BATCH_SAMPLES * 64];
+};
+
+static void __encode_topic(struct mqtt_topic *t, const char *prefix, const char *name) {
+    int len = snprintf(t->buf + HEADER_ROOM + 2, TOPIC_LEN, "%s/%s", prefix, name);
+    if (len >= TOPIC_LEN) {
+        len = TOPIC_LEN - 1;
+    }
+    t->buf[HEADER_ROOM] = (char) (len >> 8);
+    t->buf[HEADER_ROOM + 1] = (char) (len & 0xFF);
+    t->len = 2 + len;
+}
+
+// Write a fixed header for a packet of the given type and remaining length
+// into the room before the topic. Returns where the packet starts.
+static char *__fixed_header(struct mqtt_topic *t, int type, int remaining) {
+    unsigned char len[4];
+    int n = 0;
+    do {
+        len[n] = remaining % 128;
+        remaining /= 128;
+        if (remaining > 0) {
+            len[n] |= 0x80;
+        }
+        n++;
+    } while (remaining > 0 && n < 4);
+    char *start = t->buf + HEADER_ROOM - 1 - n;
+    start[0] = (char) type;
+    memcpy(start + 1, len, n);
+    return start;
+}
+
+// Fill in iov[0..1] with a QoS 0 publish: fixed header, topic and payload,
+// with no packet identifier
+static void __publish_iov(struct mqtt_topic *t, const char *payload, int len, struct iovec *iov) {
+    char *start = __fixed_header(t, MQTT_PUBLISH, t->len + len);
+    iov[0].iov_base = start;
+    iov[0].iov_len = (t->buf + HEADER_ROOM + t->len) - start;
+    iov[1].iov_base = (char *) payload;
+    iov[1].iov_len = len;
+}
+
+// Send publish packets, all in one write
+static void __publish(struct sink *sink, struct mqtt_state *st, const struct iovec *iov, int iovcnt) {
+    int sent = tcp_send(&st->tcp, iov, iovcnt);
+    if (sent < 0) {
+        sink->errors++;
+        return;
+    }
+    sink->sent += iovcnt / 2;
+    sink->bytes += sent;
+    st->lastSendNs = pipeline_now();
+}
+
+// Make sure we are connected, sending CONNECT on each new connection. The
+// broker lets us publish straight after without waiting for CONNACK, so
+// nothing here waits. Returns true if we can publish, leaving the caller to
+// count an error if not.
+static bool __ready(struct mqtt_state *st) {
+    if (!tcp_ready(&st->tcp)) {
+        return false;
+    }
+    tcp_drain(&st->tcp);
+    if (!st->tcp.connected) {
+        return false;
+    }
+
+    uint64_t now = pipeline_now();
+    if (st->tcp.connects != st->lastConnects) {
+        st->lastConnects = st->tcp.connects;
+        static const char clientId[] = MQTT_CLIENT_ID;
+        int idLen = (int) sizeof(clientId) - 1;
+        unsigned char packet[14 + sizeof(clientId)];
+        int n = 0;
+        packet[n++] = MQTT_CONNECT;
+        packet[n++] = (unsigned char) (10 + 2 + idLen);
+        memcpy(packet + n, "\0\4MQTT\4\2", 8);     // protocol 3.1.1, clean session
+        n += 8;
+        packet[n++] = MQTT_KEEPALIVE_S >> 8;
+        packet[n++] = MQTT_KEEPALIVE_S & 0xFF;
+        packet[n++] = (unsigned char) (idLen >> 8);
+        packet[n++] = (unsigned char) (idLen & 0xFF);
+        memcpy(packet + n, clientId, idLen);
+        n += idLen;
+        struct iovec iov = { packet, n };
+        if (tcp_send(&st->tcp, &iov, 1) < 0) {
+            return false;
+        }
+        st->lastSendNs = now;
+    } else if (now - st->lastSendNs > (uint64_t) MQTT_KEEPALIVE_S * 500000000ULL) {
+        // Nothing sent for half the keepalive time, e.g. while batching slowly
+        static const char ping[] = { (char) MQTT_PINGREQ, 0 };
+        struct iovec iov = { (char *) ping, 2 };
+        if (tcp_send(&st->tcp, &iov, 1) < 0) {
+            return false;
+        }
+        st->lastSendNs = now;
+    }
+    return true;
+}
+
+static void __send(struct sink *sink, const struct sample *s,
+        __attribute__ ((unused)) const struct iovec *sentences, __attribute__ ((unused)) int sentenceCount) {
+    struct mqtt_state *st = sink->state;
+
+    // Batching: one "time_ms,heading,pitch,roll" line per sample, with Unix
+    // time in ms, published together every MQTT_BATCH_SAMPLES samples
+    if (MQTT_BATCH_SAMPLES > 1) {
+        if (st->batchSamples == 0) {
+            st->epochOffsetNs = pipeline_epoch_offset();
+        }
+        char *p = st->batch + st->batchLen;
+        p = fmt_uint(p, (uint64_t) ((int64_t) s->timestamp_ns + st->epochOffsetNs) / 1000000ULL);
+        int i;
+        for (i = 0; i < VALUE_COUNT; i++) {
+            *p++ = ',';
+            p = fmt_fixed(p, *(const double *) ((const char *) s + values[i].offset), 1);
+        }
+        *p++ = '\n';
+        st->batchLen = p - st->batch;
+        if (++st->batchSamples < MQTT_BATCH_SAMPLES) {
+            return;
+        }
+        if (__ready(st)) {
+            struct iovec iov[2];
+            __publish_iov(&st->batchTopic, st->batch, st->batchLen, iov);
+            __publish(sink, st, iov, 2);
+        } else {
+            sink->errors++;
+        }
+        st->batchSamples = 0;
+        st->batchLen = 0;
+        return;
+    }
+
+    if (!__ready(st)) {
+        sink->errors++;
+        return;
+    }
+    char payloads[VALUE_COUNT][24];
+    struct iovec iov[VALUE_COUNT * 2];
+    int i;
+    for (i = 0; i < VALUE_COUNT; i++) {
+        char *end = fmt_fixed(payloads[i], *(const double *) ((const char *) s + values[i].offset), 1);
+        __publish_iov(&st->topics[i], payloads[i], end - payloads[i], &iov[i * 2]);
+    }
+    __publish(sink, st, iov, VALUE_COUNT * 2);
+}
+
+static void __close(struct sink *sink) {
+    struct mqtt_state *st = sink->state;
+    if (st->tcp.connected) {
+        static const char disconnect[] = { (char) 0xE0, 0 };
+        struct iovec iov = { (char *) disconnect, 2 };
+        tcp_send(&st->tcp, &iov, 1);
+    }
+    tcp_close(&st->tcp);
+    free(st);
+    sink->state = NULL;
+}
+
+int mqtt_add(const char *spec) {
+    char host[48];
+    char prefix[64] = MQTT_TOPIC_PREFIX;
+    int port;
+    if (sscanf(spec, "%47[^:]:%d/%63s", host, &port, prefix) < 2 || port <= 0 || port > 65535) {
+        fprintf(stderr, "bad MQTT broker %s, expected HOST:PORT[/TOPIC_PREFIX]\n", spec);
+        return -1;
+    }
+
+    struct mqtt_state *st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        fprintf(stderr, "can't allocate MQTT sink %s\n", spec);
+        return -1;
+    }
+    if (tcp_init(&st->tcp, host, port)) {
+        free(st);
+        return -1;
+    }
+    int i;
+    for (i = 0; i < VALUE_COUNT; i++) {
+        __encode_topic(&st->topics[i], prefix, values[i].name);
+    }
+    __encode_topic(&st->batchTopic, prefix, "samples");
+
+    char name[64];
+    snprintf(name, sizeof(name), "mqtt %s:%d", host, port);
+    struct sink *sink = sinks_add(name, 0);
+    if (sink == NULL) {
+        free(st);
+        return -1;
+    }
+    sink->send = __send;
+    sink->close = __close;
+    sink->low_priority = true;
+    sink->state = st;
+    tcp_ready(&st->tcp);
+    return 0;
+}
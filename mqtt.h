@@ -0,0 +1,15 @@
+// Beaglebone Blue Heading NMEA UDP Sender - MQTT sink
+//
+// A minimal MQTT 3.1.1 client that publishes heading and attitude to a broker
+// such as Mosquitto, at QoS 0 over a persistent connection. It never waits for
+// the broker: if the connection is down, messages are dropped while it
+// reconnects in the background.
+
+#ifndef MQTT_H
+#define MQTT_H
+
+// Add an MQTT sink publishing to a broker at "HOST:PORT" or
+// "HOST:PORT/TOPIC_PREFIX". Returns 0 on success.
+int mqtt_add(const char *spec);
+
+#endif
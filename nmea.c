@@ -0,0 +1,304 @@
+// Beaglebone Blue Heading NMEA UDP Sender - NMEA parser
+
+#include <string.h>
+
+#include "nmea.h"
+
+// Scanning a machine word at a time: 8 bytes on x86-64, 4 on the BeagleBone.
+// A byte equal to c shows up as its top bit set in __match(), and on a
+// little-endian machine the lowest set bit is the first match.
+typedef unsigned long word_t;
+#define ONES ((word_t) -1 / 0xff)
+#define HIGHS (ONES * 0x80)
+#define WORD_SCAN (__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__)
+
+static inline word_t __match(word_t w, unsigned char c) {
+    word_t x = w ^ (ONES * c);
+    return (x - ONES) & ~x & HIGHS;
+}
+
+// First c in [p, end), or end if there isn't one
+static inline const char *__find(const char *p, const char *end, char c) {
+#if WORD_SCAN
+    while (end - p >= (long) sizeof(word_t)) {
+        word_t w;
+        memcpy(&w, p, sizeof(w));
+        word_t m = __match(w, (unsigned char) c);
+        if (m != 0) {
+            return p + (__builtin_ctzl(m) >> 3);
+        }
+        p += sizeof(word_t);
+    }
+#endif
+    while (p < end && *p != c) {
+        p++;
+    }
+    return p;
+}
+
+// XOR of every byte in [p, end). XORing whole words and then folding the
+// result gives the same answer, whatever the byte order.
+static inline unsigned char __checksum(const char *p, const char *end) {
+    word_t x = 0;
+    while (end - p >= (long) sizeof(word_t)) {
+        word_t w;
+        memcpy(&w, p, sizeof(w));
+        x ^= w;
+        p += sizeof(word_t);
+    }
+    unsigned int shift;
+    for (shift = sizeof(word_t) * 4; shift >= 8; shift /= 2) {
+        x ^= x >> shift;
+    }
+    unsigned char crc = (unsigned char) x;
+    while (p < end) {
+        crc ^= (unsigned char) *p++;
+    }
+    return crc;
+}
+
+static inline int __hex(char c) {
+    if (c >= '0' && c <= '9') {
+        return c - '0';
+    }
+    if (c >= 'A' && c <= 'F') {
+        return c - 'A' + 10;
+    }
+    if (c >= 'a' && c <= 'f') {
+        return c - 'a' + 10;
+    }
+    return -1;
+}
+
+// Whether [p, p + n) ends with a checksum, and so is a whole sentence even
+// without a line ending
+static bool __complete(const char *p, size_t n) {
+    return n >= 4 && p[n - 3] == '*' && __hex(p[n - 2]) >= 0 && __hex(p[n - 1]) >= 0;
+}
+
+// Check and split one line, without its line ending
+static bool __parse(struct nmea_parser *parser, const char *p, size_t n, struct nmea_sentence *s) {
+    // Skip anything before the start of the sentence
+    const char *end = p + n;
+    while (p < end && *p != '$' && *p != '!') {
+        p++;
+    }
+    n = end - p;
+    if (n == 0) {
+        return false;
+    }
+    if (n > NMEA_MAX_LEN || !__complete(p, n)) {
+        parser->framing_errors++;
+        return false;
+    }
+    const char *star = end - 3;
+    if (__checksum(p + 1, star) != (__hex(star[1]) << 4 | __hex(star[2]))) {
+        parser->checksum_errors++;
+        return false;
+    }
+
+    const char *field = p + 1;
+    s->field_count = 0;
+    while (s->field_count < NMEA_MAX_FIELDS) {
+        const char *comma = __find(field, star, ',');
+        s->fields[s->field_count].p = field;
+        s->fields[s->field_count].len = comma - field;
+        s->field_count++;
+        if (comma == star) {
+            break;
+        }
+        field = comma + 1;
+    }
+    parser->sentences++;
+    return true;
+}
+
+void nmea_init(struct nmea_parser *p) {
+    memset(p, 0, sizeof(*p));
+}
+
+void nmea_feed(struct nmea_parser *p, const char *buf, size_t len) {
+    p->buf = buf;
+    p->len = len;
+    p->pos = 0;
+    // A new sentence at the start means the held one was never finished
+    if (p->partial_len > 0 && len > 0 && (buf[0] == '$' || buf[0] == '!')) {
+        p->partial_len = 0;
+        p->framing_errors++;
+    }
+}
+
+bool nmea_next(struct nmea_parser *p, struct nmea_sentence *s) {
+    while (p->pos < p->len) {
+        const char *start = p->buf + p->pos;
+        const char *end = p->buf + p->len;
+        const char *nl = __find(start, end, '\n');
+        size_t n = nl - start;
+        p->pos += nl < end ? n + 1 : n;
+
+        // Finish off a sentence started in the previous buffer
+        if (p->partial_len > 0) {
+            if (p->partial_len + n > NMEA_MAX_LEN) {
+                p->partial_len = 0;
+                p->framing_errors++;
+                continue;
+            }
+            memcpy(p->partial + p->partial_len, start, n);
+            start = p->partial;
+            n += p->partial_len;
+            p->partial_len = 0;
+        }
+        if (n > 0 && start[n - 1] == '\r') {
+            n--;
+        }
+
+        // The last line of a buffer is held until the next one unless it is
+        // already a whole sentence
+        if (nl == end && !__complete(start, n)) {
+            if (n > NMEA_MAX_LEN) {
+                p->framing_errors++;
+            } else {
+                memmove(p->partial, start, n);
+                p->partial_len = n;
+            }
+            return false;
+        }
+        if (__parse(p, start, n, s)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool nmea_is(const struct nmea_sentence *s, const char *type) {
+    const struct nmea_field *address = &s->fields[0];
+    return address->len == 5 && memcmp(address->p + 2, type, 3) == 0;
+}
+
+struct nmea_field nmea_field(const struct nmea_sentence *s, int n) {
+    if (n < s->field_count) {
+        return s->fields[n];
+    }
+    struct nmea_field empty = { "", 0 };
+    return empty;
+}
+
+bool nmea_decimal(struct nmea_field f, double *v) {
+    static const double scales[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9,
+        1e10, 1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18
+    };
+    const char *p = f.p;
+    const char *end = f.p + f.len;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    // Up to 18 significant digits fit in the mantissa; any more decimals are
+    // beyond double precision anyway, so they are ignored
+    uint64_t mantissa = 0;
+    int digits = 0;
+    int decimals = 0;
+    bool any = false;
+    bool point = false;
+    for (; p < end; p++) {
+        if (*p >= '0' && *p <= '9') {
+            any = true;
+            if (digits < 18) {
+                mantissa = mantissa * 10 + (uint64_t) (*p - '0');
+                digits += mantissa != 0;
+                decimals += point;
+            } else if (!point) {
+                return false;
+            }
+        } else if (*p == '.' && !point) {
+            point = true;
+        } else {
+            return false;
+        }
+    }
+    if (!any || decimals > 18) {
+        return false;
+    }
+    // Exact for up to 15 or so digits, as both are exactly representable
+    *v = (double) mantissa / scales[decimals];
+    if (negative) {
+        *v = -*v;
+    }
+    return true;
+}
+
+bool nmea_scaled(struct nmea_field f, int decimals, int64_t *v) {
+    const char *p = f.p;
+    const char *end = f.p + f.len;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    int64_t value = 0;
+    int digits = 0;
+    int places = 0;
+    bool any = false;
+    bool point = false;
+    bool roundUp = false;
+    for (; p < end; p++) {
+        if (*p >= '0' && *p <= '9') {
+            any = true;
+            if (!point || places < decimals) {
+                value = value * 10 + (*p - '0');
+                digits += value != 0;
+                places += point;
+            } else if (places++ == decimals) {
+                // Round on the first digit past the ones kept
+                roundUp = *p >= '5';
+            }
+        } else if (*p == '.' && !point) {
+            point = true;
+        } else {
+            return false;
+        }
+        if (digits > 18) {
+            return false;
+        }
+    }
+    if (!any) {
+        return false;
+    }
+    for (; places < decimals; places++) {
+        value *= 10;
+        if (value != 0 && ++digits > 18) {
+            return false;
+        }
+    }
+    value += roundUp;
+    *v = negative ? -value : value;
+    return true;
+}
+
+bool nmea_int(struct nmea_field f, long *v) {
+    const char *p = f.p;
+    const char *end = f.p + f.len;
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        p++;
+    }
+    if (p == end || end - p > 9) {
+        return false;
+    }
+    long value = 0;
+    for (; p < end; p++) {
+        if (*p < '0' || *p > '9') {
+            return false;
+        }
+        value = value * 10 + (*p - '0');
+    }
+    *v = negative ? -value : value;
+    return true;
+}
+
+char nmea_char(struct nmea_field f) {
+    return f.len > 0 ? f.p[0] : 0;
+}
@@ -0,0 +1,85 @@
+// Beaglebone Blue Heading NMEA UDP Sender - NMEA parser
+//
+// Splits a stream of received bytes into checksummed NMEA sentences and their
+// fields, without copying them: fields point straight into the receive buffer.
+// A datagram can hold several sentences, and a sentence can be split across
+// datagrams. Delimiters are found and checksums worked out a machine word at a
+// time, and numbers are parsed without strtod() or the locale.
+//
+//     nmea_feed(&parser, buf, len);
+//     struct nmea_sentence s;
+//     while (nmea_next(&parser, &s)) {
+//         if (nmea_is(&s, "HDT")) ...
+//     }
+
+#ifndef NMEA_H
+#define NMEA_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Longest sentence accepted, from "$" to the checksum. NMEA itself allows 82,
+// but some devices go over.
+#define NMEA_MAX_LEN 128
+// Most fields kept per sentence, including the address field
+#define NMEA_MAX_FIELDS 32
+
+struct nmea_field {
+    const char *p;
+    int len;
+};
+
+struct nmea_sentence {
+    // fields[0] is the address, e.g. "GPHDT", and fields[1] onwards are the
+    // data fields. Empty fields have len 0.
+    struct nmea_field fields[NMEA_MAX_FIELDS];
+    int field_count;
+};
+
+struct nmea_parser {
+    // The buffer being parsed
+    const char *buf;
+    size_t len;
+    size_t pos;
+    // The start of a sentence left at the end of the previous buffer
+    char partial[NMEA_MAX_LEN];
+    int partial_len;
+    // Counters
+    uint64_t sentences;
+    uint64_t checksum_errors;
+    uint64_t framing_errors;
+};
+
+void nmea_init(struct nmea_parser *p);
+
+// Start parsing a new buffer, which must stay valid until nmea_next() returns
+// false
+void nmea_feed(struct nmea_parser *p, const char *buf, size_t len);
+
+// Get the next valid sentence from the buffer. Returns false when there are
+// none left. The sentence's fields are only valid until the next call.
+bool nmea_next(struct nmea_parser *p, struct nmea_sentence *s);
+
+// Whether the sentence has the given three-letter type, from any talker
+bool nmea_is(const struct nmea_sentence *s, const char *type);
+
+// Field n of a sentence, empty if the sentence doesn't have that many
+struct nmea_field nmea_field(const struct nmea_sentence *s, int n);
+
+// Parse a field as a decimal number such as "-12.345". Returns false if it is
+// empty or isn't a number.
+bool nmea_decimal(struct nmea_field f, double *v);
+
+// Parse a decimal field as a whole number of units of 10^-decimals, rounded
+// to the nearest, without floating point. Returns false if it is empty, isn't
+// a number, or has more than 18 digits once scaled.
+bool nmea_scaled(struct nmea_field f, int decimals, int64_t *v);
+
+// Parse a field as an integer. Returns false if it is empty or isn't one.
+bool nmea_int(struct nmea_field f, long *v);
+
+// A single-character field such as a status flag, or 0 if it is empty
+char nmea_char(struct nmea_field f);
+
+#endif
@@ -0,0 +1,315 @@
+// Beaglebone Blue Heading NMEA UDP Sender - pcap capture sink
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <arpa/inet.h>
+
+#include "config.h"
+#include "sinks.h"
+#include "pcap.h"
+#include "events.h"
+
+// Datagrams waiting for the writer thread. Enough for a couple of seconds of
+// several destinations at the highest sample rate; if the writer falls further
+// behind than that, datagrams are dropped from the capture rather than
+// holding up sending.
+#define RING_LEN 512
+#define DATAGRAM_LEN ((SENTENCE_COUNT + SAMPLE_EXTRA_SENTENCES) * SLAB_BUFFER_LEN)
+// How often the writer thread wakes up to write what has been captured
+#define WRITE_INTERVAL_MS 200
+
+// pcap with nanosecond timestamps, holding raw IPv4 packets
+#define PCAP_MAGIC_NS 0xa1b23c4d
+#define LINKTYPE_RAW 101
+
+struct pcap_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+};
+
+struct pcap_record {
+    uint32_t ts_sec;
+    uint32_t ts_nsec;
+    uint32_t incl_len;
+    uint32_t orig_len;
+};
+
+// IPv4 and UDP headers, built by the writer thread
+struct packet_header {
+    uint8_t version_ihl;
+    uint8_t tos;
+    uint16_t total_len;
+    uint16_t id;
+    uint16_t frag;
+    uint8_t ttl;
+    uint8_t protocol;
+    uint16_t checksum;
+    uint32_t src;
+    uint32_t dst;
+    uint16_t sport;
+    uint16_t dport;
+    uint16_t udp_len;
+    uint16_t udp_checksum;
+};
+
+struct capture {
+    uint64_t timeNs;
+    struct sockaddr_in src;
+    struct sockaddr_in dst;
+    int len;
+    char data[DATAGRAM_LEN];
+};
+
+// Single producer (the sample path), single consumer (the writer thread)
+static struct capture ring[RING_LEN];
+static atomic_uint ringHead = 0;
+static atomic_uint ringTail = 0;
+
+static struct sink *pcapSink = NULL;
+static char pcapPath[256];
+static FILE *pcapFile = NULL;
+static long pcapFileBytes = 0;
+static uint16_t packetId = 0;
+static bool writeFailed = false;
+static pthread_t writerThread;
+static volatile bool writing = false;
+static volatile bool paused = false;
+
+static uint16_t __ip_checksum(const struct packet_header *h) {
+    const uint16_t *words = (const uint16_t *) h;
+    uint32_t sum = 0;
+    int i;
+    for (i = 0; i < 10; i++) {
+        sum += words[i];
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    return (uint16_t) ~sum;
+}
+
+// Start a new file and event index, moving path to path.1, path.1 to path.2
+// and so on, and path.idx to path.1.idx and so on, and dropping the oldest.
+// Failures are only reported once, as the writer thread retries after them.
+static int __open_file(void) {
+    char from[272], to[272];
+    if (pcapFile != NULL) {
+        fclose(pcapFile);
+        pcapFile = NULL;
+        events_close();
+        int i;
+        for (i = PCAP_ROTATE_FILES; i > 0; i--) {
+            if (i > 1) {
+                snprintf(from, sizeof(from), "%s.%d", pcapPath, i - 1);
+            } else {
+                snprintf(from, sizeof(from), "%s", pcapPath);
+            }
+            snprintf(to, sizeof(to), "%s.%d", pcapPath, i);
+            rename(from, to);
+            strcat(from, ".idx");
+            strcat(to, ".idx");
+            rename(from, to);
+        }
+    }
+
+    snprintf(to, sizeof(to), "%s.idx", pcapPath);
+    if (events_open(to)) {
+        if (!writeFailed) {
+            fprintf(stderr, "can't open event index %s\n", to);
+        }
+        return -1;
+    }
+    pcapFile = fopen(pcapPath, "w");
+    if (pcapFile == NULL) {
+        if (!writeFailed) {
+            fprintf(stderr, "can't open capture file %s\n", pcapPath);
+        }
+        events_close();
+        return -1;
+    }
+    // Let stdio batch records up into large writes
+    setvbuf(pcapFile, NULL, _IOFBF, 65536);
+    struct pcap_header h = {
+        .magic = PCAP_MAGIC_NS,
+        .version_major = 2,
+        .version_minor = 4,
+        .snaplen = 65535,
+        .linktype = LINKTYPE_RAW,
+    };
+    fwrite(&h, sizeof(h), 1, pcapFile);
+    pcapFileBytes = sizeof(h);
+    return 0;
+}
+
+static void __write_capture(const struct capture *c) {
+    struct packet_header h = {
+        .version_ihl = 0x45,
+        .total_len = htons(sizeof(h) + c->len),
+        .id = htons(packetId++),
+        .frag = htons(0x4000),
+        .ttl = 64,
+        .protocol = IPPROTO_UDP,
+        .src = c->src.sin_addr.s_addr,
+        .dst = c->dst.sin_addr.s_addr,
+        .sport = c->src.sin_port,
+        .dport = c->dst.sin_port,
+        .udp_len = htons(8 + c->len),
+    };
+    h.checksum = __ip_checksum(&h);
+    struct pcap_record r = {
+        .ts_sec = c->timeNs / 1000000000ULL,
+        .ts_nsec = c->timeNs % 1000000000ULL,
+        .incl_len = sizeof(h) + c->len,
+        .orig_len = sizeof(h) + c->len,
+    };
+    fwrite(&r, sizeof(r), 1, pcapFile);
+    fwrite(&h, sizeof(h), 1, pcapFile);
+    fwrite(c->data, 1, c->len, pcapFile);
+    pcapFileBytes += sizeof(r) + r.incl_len;
+}
+
+// Write everything in the ring, then flush so a capture can be read while we
+// are still running. If starting a new file failed, try again each time,
+// leaving datagrams in the ring until it fills.
+static void __write_all(void) {
+    if (pcapFile == NULL) {
+        if (__open_file()) {
+            return;
+        }
+        fprintf(stderr, "capture file %s open again\n", pcapPath);
+        writeFailed = false;
+    }
+    unsigned int tail = atomic_load_explicit(&ringTail, memory_order_relaxed);
+    unsigned int head = atomic_load_explicit(&ringHead, memory_order_acquire);
+    if (tail == head) {
+        return;
+    }
+    while (tail != head) {
+        events_write(tail, (uint32_t) pcapFileBytes);
+        __write_capture(&ring[tail % RING_LEN]);
+        tail++;
+        atomic_store_explicit(&ringTail, tail, memory_order_release);
+    }
+    if (fflush(pcapFile) != 0 && !writeFailed) {
+        fprintf(stderr, "writing capture file %s failed\n", pcapPath);
+        writeFailed = true;
+    }
+    events_flush();
+    if (pcapFileBytes >= PCAP_ROTATE_KB * 1024L && __open_file() && !writeFailed) {
+        fprintf(stderr, "capture stopped until a new file can be opened\n");
+        writeFailed = true;
+    }
+}
+
+static void *__writer(__attribute__ ((unused)) void *arg) {
+    struct timespec interval = { 0, WRITE_INTERVAL_MS * 1000000L };
+    while (writing) {
+        nanosleep(&interval, NULL);
+        __write_all();
+    }
+    __write_all();
+    return NULL;
+}
+
+bool pcap_active(void) {
+    return pcapSink != NULL && !paused;
+}
+
+void pcap_pause(bool pause) {
+    paused = pause;
+}
+
+void pcap_capture(const struct sockaddr_in *src, const struct sockaddr_in *dst,
+        const struct iovec *iov, int iovcnt, uint64_t timeNs) {
+    if (pcapSink == NULL) {
+        return;
+    }
+    unsigned int head = atomic_load_explicit(&ringHead, memory_order_relaxed);
+    if (head - atomic_load_explicit(&ringTail, memory_order_acquire) >= RING_LEN) {
+        pcapSink->errors++;
+        return;
+    }
+    struct capture *c = &ring[head % RING_LEN];
+    c->timeNs = timeNs;
+    c->src = *src;
+    c->dst = *dst;
+    c->len = 0;
+    int i;
+    for (i = 0; i < iovcnt && c->len + (int) iov[i].iov_len <= DATAGRAM_LEN; i++) {
+        memcpy(c->data + c->len, iov[i].iov_base, iov[i].iov_len);
+        c->len += iov[i].iov_len;
+    }
+    atomic_store_explicit(&ringHead, head + 1, memory_order_release);
+    pcapSink->sent++;
+    pcapSink->bytes += c->len;
+}
+
+// Datagrams arrive through pcap_capture() as the UDP sinks send them, after
+// this, so all there is to do per sample is look for events to index against
+// the next datagram, and count the samples we aren't capturing
+static void __pcap_send(struct sink *sink, const struct sample *s,
+        __attribute__ ((unused)) const struct iovec *iov, __attribute__ ((unused)) int iovcnt) {
+    events_detect(s, atomic_load_explicit(&ringHead, memory_order_relaxed), !paused);
+    if (paused) {
+        sink->shed++;
+    }
+}
+
+static void __pcap_close(__attribute__ ((unused)) struct sink *sink) {
+    pcapSink = NULL;
+    writing = false;
+    pthread_join(writerThread, NULL);
+    if (pcapFile != NULL) {
+        // Events noted after the last datagram point at the end of the file
+        events_write(atomic_load(&ringHead), (uint32_t) pcapFileBytes);
+        fclose(pcapFile);
+        pcapFile = NULL;
+        events_close();
+    }
+}
+
+int pcap_add(const char *path) {
+    if (pcapSink != NULL) {
+        fprintf(stderr, "only one capture file can be written\n");
+        return -1;
+    }
+    snprintf(pcapPath, sizeof(pcapPath), "%s", path);
+    if (__open_file()) {
+        return -1;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "pcap %s", path);
+    struct sink *sink = sinks_add(name, 0);
+    if (sink == NULL) {
+        fclose(pcapFile);
+        pcapFile = NULL;
+        events_close();
+        return -1;
+    }
+    sink->send = __pcap_send;
+    sink->close = __pcap_close;
+
+    writing = true;
+    if (pthread_create(&writerThread, NULL, __writer, NULL)) {
+        fprintf(stderr, "failed to start capture writer thread\n");
+        writing = false;
+        sink->close = NULL;
+        fclose(pcapFile);
+        pcapFile = NULL;
+        events_close();
+        return -1;
+    }
+    pcapSink = sink;
+    return 0;
+}
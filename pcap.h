@@ -0,0 +1,34 @@
+// Beaglebone Blue Heading NMEA UDP Sender - pcap capture sink
+//
+// Records every UDP datagram we send, with its destination and send time, to
+// a pcap file that Wireshark can open and decode as NMEA. The sample path only
+// copies each datagram into a ring; a background thread writes them out in
+// batches, starting a new file every PCAP_ROTATE_KB and keeping
+// PCAP_ROTATE_FILES old ones. Each file has an index of the events in it
+// beside it (see events.h).
+
+#ifndef PCAP_H
+#define PCAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+// Add the capture sink, writing to path. Older files are path.1, path.2 and
+// so on. Returns 0 on success.
+int pcap_add(const char *path);
+
+// Whether the capture sink has been added and isn't paused
+bool pcap_active(void);
+
+// Stop capturing for a while when the CPU is overloaded, or start again
+void pcap_pause(bool paused);
+
+// Capture one datagram from src to dst, sent at timeNs (Unix time). Does
+// nothing unless the capture sink has been added. Only the sample path may
+// call this.
+void pcap_capture(const struct sockaddr_in *src, const struct sockaddr_in *dst,
+        const struct iovec *iov, int iovcnt, uint64_t timeNs);
+
+#endif
@@ -0,0 +1,85 @@
+// Beaglebone Blue Heading NMEA UDP Sender - processing pipeline
+
+#include "pipeline.h"
+
+struct stage pipeline_stages[PIPELINE_MAX_STAGES];
+int pipeline_stage_count = 0;
+bool pipeline_fixed_point = FIXED_POINT;
+volatile bool pipeline_timing = true;
+
+int pipeline_add(const char *name, stage_fn run) {
+    if (pipeline_stage_count >= PIPELINE_MAX_STAGES) {
+        fprintf(stderr, "too many pipeline stages, %s not added\n", name);
+        return -1;
+    }
+    struct stage *st = &pipeline_stages[pipeline_stage_count];
+    st->name = name;
+    st->run = run;
+    return pipeline_stage_count++;
+}
+
+void pipeline_run(struct sample *s) {
+    uint64_t lastNs = 0;
+#if STAGE_TIMING
+    lastNs = pipeline_now();
+#endif
+    int i;
+    for (i = 0; i < pipeline_stage_count; i++) {
+        pipeline_run_stage(i, pipeline_stages[i].run, s, &lastNs);
+    }
+}
+
+void pipeline_record(struct stage *st, uint64_t ns) {
+    int bucket = 0;
+    uint64_t v = ns;
+    while (v > 1 && bucket < PIPELINE_HISTOGRAM_BUCKETS - 1) {
+        v >>= 1;
+        bucket++;
+    }
+    st->histogram[bucket]++;
+    st->count++;
+    st->total_ns += ns;
+    if (ns > st->max_ns) {
+        st->max_ns = ns;
+    }
+}
+
+uint64_t pipeline_percentile(const struct stage *st, double fraction) {
+    uint64_t target = (uint64_t) ((double) st->count * fraction);
+    uint64_t seen = 0;
+    int i;
+    for (i = 0; i < PIPELINE_HISTOGRAM_BUCKETS; i++) {
+        seen += st->histogram[i];
+        if (seen > target) {
+            uint64_t upper = (2ULL << i) - 1;
+            return upper < st->max_ns ? upper : st->max_ns;
+        }
+    }
+    return st->max_ns;
+}
+
+void pipeline_print_header(FILE *f, const char *title) {
+    fprintf(f, "%-16s %10s %10s %10s %10s %10s\n", title, "count", "mean ns", "p50 ns", "p99 ns", "max ns");
+}
+
+void pipeline_print_stage(FILE *f, const struct stage *st) {
+    if (st->count == 0) {
+        fprintf(f, "%-16s %10d\n", st->name, 0);
+        return;
+    }
+    fprintf(f, "%-16s %10llu %10llu %10llu %10llu %10llu\n", st->name,
+            (unsigned long long) st->count,
+            (unsigned long long) (st->total_ns / st->count),
+            (unsigned long long) pipeline_percentile(st, 0.5),
+            (unsigned long long) pipeline_percentile(st, 0.99),
+            (unsigned long long) st->max_ns);
+}
+
+void pipeline_print_stats(FILE *f) {
+    pipeline_print_header(f, "stage");
+    int i;
+    for (i = 0; i < pipeline_stage_count; i++) {
+        pipeline_print_stage(f, &pipeline_stages[i]);
+    }
+    fflush(f);
+}
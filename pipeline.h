@@ -0,0 +1,94 @@
+// Beaglebone Blue Heading NMEA UDP Sender - processing pipeline
+//
+// The per-sample processing is a list of stages set up at startup, each of
+// which is given a pointer to the same sample record. Every stage keeps a
+// histogram of how long it takes, which can be printed while running.
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <time.h>
+
+#include "config.h"
+#include "sample.h"
+
+#define PIPELINE_MAX_STAGES 32
+// Histogram bucket i counts stage runs taking 2^i to 2^(i+1)-1 ns
+#define PIPELINE_HISTOGRAM_BUCKETS 32
+
+typedef void (*stage_fn)(struct sample *s);
+
+struct stage {
+    const char *name;
+    stage_fn run;
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint32_t histogram[PIPELINE_HISTOGRAM_BUCKETS];
+};
+
+extern struct stage pipeline_stages[PIPELINE_MAX_STAGES];
+extern int pipeline_stage_count;
+
+// Whether the heading path works in fixed point, see fixed.h
+extern bool pipeline_fixed_point;
+
+// Whether stages are being timed, when STAGE_TIMING is on. Load shedding
+// turns it off.
+extern volatile bool pipeline_timing;
+
+// Add a stage to the end of the pipeline. Returns its index, or -1 if full.
+int pipeline_add(const char *name, stage_fn run);
+
+// Run every stage in order on one sample
+void pipeline_run(struct sample *s);
+
+// Print each stage's timing statistics
+void pipeline_print_stats(FILE *f);
+
+// Print timing statistics in the same format for anything else timed with a
+// struct stage: a header row, then one row per stage
+void pipeline_print_header(FILE *f, const char *title);
+void pipeline_print_stage(FILE *f, const struct stage *st);
+
+// Add one run taking ns to a stage's statistics
+void pipeline_record(struct stage *st, uint64_t ns);
+
+// Upper bound in ns of the histogram bucket containing the given fraction of
+// a stage's runs, e.g. 0.99 for the 99th percentile
+uint64_t pipeline_percentile(const struct stage *st, double fraction);
+
+static inline uint64_t pipeline_now(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (uint64_t) t.tv_sec * 1000000000ULL + (uint64_t) t.tv_nsec;
+}
+
+// Offset to add to pipeline_now() times to get Unix time in ns
+static inline int64_t pipeline_epoch_offset(void) {
+    struct timespec real;
+    clock_gettime(CLOCK_REALTIME, &real);
+    return (int64_t) real.tv_sec * 1000000000LL + real.tv_nsec - (int64_t) pipeline_now();
+}
+
+// Run a single stage and time it. *lastNs holds the time the previous stage
+// finished, so consecutive stages only need one clock read each. Being
+// inline, this lets the specialised build call known stage functions directly.
+static inline void pipeline_run_stage(int index, stage_fn run, struct sample *s, uint64_t *lastNs) {
+    run(s);
+#if STAGE_TIMING
+    if (pipeline_timing) {
+        uint64_t now = pipeline_now();
+        pipeline_record(&pipeline_stages[index], now - *lastNs);
+        *lastNs = now;
+    }
+#else
+    (void) index;
+    (void) lastNs;
+#endif
+}
+
+#endif
@@ -0,0 +1,359 @@
+// Beaglebone Blue Heading NMEA UDP Sender - plugins
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <time.h>
+
+#include "config.h"
+#include "pipeline.h"
+#include "slab.h"
+#include "blackbox.h"
+#include "sinks.h"
+#include "loadshed.h"
+#include "plugin.h"
+
+// Sentences and payloads a plugin on its own thread has emitted, waiting for
+// the next sample
+#define PENDING_LEN 8
+
+// A sentence, without the "$" or checksum, or a payload for one sink
+struct pending {
+    int sink;
+    int len;
+    char data[SLAB_BUFFER_LEN];
+};
+
+struct loaded_plugin {
+    const struct plugin *plugin;
+    void *handle;
+    struct plugin_output out;
+    // The sample being passed to it in the sample path
+    struct sample *current;
+    // Time taken by each call, wherever it runs
+    struct stage stats;
+    int overruns;
+    uint64_t total_overruns;
+    // Counted by the sample path, and by the plugin's own thread once demoted
+    atomic_ullong emitted;
+    atomic_ullong dropped_sentences;
+
+    // Once demoted, samples are copied to it through queue and it runs on
+    // thread. It sends its output back through pending. Both are
+    // single-producer, single-consumer rings.
+    volatile bool demoted;
+    bool failed;
+    pthread_t thread;
+    sem_t queued;
+    struct sample queue[PLUGIN_QUEUE_LEN];
+    atomic_uint queue_head;
+    atomic_uint queue_tail;
+    uint64_t dropped_samples;
+    struct pending pending[PENDING_LEN];
+    atomic_uint pending_head;
+    atomic_uint pending_tail;
+};
+
+static struct loaded_plugin plugins[PLUGIN_MAX];
+static int pluginCount = 0;
+static volatile bool running = true;
+static volatile bool shed = false;
+// Samples no plugin was given because of load shedding
+static uint64_t shedSamples = 0;
+
+// Add a sentence to a sample, with the "$", checksum and line ending, unless
+// load shedding is dropping optional sentences
+static int __attach(struct sample *s, const char *sentence) {
+    if (SHED_ENABLE && loadshed_drop_extra_sentence()) {
+        return 0;
+    }
+    if (s->extra_sentence_count >= SAMPLE_EXTRA_SENTENCES) {
+        return -1;
+    }
+    int crc = 0;
+    const char *c;
+    for (c = sentence; *c != '\0'; c++) {
+        crc ^= *c;
+    }
+    struct slab_buffer *buf = slab_get();
+    if (buf == NULL) {
+        return -1;
+    }
+    buf->len = snprintf(buf->data, SLAB_BUFFER_LEN, "$%s*%02X\r\n", sentence, crc);
+    if (buf->len >= SLAB_BUFFER_LEN) {
+        slab_release(buf);
+        return -1;
+    }
+    s->extra_sinks[s->extra_sentence_count] = SAMPLE_ALL_SINKS;
+    s->extra_sentences[s->extra_sentence_count++] = buf;
+    return 0;
+}
+
+// Add a payload for one sink to a sample, as it is
+static int __attach_payload(struct sample *s, int sink, const void *data, size_t len) {
+    if (s->extra_sentence_count >= SAMPLE_EXTRA_SENTENCES || len > SLAB_BUFFER_LEN) {
+        return -1;
+    }
+    struct slab_buffer *buf = slab_get();
+    if (buf == NULL) {
+        return -1;
+    }
+    memcpy(buf->data, data, len);
+    buf->len = (int) len;
+    s->extra_sinks[s->extra_sentence_count] = sink;
+    s->extra_sentences[s->extra_sentence_count++] = buf;
+    return 0;
+}
+
+// Only slab_get() in the sample path, so a demoted plugin's output is held
+// until the next sample
+static int __hold(struct loaded_plugin *p, int sink, const void *data, size_t len) {
+    unsigned int head = atomic_load(&p->pending_head);
+    if (head - atomic_load(&p->pending_tail) >= PENDING_LEN || len > SLAB_BUFFER_LEN) {
+        return -1;
+    }
+    struct pending *held = &p->pending[head % PENDING_LEN];
+    held->sink = sink;
+    held->len = (int) len;
+    memcpy(held->data, data, len);
+    atomic_store(&p->pending_head, head + 1);
+    return 0;
+}
+
+static void __count(struct loaded_plugin *p, int result) {
+    if (result == 0) {
+        atomic_fetch_add(&p->emitted, 1);
+    } else {
+        atomic_fetch_add(&p->dropped_sentences, 1);
+    }
+}
+
+static int __emit(struct plugin_output *out, const char *sentence) {
+    struct loaded_plugin *p = out->host;
+    int result;
+    if (!p->demoted) {
+        result = __attach(p->current, sentence);
+    } else {
+        size_t len = strlen(sentence);
+        result = len < SLAB_BUFFER_LEN - 6 ? __hold(p, SAMPLE_ALL_SINKS, sentence, len + 1) : -1;
+    }
+    __count(p, result);
+    return result;
+}
+
+static int __send(struct plugin_output *out, const char *sink, const void *data, size_t len) {
+    struct loaded_plugin *p = out->host;
+    int index = sinks_find(sink);
+    int result;
+    if (index < 0) {
+        result = -1;
+    } else if (!p->demoted) {
+        result = __attach_payload(p->current, index, data, len);
+    } else {
+        result = __hold(p, index, data, len);
+    }
+    __count(p, result);
+    return result;
+}
+
+int plugin_add(const char *spec) {
+    if (pluginCount >= PLUGIN_MAX) {
+        fprintf(stderr, "too many plugins, %s not added\n", spec);
+        return -1;
+    }
+    char path[256];
+    strncpy(path, spec, sizeof(path) - 1);
+    path[sizeof(path) - 1] = '\0';
+    const char *args = "";
+    char *comma = strchr(path, ',');
+    if (comma != NULL) {
+        *comma = '\0';
+        args = comma + 1;
+    }
+
+    struct loaded_plugin *p = &plugins[pluginCount];
+    p->handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+    if (p->handle == NULL) {
+        fprintf(stderr, "load plugin failed: %s\n", dlerror());
+        return -1;
+    }
+    const struct plugin *(*entry)(void);
+    *(void **) &entry = dlsym(p->handle, "heading_plugin");
+    if (entry == NULL) {
+        fprintf(stderr, "%s has no heading_plugin()\n", path);
+        dlclose(p->handle);
+        return -1;
+    }
+    p->plugin = entry();
+    if (p->plugin == NULL || p->plugin->on_sample == NULL) {
+        fprintf(stderr, "%s gave no plugin\n", path);
+        dlclose(p->handle);
+        return -1;
+    }
+    if (p->plugin->api_version != PLUGIN_API_VERSION || p->plugin->sample_size != sizeof(struct sample)) {
+        fprintf(stderr, "%s was built for a different version or config.h, rebuild it\n", path);
+        dlclose(p->handle);
+        return -1;
+    }
+    if (p->plugin->init != NULL && p->plugin->init(args)) {
+        fprintf(stderr, "plugin %s failed to start\n", p->plugin->name);
+        dlclose(p->handle);
+        return -1;
+    }
+    p->out.emit = __emit;
+    p->out.send = __send;
+    p->out.host = p;
+    p->stats.name = p->plugin->name;
+    pluginCount++;
+    return 0;
+}
+
+int plugin_count(void) {
+    return pluginCount;
+}
+
+// Thread for a demoted plugin. Wakes regularly so it notices when it has been
+// asked to stop.
+static void *__run_demoted(void *arg) {
+    struct loaded_plugin *p = arg;
+    while (running) {
+        struct timespec t;
+        clock_gettime(CLOCK_REALTIME, &t);
+        t.tv_sec += 1;
+        if (sem_timedwait(&p->queued, &t) < 0) {
+            continue;
+        }
+        unsigned int tail = atomic_load(&p->queue_tail);
+        while (tail != atomic_load(&p->queue_head)) {
+            uint64_t start = pipeline_now();
+            p->plugin->on_sample(&p->queue[tail % PLUGIN_QUEUE_LEN], &p->out);
+            if (STAGE_TIMING && pipeline_timing) {
+                pipeline_record(&p->stats, pipeline_now() - start);
+            }
+            atomic_store(&p->queue_tail, ++tail);
+        }
+    }
+    return NULL;
+}
+
+// Move a plugin out of the sample path. Starting the thread only now costs
+// the sample path once, but nothing at all for plugins that keep to budget.
+static void __demote(struct loaded_plugin *p, uint64_t ns) {
+    fprintf(stderr, "plugin %s took %llu us, moving it to its own thread\n",
+            p->plugin->name, (unsigned long long) (ns / 1000));
+    blackbox_note("plugin %s moved to its own thread", p->plugin->name);
+    sem_init(&p->queued, 0, 0);
+    p->demoted = true;
+    if (pthread_create(&p->thread, NULL, __run_demoted, p)) {
+        fprintf(stderr, "create plugin thread failed, plugin %s stopped\n", p->plugin->name);
+        sem_destroy(&p->queued);
+        p->failed = true;
+    }
+}
+
+// Give a demoted plugin a copy of the sample, without the sentence buffers
+// that will have gone by the time it looks, and pick up what it has emitted
+static void __queue(struct loaded_plugin *p, struct sample *s) {
+    unsigned int pendingTail = atomic_load(&p->pending_tail);
+    while (pendingTail != atomic_load(&p->pending_head)) {
+        const struct pending *held = &p->pending[pendingTail % PENDING_LEN];
+        if (held->sink == SAMPLE_ALL_SINKS ? __attach(s, held->data)
+                : __attach_payload(s, held->sink, held->data, held->len)) {
+            atomic_fetch_add(&p->dropped_sentences, 1);
+        }
+        atomic_store(&p->pending_tail, ++pendingTail);
+    }
+
+    unsigned int head = atomic_load(&p->queue_head);
+    if (head - atomic_load(&p->queue_tail) >= PLUGIN_QUEUE_LEN) {
+        p->dropped_samples++;
+        return;
+    }
+    struct sample *copy = &p->queue[head % PLUGIN_QUEUE_LEN];
+    *copy = *s;
+    memset(copy->sentences, 0, sizeof(copy->sentences));
+    memset(copy->extra_sentences, 0, sizeof(copy->extra_sentences));
+    copy->extra_sentence_count = 0;
+    atomic_store(&p->queue_head, head + 1);
+    sem_post(&p->queued);
+}
+
+void plugin_run(struct sample *s) {
+    if (shed) {
+        shedSamples++;
+        return;
+    }
+    int i;
+    for (i = 0; i < pluginCount; i++) {
+        struct loaded_plugin *p = &plugins[i];
+        if (p->failed) {
+            continue;
+        }
+        if (p->demoted) {
+            __queue(p, s);
+            continue;
+        }
+
+        p->current = s;
+        uint64_t start = pipeline_now();
+        p->plugin->on_sample(s, &p->out);
+        uint64_t ns = pipeline_now() - start;
+        if (STAGE_TIMING && pipeline_timing) {
+            pipeline_record(&p->stats, ns);
+        }
+        if (ns <= PLUGIN_BUDGET_US * 1000ULL) {
+            p->overruns = 0;
+            continue;
+        }
+        p->overruns++;
+        p->total_overruns++;
+        if (p->overruns >= PLUGIN_OVERRUNS || ns > PLUGIN_BUDGET_US * 10000ULL) {
+            __demote(p, ns);
+        }
+    }
+}
+
+void plugin_shed(bool shedPlugins) {
+    shed = shedPlugins;
+}
+
+void plugin_print_stats(FILE *f) {
+    pipeline_print_header(f, "plugin");
+    int i;
+    for (i = 0; i < pluginCount; i++) {
+        pipeline_print_stage(f, &plugins[i].stats);
+    }
+    fprintf(f, "%-20s %-14s %10s %10s %10s %10s\n", "plugin", "runs in", "overruns", "emitted",
+            "dropped", "queue drop");
+    for (i = 0; i < pluginCount; i++) {
+        const struct loaded_plugin *p = &plugins[i];
+        fprintf(f, "%-20s %-14s %10llu %10llu %10llu %10llu\n", p->plugin->name,
+                p->failed ? "stopped" : p->demoted ? "own thread" : "sample path",
+                (unsigned long long) p->total_overruns, atomic_load(&p->emitted),
+                atomic_load(&p->dropped_sentences), (unsigned long long) p->dropped_samples);
+    }
+    fprintf(f, "%llu samples not given to plugins while shedding load\n", (unsigned long long) shedSamples);
+    fflush(f);
+}
+
+void plugin_close(void) {
+    running = false;
+    int i;
+    for (i = 0; i < pluginCount; i++) {
+        struct loaded_plugin *p = &plugins[i];
+        if (p->demoted && !p->failed) {
+            pthread_join(p->thread, NULL);
+            sem_destroy(&p->queued);
+        }
+        if (p->plugin->close != NULL) {
+            p->plugin->close();
+        }
+        dlclose(p->handle);
+    }
+    pluginCount = 0;
+}
@@ -0,0 +1,97 @@
+// Beaglebone Blue Heading NMEA UDP Sender - plugins
+//
+// A plugin is a shared object loaded at startup with --plugin, for things
+// like a heading-hold controller that need each sample without a network hop
+// in between. It is called in the sample path with a read-only sample record
+// once the sentences are formatted, and can add sentences of its own for the
+// sinks to send with them, or payloads of any kind for one sink. Each call is timed against PLUGIN_BUDGET_US. A
+// plugin that keeps going over is moved to a thread of its own, where it is
+// given copies of the samples through a queue instead, so it can no longer
+// hold up the output. Nothing can stop a call that never returns, though.
+//
+// A plugin is built against this file and sample.h with the same config.h as
+// the sender, and exports a function heading_plugin() returning its struct
+// plugin, e.g.
+//
+//   static void onSample(const struct sample *s, struct plugin_output *out) {
+//       char rsa[32];
+//       snprintf(rsa, sizeof(rsa), "AGRSA,%.1f,A,,", rudder(s->heading_true));
+//       out->emit(out, rsa);
+//   }
+//
+//   static const struct plugin plugin = {
+//       PLUGIN_API_VERSION, sizeof(struct sample), "heading hold", NULL, onSample, NULL
+//   };
+//
+//   const struct plugin *heading_plugin(void) {
+//       return &plugin;
+//   }
+//
+// and is built with "gcc -shared -fPIC -O2 -o hold.so hold.c".
+
+#ifndef PLUGIN_H
+#define PLUGIN_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sample.h"
+
+#define PLUGIN_API_VERSION 2
+#define PLUGIN_MAX 4
+
+// Given to a plugin with each sample, to send sentences with
+struct plugin_output {
+    // Add a sentence, without the "$" or checksum, e.g. "AGRSA,1.5,A,,". It
+    // goes out with this sample, or the next one for a plugin on its own
+    // thread. Returns 0 on success, or -1 if there was no room for it.
+    int (*emit)(struct plugin_output *out, const char *sentence);
+    // Send len bytes as they are to the sink called name, as shown by
+    // kill -USR1, e.g. "udp 192.168.1.20:10110", after this sample's
+    // sentences. Only sinks that send sentences take payloads. Returns 0 on
+    // success, or -1 if there is no such sink or no room for it.
+    int (*send)(struct plugin_output *out, const char *sink, const void *data, size_t len);
+    // For the sender's use
+    void *host;
+};
+
+struct plugin {
+    // PLUGIN_API_VERSION and sizeof(struct sample) as the plugin was built,
+    // so one built with a different config.h isn't loaded
+    int api_version;
+    size_t sample_size;
+    const char *name;
+    // Optional. Called once at startup with the arguments after the comma in
+    // --plugin, or "" if none. Returns 0 on success.
+    int (*init)(const char *args);
+    // Called with each sample. Must not block.
+    void (*on_sample)(const struct sample *s, struct plugin_output *out);
+    // Optional, called on shutdown
+    void (*close)(void);
+};
+
+// Load a plugin from a "PATH[,ARGS]" spec and initialise it. Returns 0 on
+// success.
+int plugin_add(const char *spec);
+
+// How many plugins are loaded
+int plugin_count(void);
+
+// Pipeline stage, after the formatters. Calls each plugin in the sample path,
+// or queues the sample for it if it has been moved to its own thread, and adds
+// the sentences and payloads they emit. Their sentences are dropped along with
+// other optional sentences when load shedding, and at its last level plugins
+// aren't given samples at all.
+void plugin_run(struct sample *s);
+
+// Stop calling plugins, or start again, for load shedding
+void plugin_shed(bool shed);
+
+// Print each plugin's call times, overruns and where it runs
+void plugin_print_stats(FILE *f);
+
+// Stop any plugin threads and close every plugin
+void plugin_close(void);
+
+#endif
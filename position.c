@@ -0,0 +1,318 @@
+// Beaglebone Blue Heading NMEA UDP Sender - dead-reckoned position
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <math.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "angles.h"
+#include "pipeline.h"
+#include "position.h"
+
+// Below this speed over ground in knots, the receiver's course is mostly
+// noise, so we go along the heading instead
+#define MIN_COURSE_SPEED 0.5
+
+// Metres in one degree of latitude, there being a nautical mile to the minute
+#define METRES_PER_DEGREE (60.0 * 1852.0)
+
+#define DEG_RAD (M_PI / 180.0)
+
+// Everything we know from the receiver. The sequence numbers go up with each
+// new position, and with each new speed and course over ground.
+struct fix {
+    uint32_t position_sequence;
+    double latitude;
+    double longitude;
+    // When the position was measured, CLOCK_MONOTONIC ns, and what the
+    // receiver said the UTC time was then, Unix ns
+    uint64_t measured_ns;
+    int64_t utc_ns;
+    uint32_t track_sequence;
+    double sog;
+    double cog;
+    bool cog_valid;
+    uint64_t sog_ns;
+    // Speed through the water from VHW
+    double log_speed;
+    uint64_t log_ns;
+    // Quality of the last GGA
+    int satellites;
+    double hdop;
+    double altitude;
+    double geoid_separation;
+};
+
+// Latest from the receiver thread, protected by fixLock
+static pthread_mutex_t fixLock = PTHREAD_MUTEX_INITIALIZER;
+static struct fix latest;
+
+// Only touched by the receiver thread
+static double lastTimeOfDay = -1.0;
+static int64_t lastUtcNs = 0;
+static uint64_t lastArrivalNs = 0;
+
+// Estimate, only touched by the sample path
+static bool haveEstimate = false;
+static double latitude;
+static double longitude;
+static uint64_t lastNs = 0;
+static double errorLatitude = 0.0;
+static double errorLongitude = 0.0;
+static int64_t utcOffsetNs = 0;
+static uint32_t lastPositionSequence = 0;
+static uint32_t lastTrackSequence = 0;
+static double headingAtCourse = 0.0;
+
+// Statistics, written by the sample path
+static unsigned int fixes = 0;
+static unsigned int jumps = 0;
+static double totalCorrection = 0.0;
+static double maxCorrection = 0.0;
+
+// "ddmm.mmmm" or "dddmm.mmmm" and a hemisphere to signed degrees
+static bool __parse_coordinate(struct nmea_field value, struct nmea_field hemisphere, double *degrees) {
+    double v;
+    char h = nmea_char(hemisphere);
+    if (!nmea_decimal(value, &v) || (h != 'N' && h != 'S' && h != 'E' && h != 'W')) {
+        return false;
+    }
+    double whole = floor(v / 100.0);
+    *degrees = whole + (v - whole * 100.0) / 60.0;
+    if (h == 'S' || h == 'W') {
+        *degrees = -*degrees;
+    }
+    return true;
+}
+
+// "hhmmss.ss" to seconds since midnight
+static bool __parse_time(struct nmea_field field, double *seconds) {
+    double v;
+    if (!nmea_decimal(field, &v) || v < 0.0) {
+        return false;
+    }
+    double hours = floor(v / 10000.0);
+    double minutes = floor((v - hours * 10000.0) / 100.0);
+    *seconds = hours * 3600.0 + minutes * 60.0 + (v - hours * 10000.0 - minutes * 100.0);
+    return true;
+}
+
+// "ddmmyy" to days since 1970-01-01
+static bool __parse_date(struct nmea_field field, int64_t *days) {
+    long v;
+    if (!nmea_int(field, &v) || v <= 0) {
+        return false;
+    }
+    int64_t d = v / 10000;
+    int64_t m = v / 100 % 100;
+    int64_t y = 2000 + v % 100;
+    if (m < 1 || m > 12 || d < 1 || d > 31) {
+        return false;
+    }
+    // Days from civil, counting years from March so the leap day comes last
+    y -= m <= 2;
+    int64_t era = y / 400;
+    int64_t yearOfEra = y - era * 400;
+    int64_t dayOfYear = (153 * (m > 2 ? m - 3 : m + 9) + 2) / 5 + d - 1;
+    int64_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+    *days = era * 146097 + dayOfEra - 719468;
+    return true;
+}
+
+// UTC time of a fix from its time of day. GGA has no date, so take the day
+// that puts it nearest where the last fix's time would have got to by now, or
+// the system clock's for the first fix.
+static int64_t __utc_ns(double timeOfDay, uint64_t now) {
+    int64_t reference = lastUtcNs != 0 ? lastUtcNs + (int64_t) (now - lastArrivalNs)
+                                        : (int64_t) now + pipeline_epoch_offset();
+    int64_t day = reference / (86400LL * 1000000000LL);
+    int64_t utc = day * 86400LL * 1000000000LL + (int64_t) (timeOfDay * 1e9);
+    if (utc < reference - 43200LL * 1000000000LL) {
+        utc += 86400LL * 1000000000LL;
+    } else if (utc > reference + 43200LL * 1000000000LL) {
+        utc -= 86400LL * 1000000000LL;
+    }
+    return utc;
+}
+
+// Record a new position. GGA and RMC for the same moment only count once.
+// Called with fixLock held.
+static void __new_position(double timeOfDay, int64_t utcNs, double lat, double lon, uint64_t now) {
+    lastUtcNs = utcNs;
+    lastArrivalNs = now;
+    if (fabs(timeOfDay - lastTimeOfDay) < 0.001) {
+        return;
+    }
+    lastTimeOfDay = timeOfDay;
+    latest.latitude = lat;
+    latest.longitude = lon;
+    latest.measured_ns = now - (uint64_t) GNSS_LATENCY_MS * 1000000ULL;
+    latest.utc_ns = utcNs;
+    latest.position_sequence++;
+}
+
+void position_input(const struct nmea_sentence *sentence, uint64_t now) {
+    double timeOfDay, lat, lon;
+    if (nmea_is(sentence, "GGA")) {
+        // Quality 0 is no fix, and 6 is someone else's dead reckoning
+        long quality, satellites;
+        if (!__parse_time(nmea_field(sentence, 1), &timeOfDay)
+                || !__parse_coordinate(nmea_field(sentence, 2), nmea_field(sentence, 3), &lat)
+                || !__parse_coordinate(nmea_field(sentence, 4), nmea_field(sentence, 5), &lon)
+                || !nmea_int(nmea_field(sentence, 6), &quality) || quality == 0 || quality == 6) {
+            return;
+        }
+        pthread_mutex_lock(&fixLock);
+        __new_position(timeOfDay, __utc_ns(timeOfDay, now), lat, lon, now);
+        latest.satellites = nmea_int(nmea_field(sentence, 7), &satellites) ? (int) satellites : 0;
+        if (!nmea_decimal(nmea_field(sentence, 8), &latest.hdop)) {
+            latest.hdop = 0.0;
+        }
+        if (!nmea_decimal(nmea_field(sentence, 9), &latest.altitude)) {
+            latest.altitude = 0.0;
+        }
+        if (!nmea_decimal(nmea_field(sentence, 11), &latest.geoid_separation)) {
+            latest.geoid_separation = 0.0;
+        }
+        pthread_mutex_unlock(&fixLock);
+    } else if (nmea_is(sentence, "RMC")) {
+        // Status A is valid, and the mode (NMEA 2.3 on) E is estimated and N
+        // is not valid
+        int64_t day;
+        char mode = nmea_char(nmea_field(sentence, 12));
+        if (nmea_char(nmea_field(sentence, 2)) != 'A' || mode == 'E' || mode == 'N'
+                || !__parse_time(nmea_field(sentence, 1), &timeOfDay)
+                || !__parse_coordinate(nmea_field(sentence, 3), nmea_field(sentence, 4), &lat)
+                || !__parse_coordinate(nmea_field(sentence, 5), nmea_field(sentence, 6), &lon)) {
+            return;
+        }
+        int64_t utcNs = __parse_date(nmea_field(sentence, 9), &day)
+                ? day * 86400LL * 1000000000LL + (int64_t) (timeOfDay * 1e9)
+                : __utc_ns(timeOfDay, now);
+        double sog;
+        bool haveSog = nmea_decimal(nmea_field(sentence, 7), &sog);
+        pthread_mutex_lock(&fixLock);
+        __new_position(timeOfDay, utcNs, lat, lon, now);
+        if (haveSog) {
+            latest.sog = sog;
+            latest.cog_valid = nmea_decimal(nmea_field(sentence, 8), &latest.cog);
+            latest.sog_ns = now;
+            latest.track_sequence++;
+        }
+        pthread_mutex_unlock(&fixLock);
+    } else if (nmea_is(sentence, "VHW")) {
+        double speed;
+        if (!nmea_decimal(nmea_field(sentence, 5), &speed)) {
+            return;
+        }
+        pthread_mutex_lock(&fixLock);
+        latest.log_speed = speed;
+        latest.log_ns = now;
+        pthread_mutex_unlock(&fixLock);
+    }
+}
+
+// Move a position the given number of seconds along a track in degrees true at
+// a speed in knots. Flat earth is plenty over a fraction of a second.
+static void __advance(double *lat, double *lon, double speed, double track, double seconds) {
+    double metres = speed * 1852.0 / 3600.0 * seconds;
+    *lat += metres * cos(track * DEG_RAD) / METRES_PER_DEGREE;
+    *lon = wrap_180(*lon + metres * sin(track * DEG_RAD) / (METRES_PER_DEGREE * cos(*lat * DEG_RAD)));
+}
+
+static bool __fresh(uint64_t then, uint64_t now) {
+    return then != 0 && (int64_t) (now - then) < (int64_t) (POSITION_TIMEOUT_S * 1e9);
+}
+
+void position_dead_reckon(struct sample *s) {
+    struct fix f;
+    pthread_mutex_lock(&fixLock);
+    f = latest;
+    pthread_mutex_unlock(&fixLock);
+    uint64_t now = s->timestamp_ns;
+
+    // Go at the speed over ground along the course over ground, turned by
+    // however much the heading has turned since the receiver measured it. That
+    // keeps the receiver's allowance for leeway and tide, but follows turns
+    // at our sample rate. Without a speed over ground, go at the speed through
+    // the water along the heading.
+    if (f.track_sequence != lastTrackSequence) {
+        lastTrackSequence = f.track_sequence;
+        headingAtCourse = s->heading_true;
+    }
+    double speed = 0.0;
+    double track = s->heading_true;
+    if (__fresh(f.sog_ns, now)) {
+        speed = f.sog;
+        if (f.cog_valid && f.sog >= MIN_COURSE_SPEED) {
+            track = wrap_360(f.cog + wrap_180(s->heading_true - headingAtCourse));
+        }
+    } else if (__fresh(f.log_ns, now)) {
+        speed = f.log_speed;
+    }
+
+    // Carry the estimate on to this sample, and take out a little more of the
+    // last fix's error: first order, with time constant POSITION_CORRECTION_S
+    if (haveEstimate && now > lastNs) {
+        double dt = (double) (now - lastNs) / 1e9;
+        __advance(&latitude, &longitude, speed, track, dt);
+        double k = dt / (POSITION_CORRECTION_S + dt);
+        latitude += errorLatitude * k;
+        longitude = wrap_180(longitude + errorLongitude * k);
+        errorLatitude -= errorLatitude * k;
+        errorLongitude -= errorLongitude * k;
+    }
+    lastNs = now;
+
+    if (f.position_sequence != lastPositionSequence) {
+        lastPositionSequence = f.position_sequence;
+        utcOffsetNs = f.utc_ns - (int64_t) f.measured_ns;
+
+        // The fix was measured GNSS_LATENCY_MS ago, so carry it on to now
+        // before comparing
+        double fixLat = f.latitude;
+        double fixLon = f.longitude;
+        if (now > f.measured_ns) {
+            __advance(&fixLat, &fixLon, speed, track, (double) (now - f.measured_ns) / 1e9);
+        }
+        double north = (fixLat - latitude) * METRES_PER_DEGREE;
+        double east = wrap_180(fixLon - longitude) * METRES_PER_DEGREE * cos(latitude * DEG_RAD);
+        double error = sqrt(north * north + east * east);
+        if (!haveEstimate || error > POSITION_JUMP_M) {
+            latitude = fixLat;
+            longitude = fixLon;
+            errorLatitude = 0.0;
+            errorLongitude = 0.0;
+            jumps += haveEstimate;
+            haveEstimate = true;
+        } else {
+            errorLatitude = fixLat - latitude;
+            errorLongitude = wrap_180(fixLon - longitude);
+            totalCorrection += error;
+            if (error > maxCorrection) {
+                maxCorrection = error;
+            }
+        }
+        fixes++;
+    }
+
+    s->position_valid = haveEstimate && __fresh(f.measured_ns, now);
+    s->latitude = latitude;
+    s->longitude = longitude;
+    s->speed = speed;
+    s->track = track;
+    s->utc_ns = (int64_t) now + utcOffsetNs;
+    s->satellites = f.satellites;
+    s->hdop = f.hdop;
+    s->altitude = f.altitude;
+    s->geoid_separation = f.geoid_separation;
+}
+
+void position_print_stats(FILE *f) {
+    unsigned int corrected = fixes - jumps - (haveEstimate ? 1 : 0);
+    fprintf(f, "dead reckoning: %u fixes, correction mean %.2f m max %.2f m, %u jumps\n",
+            fixes, corrected > 0 ? totalCorrection / corrected : 0.0, maxCorrection, jumps);
+    fflush(f);
+}
@@ -0,0 +1,33 @@
+// Beaglebone Blue Heading NMEA UDP Sender - dead-reckoned position
+//
+// GNSS receivers give a position a few times a second, but an autopilot
+// steering on it wants one every sample. This takes GGA and RMC fixes (and VHW
+// speed through the water) from the GNSS input and carries the last position
+// forward every sample along the heading, at the speed over ground or failing
+// that the speed through the water. When a new fix arrives, the difference
+// between it and the estimate is taken out gradually so the output doesn't
+// jump. The sample path does a fixed amount of arithmetic per sample and
+// allocates nothing.
+
+#ifndef POSITION_H
+#define POSITION_H
+
+#include <stdio.h>
+#include <stdint.h>
+
+#include "nmea.h"
+#include "sample.h"
+
+// Take a GGA, RMC or VHW sentence from the GNSS input, received at now
+// (CLOCK_MONOTONIC ns). Other sentences are ignored. Called from the GNSS
+// receiver thread.
+void position_input(const struct nmea_sentence *sentence, uint64_t now);
+
+// Pipeline stage. Advances the estimate to the sample's time, applies any new
+// fix, and fills in the sample's position.
+void position_dead_reckon(struct sample *s);
+
+// Print how many fixes have arrived and how far they were from the estimate
+void position_print_stats(FILE *f);
+
+#endif
@@ -0,0 +1,113 @@
+// Beaglebone Blue Heading NMEA UDP Sender - sample record
+//
+// One of these is filled in per MPU sample and handed by pointer from each
+// pipeline stage to the next, so nothing is copied along the way.
+
+#ifndef SAMPLE_H
+#define SAMPLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "slab.h"
+#include "fixed.h"
+
+// Each sentence in OUTPUT_SENTENCES gets an index
+enum sentence {
+#define X(name, enabled) SENTENCE_##name,
+    OUTPUT_SENTENCES(X)
+#undef X
+    SENTENCE_COUNT
+};
+#define SENTENCE_BIT(id) (1U << (id))
+
+// Most sentences and payloads templates and plugins can add to one sample
+#define SAMPLE_EXTRA_SENTENCES 8
+#define SAMPLE_ALL_SINKS -1
+
+// Where the heading came from
+enum heading_source {
+    HEADING_SOURCE_IMU,         // IMU only
+    HEADING_SOURCE_BLENDED,     // IMU corrected by recent GNSS heading
+    HEADING_SOURCE_PREDICTED    // Carried on from the last heading after failover
+};
+
+struct sample {
+    // Sample counter
+    uint32_t sequence;
+    // When the sample reached us, and when the MPU took it according to the
+    // sample clock model, both CLOCK_MONOTONIC in ns. Use timestamp_ns for
+    // anything that needs to know when the reading was valid.
+    uint64_t arrival_ns;
+    uint64_t timestamp_ns;
+    // Heading in degrees clockwise from the board's +X axis, straight from the MPU
+    double heading_raw;
+    // What that heading is fused from: the DMP's gyro-based yaw and the
+    // unfiltered magnetometer heading in degrees, and the magnetic field
+    // strength in uT
+    double dmp_yaw;
+    double compass_raw;
+    double mag_field;
+    // Magnetic & true heading in degrees, with offsets applied, 0.0<=x<360.0
+    double heading_mag;
+    double heading_true;
+    enum heading_source heading_source;
+    // The raw, magnetic and true heading, pitch and roll as binary angles,
+    // filled in instead when pipeline_fixed_point is set (see fixed.h). The
+    // doubles above are then worked out from these for anything else that
+    // wants them.
+    bam_t heading_raw_bam;
+    bam_t heading_mag_bam;
+    bam_t heading_true_bam;
+    bam_t pitch_bam;
+    bam_t roll_bam;
+    // How many IMUs the heading was voted on by, and a bit for each that was
+    // left out, bit 0 being the MPU (see imu.h)
+    int imu_voters;
+    int imu_excluded;
+    // Correction applied to the IMU heading from GNSS, in degrees
+    double gnss_bias;
+    // Attitude of the board in degrees
+    double pitch;
+    double roll;
+    // Air pressure from the barometer in whole Pa. Only meaningful if
+    // pressure_valid.
+    bool pressure_valid;
+    int32_t pressure;
+    // Dead-reckoned position in degrees, north and east positive, with the
+    // speed in knots and track in degrees true it is going at, and the UTC
+    // time it is for in Unix ns. Only meaningful if position_valid.
+    bool position_valid;
+    double latitude;
+    double longitude;
+    double speed;
+    double track;
+    int64_t utc_ns;
+    // From the last GGA fix
+    int satellites;
+    double hdop;
+    double altitude;
+    double geoid_separation;
+    // True wind worked out from a wind reading that arrived since the last
+    // sample: the direction it comes from in degrees true and magnetic, its
+    // angle from the bow in degrees clockwise, and its speed in knots. Only
+    // meaningful if wind_valid.
+    bool wind_valid;
+    double wind_direction;
+    double wind_direction_mag;
+    double wind_angle;
+    double wind_speed;
+    // The NMEA sentences built by the formatter stages, ready to send, indexed
+    // by enum sentence. NULL for sentences that weren't formatted.
+    struct slab_buffer *sentences[SENTENCE_COUNT];
+    // Sentences added by templates and plugins (see template.h and plugin.h),
+    // sent after the ones above by every sink that sends sentences, and
+    // plugin payloads for one sink. extra_sinks has SAMPLE_ALL_SINKS for a
+    // sentence, or the index of the sink a payload is for.
+    struct slab_buffer *extra_sentences[SAMPLE_EXTRA_SENTENCES];
+    int extra_sinks[SAMPLE_EXTRA_SENTENCES];
+    int extra_sentence_count;
+} __attribute__ ((aligned(64)));
+
+#endif
@@ -0,0 +1,240 @@
+// Beaglebone Blue Heading NMEA UDP Sender - latency self test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "pipeline.h"
+#include "selftest.h"
+
+// Timer wakeups are tested cyclictest-style, every SELFTEST_INTERVAL_US
+#define SELFTEST_INTERVAL_US 1000
+#define SELFTEST_WAKEUPS 2000
+#define SELFTEST_THREAD_WAKES 1000
+#define SELFTEST_I2C_READS 200
+#define SELFTEST_SENDS 1000
+// I2C transactions per sample in DMP mode: reading the FIFO, and the
+// magnetometer
+#define I2C_READS_PER_SAMPLE 2
+
+struct selftest_results {
+    bool ran;
+    struct stage wakeup;
+    struct stage scheduler;
+    struct stage i2c;
+    struct stage send;
+    double processingNs;
+    double busyNs;
+    double latencyNs;
+    bool rateOk;
+    bool latencyOk;
+};
+
+static struct selftest_results results;
+
+struct selftest_args {
+    rc_mpu_data_t *data;
+    const rc_mpu_config_t *conf;
+    int pipe[2];
+};
+
+static void __reset(struct stage *st, const char *name) {
+    memset(st, 0, sizeof(*st));
+    st->name = name;
+}
+
+// Create a thread with the same scheduling as the MPU interrupt thread
+static int __start_thread(pthread_t *thread, void *(*run)(void *), void *arg) {
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (DMP_INTERRUPT_PRIORITY > 0) {
+        struct sched_param param = { .sched_priority = DMP_INTERRUPT_PRIORITY };
+        pthread_attr_setinheritsched(&attr, PTHREAD_EXPLICIT_SCHED);
+        pthread_attr_setschedpolicy(&attr, SCHED_FIFO);
+        pthread_attr_setschedparam(&attr, &param);
+    }
+    int result = pthread_create(thread, &attr, run, arg);
+    pthread_attr_destroy(&attr);
+    return result;
+}
+
+// Thread woken through a pipe, recording how long that took
+static void *__waiter(void *arg) {
+    struct selftest_args *args = arg;
+    uint64_t sentNs;
+    while (read(args->pipe[0], &sentNs, sizeof(sentNs)) == sizeof(sentNs)) {
+        pipeline_record(&results.scheduler, pipeline_now() - sentNs);
+    }
+    return NULL;
+}
+
+static void __test_wakeups(void) {
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    int i;
+    for (i = 0; i < SELFTEST_WAKEUPS; i++) {
+        next.tv_nsec += SELFTEST_INTERVAL_US * 1000;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        uint64_t target = (uint64_t) next.tv_sec * 1000000000ULL + (uint64_t) next.tv_nsec;
+        pipeline_record(&results.wakeup, pipeline_now() - target);
+    }
+}
+
+static void __test_scheduler(struct selftest_args *args) {
+    if (pipe(args->pipe)) {
+        return;
+    }
+    pthread_t waiter;
+    if (__start_thread(&waiter, __waiter, args) == 0) {
+        int i;
+        for (i = 0; i < SELFTEST_THREAD_WAKES; i++) {
+            uint64_t now = pipeline_now();
+            if (write(args->pipe[1], &now, sizeof(now)) != sizeof(now)) {
+                break;
+            }
+            usleep(SELFTEST_INTERVAL_US);
+        }
+        close(args->pipe[1]);
+        pthread_join(waiter, NULL);
+    } else {
+        close(args->pipe[1]);
+    }
+    close(args->pipe[0]);
+}
+
+static void __test_i2c(struct selftest_args *args) {
+    if (args->conf == NULL) {
+        return;
+    }
+    if (rc_mpu_initialize(args->data, *args->conf)) {
+        return;
+    }
+    int i;
+    for (i = 0; i < SELFTEST_I2C_READS; i++) {
+        uint64_t start = pipeline_now();
+        if (rc_mpu_read_temp(args->data)) {
+            break;
+        }
+        pipeline_record(&results.i2c, pipeline_now() - start);
+    }
+    rc_mpu_power_off();
+}
+
+// Time a UDP datagram from sendto() until we receive it back on loopback
+static void __test_send(void) {
+    int fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    struct sockaddr_in addr;
+    socklen_t len = sizeof(addr);
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr))
+            || getsockname(fd, (struct sockaddr *)&addr, &len)) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return;
+    }
+    char message[] = "$GPHDT,123.4,T*00\r\n";
+    int i;
+    for (i = 0; i < SELFTEST_SENDS; i++) {
+        uint64_t start = pipeline_now();
+        if (sendto(fd, message, sizeof(message) - 1, 0, (struct sockaddr *)&addr, sizeof(addr)) < 0
+                || recv(fd, message, sizeof(message), 0) < 0) {
+            break;
+        }
+        pipeline_record(&results.send, pipeline_now() - start);
+    }
+    close(fd);
+}
+
+static void *__run(void *arg) {
+    struct selftest_args *args = arg;
+    __test_wakeups();
+    __test_scheduler(args);
+    __test_i2c(args);
+    __test_send();
+    return NULL;
+}
+
+static void __verdict(void) {
+    // Mean time spent per sample in our own stages, if we've been running
+    results.processingNs = 0.0;
+    int i;
+    for (i = 0; i < pipeline_stage_count; i++) {
+        if (pipeline_stages[i].count > 0) {
+            results.processingNs += (double) pipeline_stages[i].total_ns / (double) pipeline_stages[i].count;
+        }
+    }
+
+    // Rate: the bus and CPU time each sample needs on average has to fit in a
+    // sample period with room to spare.
+    double i2cMean = results.i2c.count > 0 ? (double) results.i2c.total_ns / (double) results.i2c.count : 0.0;
+    double sendMean = results.send.count > 0 ? (double) results.send.total_ns / (double) results.send.count : 0.0;
+    results.busyNs = I2C_READS_PER_SAMPLE * i2cMean + results.processingNs + sendMean;
+    results.rateOk = results.busyNs < 0.5e9 / SAMPLE_RATE_HZ;
+
+    // Latency: a bad case is the interrupt thread waking late, then the bus
+    // reads, then our processing and the send, all at their 99th percentiles.
+    results.latencyNs = (double) pipeline_percentile(&results.wakeup, 0.99)
+            + (double) pipeline_percentile(&results.scheduler, 0.99)
+            + I2C_READS_PER_SAMPLE * (double) pipeline_percentile(&results.i2c, 0.99)
+            + results.processingNs
+            + (double) pipeline_percentile(&results.send, 0.99);
+    results.latencyOk = results.latencyNs < LATENCY_TARGET_US * 1000.0;
+}
+
+int selftest_run(rc_mpu_data_t *data, const rc_mpu_config_t *conf, FILE *f) {
+    __reset(&results.wakeup, "timer wakeup");
+    __reset(&results.scheduler, "thread wakeup");
+    __reset(&results.i2c, "i2c read");
+    __reset(&results.send, "udp loopback");
+
+    struct selftest_args args = { .data = data, .conf = conf };
+    pthread_t thread;
+    if (__start_thread(&thread, __run, &args)) {
+        fprintf(f, "self test can't run at priority %d, using normal priority\n", DMP_INTERRUPT_PRIORITY);
+        if (pthread_create(&thread, NULL, __run, &args)) {
+            fprintf(f, "self test failed to start\n");
+            return -1;
+        }
+    }
+    pthread_join(thread, NULL);
+    __verdict();
+    results.ran = true;
+
+    pipeline_print_header(f, "self test");
+    pipeline_print_stage(f, &results.wakeup);
+    pipeline_print_stage(f, &results.scheduler);
+    if (results.i2c.count > 0) {
+        pipeline_print_stage(f, &results.i2c);
+    } else {
+        fprintf(f, "%-16s not tested\n", results.i2c.name);
+    }
+    pipeline_print_stage(f, &results.send);
+    selftest_print_stats(f);
+    return results.rateOk && results.latencyOk ? 0 : -1;
+}
+
+void selftest_print_stats(FILE *f) {
+    if (!results.ran) {
+        return;
+    }
+    fprintf(f, "self test: %.0f us busy per sample, %s for %d Hz; %.0f us worst-case latency, %s target of %d us\n",
+            results.busyNs / 1000.0, results.rateOk ? "OK" : "TOO SLOW", SAMPLE_RATE_HZ,
+            results.latencyNs / 1000.0, results.latencyOk ? "within" : "OUTSIDE", LATENCY_TARGET_US);
+    fflush(f);
+}
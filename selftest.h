@@ -0,0 +1,25 @@
+// Beaglebone Blue Heading NMEA UDP Sender - latency self test
+//
+// Measures, on the board itself and with the same thread priority as the MPU
+// interrupt thread, the things that decide whether we can keep up: how late
+// timers wake us, how long it takes to wake another thread, how long an I2C
+// transaction with the MPU takes, and how long a UDP send takes. Then says
+// whether SAMPLE_RATE_HZ and LATENCY_TARGET_US are achievable.
+
+#ifndef SELFTEST_H
+#define SELFTEST_H
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <rc/mpu.h>
+
+// Run the self test and print a report. If conf is not NULL, the MPU is
+// initialised (without the DMP) to time I2C transactions, and powered off
+// again afterwards, so this must not be used while the DMP is running.
+// Returns 0 if the verdict is that everything is achievable.
+int selftest_run(rc_mpu_data_t *data, const rc_mpu_config_t *conf, FILE *f);
+
+// Print a summary of the last self test, if there has been one
+void selftest_print_stats(FILE *f);
+
+#endif
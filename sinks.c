@@ -0,0 +1,345 @@
+// Beaglebone Blue Heading NMEA UDP Sender - output sinks
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <strings.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "sinks.h"
+#include "txtime.h"
+#include "pcap.h"
+#include "pipeline.h"
+
+const char *sentence_names[SENTENCE_COUNT] = {
+#define X(name, enabled) #name,
+    OUTPUT_SENTENCES(X)
+#undef X
+};
+
+static struct sink sinks[SINKS_MAX];
+static int sinkCount = 0;
+static volatile bool shedLowPriority = false;
+
+// All UDP sinks share one socket, and give their destination per send. Their
+// datagrams for a sample are queued up and sent with a single sendmmsg().
+static int udpSocket = -1;
+static struct mmsghdr udpMessages[SINKS_MAX];
+static struct iovec udpIov[SINKS_MAX][SENTENCE_COUNT + SAMPLE_EXTRA_SENTENCES];
+static struct sink *udpMessageSinks[SINKS_MAX];
+static int udpMessageCount = 0;
+
+// Scheduled transmission. If TXTIME_ENABLE is set, UDP sinks whose outgoing
+// interface has a suitable qdisc send with a launch time from txtime_launch(),
+// worked out once per sample.
+static int txtimeClock = -1;
+static uint64_t txtimeLaunch = 0;
+static char udpControl[SINKS_MAX][CMSG_SPACE(sizeof(uint64_t))];
+
+// The socket's own port, for captures. It is bound on the first send.
+static in_port_t udpSourcePort = 0;
+
+struct udp_state {
+    struct sockaddr_in addr;
+    // The local address datagrams to addr go from, for captures
+    struct sockaddr_in local;
+    bool txtime;
+};
+
+int sentences_parse(const char *list, uint32_t *mask) {
+    char copy[64];
+    strncpy(copy, list, sizeof(copy) - 1);
+    copy[sizeof(copy) - 1] = '\0';
+    *mask = 0;
+    char *saveptr;
+    char *name;
+    for (name = strtok_r(copy, ",", &saveptr); name != NULL; name = strtok_r(NULL, ",", &saveptr)) {
+        int i;
+        for (i = 0; i < SENTENCE_COUNT; i++) {
+            if (strcasecmp(name, sentence_names[i]) == 0) {
+                *mask |= SENTENCE_BIT(i);
+                break;
+            }
+        }
+        if (i == SENTENCE_COUNT) {
+            fprintf(stderr, "unknown sentence %s\n", name);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct sink *sinks_add(const char *name, uint32_t sentences) {
+    if (sinkCount >= SINKS_MAX) {
+        fprintf(stderr, "too many sinks, %s not added\n", name);
+        return NULL;
+    }
+    struct sink *sink = &sinks[sinkCount++];
+    memset(sink, 0, sizeof(*sink));
+    snprintf(sink->name, sizeof(sink->name), "%s", name);
+    sink->sentences = sentences;
+    return sink;
+}
+
+// Queue a datagram for __udp_flush()
+static void __udp_send(struct sink *sink, __attribute__ ((unused)) const struct sample *s,
+        const struct iovec *iov, int iovcnt) {
+    struct udp_state *st = sink->state;
+    struct msghdr *msg = &udpMessages[udpMessageCount].msg_hdr;
+    memset(msg, 0, sizeof(*msg));
+    memcpy(udpIov[udpMessageCount], iov, iovcnt * sizeof(*iov));
+    msg->msg_name = &st->addr;
+    msg->msg_namelen = sizeof(st->addr);
+    msg->msg_iov = udpIov[udpMessageCount];
+    msg->msg_iovlen = iovcnt;
+    if (st->txtime) {
+        if (txtimeLaunch == 0) {
+            txtimeLaunch = txtime_launch(txtimeClock);
+        }
+        msg->msg_control = udpControl[udpMessageCount];
+        msg->msg_controllen = sizeof(udpControl[udpMessageCount]);
+        struct cmsghdr *cmsg = CMSG_FIRSTHDR(msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_TXTIME;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+        memcpy(CMSG_DATA(cmsg), &txtimeLaunch, sizeof(uint64_t));
+    }
+    udpMessageSinks[udpMessageCount] = sink;
+    udpMessageCount++;
+}
+
+// Pass sent datagrams to the capture sink, timestamped with when they were
+// sent, or will be sent if they have a launch time
+static void __udp_capture(int from, int to) {
+    if (udpSourcePort == 0) {
+        struct sockaddr_in local;
+        socklen_t len = sizeof(local);
+        if (getsockname(udpSocket, (struct sockaddr *) &local, &len) == 0) {
+            udpSourcePort = local.sin_port;
+        }
+    }
+    uint64_t now = pipeline_now();
+    uint64_t nowUnix = now + pipeline_epoch_offset();
+    uint64_t launchUnix = 0;
+    if (txtimeLaunch != 0) {
+        struct timespec t;
+        clock_gettime(txtimeClock, &t);
+        launchUnix = txtimeLaunch - ((uint64_t) t.tv_sec * 1000000000ULL + t.tv_nsec) + nowUnix;
+    }
+    int i;
+    for (i = from; i < to; i++) {
+        struct udp_state *st = udpMessageSinks[i]->state;
+        struct sockaddr_in src = st->local;
+        src.sin_port = udpSourcePort;
+        pcap_capture(&src, &st->addr, udpMessages[i].msg_hdr.msg_iov,
+                udpMessages[i].msg_hdr.msg_iovlen, st->txtime ? launchUnix : nowUnix);
+    }
+}
+
+// Send all the queued datagrams. A failure stops sendmmsg() part way, so skip
+// the failed one and carry on with the rest.
+static void __udp_flush(void) {
+    int done = 0;
+    while (done < udpMessageCount) {
+        int sent = sendmmsg(udpSocket, &udpMessages[done], udpMessageCount - done, 0);
+        if (sent < 0) {
+            udpMessageSinks[done]->errors++;
+            done++;
+            continue;
+        }
+        int i;
+        for (i = done; i < done + sent; i++) {
+            udpMessageSinks[i]->sent++;
+            udpMessageSinks[i]->bytes += udpMessages[i].msg_len;
+        }
+        if (pcap_active()) {
+            __udp_capture(done, done + sent);
+        }
+        done += sent;
+    }
+    udpMessageCount = 0;
+    txtimeLaunch = 0;
+}
+
+static void __udp_close(struct sink *sink) {
+    free(sink->state);
+    sink->state = NULL;
+}
+
+int sinks_add_udp(const char *spec, uint32_t defaultSentences) {
+    char host[48];
+    int port;
+    int consumed = 0;
+    uint32_t sentences = defaultSentences;
+    if (sscanf(spec, "%47[^:]:%d%n", host, &port, &consumed) < 2 || port <= 0 || port > 65535) {
+        fprintf(stderr, "bad UDP destination %s, expected host:port[/SENTENCES]\n", spec);
+        return -1;
+    }
+    if (spec[consumed] == '/' && sentences_parse(spec + consumed + 1, &sentences)) {
+        return -1;
+    }
+
+    struct in_addr ip;
+    if (inet_pton(AF_INET, host, &ip) != 1) {
+        fprintf(stderr, "bad UDP destination %s, expected an IPv4 address\n", host);
+        return -1;
+    }
+
+    if (udpSocket < 0 && (udpSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0) {
+        fprintf(stderr, "create socket failed\n");
+        return -1;
+    }
+    struct udp_state *st = calloc(1, sizeof(*st));
+    if (st == NULL) {
+        fprintf(stderr, "can't allocate UDP destination %s\n", spec);
+        return -1;
+    }
+    st->addr.sin_family = AF_INET;
+    st->addr.sin_port   = htons(port);
+    st->addr.sin_addr   = ip;
+
+    // Find which local address the kernel will send from, by connecting a
+    // throwaway socket, so captures show it
+    int probe = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    socklen_t localLen = sizeof(st->local);
+    if (probe < 0 || connect(probe, (struct sockaddr *) &st->addr, sizeof(st->addr)) < 0
+            || getsockname(probe, (struct sockaddr *) &st->local, &localLen) < 0) {
+        st->local.sin_family = AF_INET;
+        st->local.sin_addr.s_addr = INADDR_ANY;
+    }
+    if (probe >= 0) {
+        close(probe);
+    }
+
+    // Use scheduled transmission if the outgoing interface supports it. The
+    // socket is shared, so every destination has to use the same clock.
+    if (TXTIME_ENABLE) {
+        int clock = txtime_clock_for(&st->addr);
+        if (clock < 0) {
+            fprintf(stderr, "no etf or fq qdisc on the way to %s, sending immediately\n", host);
+        } else if (txtimeClock < 0 && txtime_enable(udpSocket, clock) == 0) {
+            txtimeClock = clock;
+            st->txtime = true;
+        } else if (clock == txtimeClock) {
+            st->txtime = true;
+        } else {
+            fprintf(stderr, "can't schedule transmission to %s, sending immediately\n", host);
+        }
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "udp %s:%d", host, port);
+    struct sink *sink = sinks_add(name, sentences);
+    if (sink == NULL) {
+        free(st);
+        return -1;
+    }
+    sink->send = __udp_send;
+    sink->close = __udp_close;
+    sink->state = st;
+    return 0;
+}
+
+uint32_t sinks_wanted_sentences(void) {
+    uint32_t mask = 0;
+    int i;
+    for (i = 0; i < sinkCount; i++) {
+        mask |= sinks[i].sentences;
+    }
+    return mask;
+}
+
+int sinks_find(const char *name) {
+    int i;
+    for (i = 0; i < sinkCount; i++) {
+        if (sinks[i].sentences != 0 && strcmp(sinks[i].name, name) == 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+int sinks_count(void) {
+    return sinkCount;
+}
+
+void sinks_send(struct sample *s) {
+    struct iovec iov[SENTENCE_COUNT + SAMPLE_EXTRA_SENTENCES];
+    int i, j;
+    for (i = 0; i < sinkCount; i++) {
+        struct sink *sink = &sinks[i];
+        if (sink->low_priority && shedLowPriority) {
+            sink->shed++;
+            continue;
+        }
+        int iovcnt = 0;
+        for (j = 0; j < SENTENCE_COUNT; j++) {
+            if ((sink->sentences & SENTENCE_BIT(j)) && s->sentences[j] != NULL) {
+                iov[iovcnt].iov_base = s->sentences[j]->data;
+                iov[iovcnt].iov_len = s->sentences[j]->len;
+                iovcnt++;
+            }
+        }
+        for (j = 0; j < s->extra_sentence_count; j++) {
+            if (s->extra_sinks[j] == SAMPLE_ALL_SINKS ? sink->sentences == 0 : s->extra_sinks[j] != i) {
+                continue;
+            }
+            iov[iovcnt].iov_base = s->extra_sentences[j]->data;
+            iov[iovcnt].iov_len = s->extra_sentences[j]->len;
+            iovcnt++;
+        }
+        if (iovcnt > 0 || sink->sentences == 0) {
+            sink->samples++;
+            sink->send(sink, s, iov, iovcnt);
+        }
+    }
+    __udp_flush();
+
+    // Every sink has what it needs, so the sample no longer needs its buffers
+    for (j = 0; j < SENTENCE_COUNT; j++) {
+        if (s->sentences[j] != NULL) {
+            slab_release(s->sentences[j]);
+            s->sentences[j] = NULL;
+        }
+    }
+    for (j = 0; j < s->extra_sentence_count; j++) {
+        slab_release(s->extra_sentences[j]);
+        s->extra_sentences[j] = NULL;
+    }
+    s->extra_sentence_count = 0;
+}
+
+void sinks_shed_low_priority(bool shed) {
+    shedLowPriority = shed;
+}
+
+void sinks_print_stats(FILE *f) {
+    fprintf(f, "%-32s %10s %10s %10s %10s %12s\n", "sink", "samples", "sent", "errors", "shed", "bytes/sample");
+    int i;
+    for (i = 0; i < sinkCount; i++) {
+        fprintf(f, "%-32s %10llu %10llu %10llu %10llu %12.1f\n", sinks[i].name,
+                (unsigned long long) sinks[i].samples, (unsigned long long) sinks[i].sent,
+                (unsigned long long) sinks[i].errors, (unsigned long long) sinks[i].shed,
+                sinks[i].samples > 0 ? (double) sinks[i].bytes / (double) sinks[i].samples : 0.0);
+    }
+    fflush(f);
+}
+
+void sinks_close(void) {
+    int i;
+    for (i = 0; i < sinkCount; i++) {
+        if (sinks[i].close != NULL) {
+            sinks[i].close(&sinks[i]);
+        }
+    }
+    if (udpSocket >= 0) {
+        close(udpSocket);
+        udpSocket = -1;
+    }
+}
@@ -0,0 +1,79 @@
+// Beaglebone Blue Heading NMEA UDP Sender - output sinks
+//
+// A sink is somewhere output goes, such as a UDP destination. Each one asks
+// for a set of sentences, and is given them per sample as an iovec pointing
+// at the shared sentence buffers, so sentences are formatted only once no
+// matter how many sinks send them.
+
+#ifndef SINKS_H
+#define SINKS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+
+#include "sample.h"
+
+#define SINKS_MAX 128
+
+struct sink {
+    // For messages and stats
+    char name[64];
+    // Bitmask of SENTENCE_BIT()s this sink sends. Sinks with their own
+    // formats have none, and are given every sample.
+    uint32_t sentences;
+    // Send one sample's sentences. iov has one entry per wanted sentence that
+    // was formatted, then the extra sentences and any plugin payloads for this
+    // sink. The sample record is there for sinks with their own formats. Sinks must not keep pointers into iov after returning, but can
+    // slab_hold() the sample's buffers to send them later.
+    void (*send)(struct sink *sink, const struct sample *s, const struct iovec *iov, int iovcnt);
+    // Optional, called on shutdown
+    void (*close)(struct sink *sink);
+    void *state;
+    // Low-priority sinks are skipped when the CPU is overloaded
+    bool low_priority;
+    // Samples given to the sink, and what it made of them
+    uint64_t samples;
+    uint64_t sent;
+    uint64_t bytes;
+    uint64_t errors;
+    // Samples skipped because of load shedding
+    uint64_t shed;
+};
+
+extern const char *sentence_names[SENTENCE_COUNT];
+
+// Parse a comma-separated list of sentence names into a bitmask. Returns 0 on
+// success or -1 if a name is not recognised.
+int sentences_parse(const char *list, uint32_t *mask);
+
+// Add a sink, returning it so the caller can fill it in, or NULL if full
+struct sink *sinks_add(const char *name, uint32_t sentences);
+
+// Add a UDP sink from a "host:port" or "host:port/HDT,XDR" spec. Sinks
+// without a sentence list get defaultSentences. Returns 0 on success.
+int sinks_add_udp(const char *spec, uint32_t defaultSentences);
+
+// The sentences wanted by at least one sink
+uint32_t sinks_wanted_sentences(void);
+
+// Index of the sink with this name, for sending a plugin payload to, or -1 if
+// there isn't one or it has its own format and so doesn't take payloads
+int sinks_find(const char *name);
+
+int sinks_count(void);
+
+// Pipeline stage. Passes the sample to every sink, then releases the sample's
+// references to its sentence buffers.
+void sinks_send(struct sample *s);
+
+// Skip low-priority sinks, or stop skipping them
+void sinks_shed_low_priority(bool shed);
+
+// Print per-sink counters
+void sinks_print_stats(FILE *f);
+
+// Close all sinks
+void sinks_close(void);
+
+#endif
@@ -0,0 +1,50 @@
+// Beaglebone Blue Heading NMEA UDP Sender - sentence buffers
+
+#include <stddef.h>
+
+#include "slab.h"
+
+static struct slab_buffer slab[SLAB_BUFFERS];
+static _Atomic(struct slab_buffer *) freeList = NULL;
+static atomic_int initialised = 0;
+
+static void __push(struct slab_buffer *buf) {
+    struct slab_buffer *head = atomic_load_explicit(&freeList, memory_order_relaxed);
+    do {
+        buf->next = head;
+    } while (!atomic_compare_exchange_weak_explicit(&freeList, &head, buf,
+            memory_order_release, memory_order_relaxed));
+}
+
+struct slab_buffer *slab_get(void) {
+    if (!atomic_load_explicit(&initialised, memory_order_relaxed)) {
+        int i;
+        for (i = 0; i < SLAB_BUFFERS; i++) {
+            __push(&slab[i]);
+        }
+        atomic_store(&initialised, 1);
+    }
+
+    // Any thread may push, but only the sample path pops, so the head can't be
+    // popped and pushed back by someone else between our load and swap (the
+    // ABA problem) and a plain compare-and-swap is enough.
+    struct slab_buffer *head = atomic_load_explicit(&freeList, memory_order_acquire);
+    while (head != NULL && !atomic_compare_exchange_weak_explicit(&freeList, &head, head->next,
+            memory_order_acquire, memory_order_acquire)) {
+    }
+    if (head != NULL) {
+        atomic_store_explicit(&head->refs, 1, memory_order_relaxed);
+        head->len = 0;
+    }
+    return head;
+}
+
+void slab_hold(struct slab_buffer *buf) {
+    atomic_fetch_add_explicit(&buf->refs, 1, memory_order_relaxed);
+}
+
+void slab_release(struct slab_buffer *buf) {
+    if (atomic_fetch_sub_explicit(&buf->refs, 1, memory_order_acq_rel) == 1) {
+        __push(buf);
+    }
+}
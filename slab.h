@@ -0,0 +1,39 @@
+// Beaglebone Blue Heading NMEA UDP Sender - sentence buffers
+//
+// Fixed-size buffers for formatted sentences, allocated from a static slab.
+// Each sentence is formatted once per sample into one of these, and every sink
+// that sends it refers to the same buffer. Buffers are reference counted, and
+// go back on a lock-free free list when the last reference is released, so a
+// sink that hands a buffer to another thread can release it from there.
+
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stdatomic.h>
+
+// Longest sentence we format, including "$", checksum and line ending. NMEA
+// itself allows 82.
+#define SLAB_BUFFER_LEN 96
+// Number of buffers. Needs to cover every sentence of one sample, plus any
+// held by sinks that send from another thread.
+#define SLAB_BUFFERS 64
+
+struct slab_buffer {
+    struct slab_buffer *next;
+    atomic_int refs;
+    int len;
+    char data[SLAB_BUFFER_LEN];
+};
+
+// Take a buffer off the free list with one reference, or NULL if none are free.
+// Only the sample path may call this.
+struct slab_buffer *slab_get(void);
+
+// Add a reference to a buffer
+void slab_hold(struct slab_buffer *buf);
+
+// Drop a reference, returning the buffer to the free list if it was the last.
+// Safe from any thread.
+void slab_release(struct slab_buffer *buf);
+
+#endif
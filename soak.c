@@ -0,0 +1,219 @@
+// Beaglebone Blue Heading NMEA UDP Sender - soak test
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "angles.h"
+#include "pipeline.h"
+#include "sinks.h"
+#include "soak.h"
+
+// Checks and counters, reset for each report interval where it makes sense
+static struct stage latency = { .name = "latency" };
+static uint64_t sentencesChecked = 0;
+static uint64_t sentencesBad = 0;
+static double expectedHeading = 0.0;
+static double worstHeadingError = 0.0;
+
+// Resident set size in kB
+static long __rss_kb(void) {
+    long pages = 0, resident = 0;
+    FILE *f = fopen("/proc/self/statm", "r");
+    if (f != NULL) {
+        if (fscanf(f, "%ld %ld", &pages, &resident) != 2) {
+            resident = 0;
+        }
+        fclose(f);
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// Number of open file descriptors
+static int __fd_count(void) {
+    int count = 0;
+    DIR *dir = opendir("/proc/self/fd");
+    if (dir == NULL) {
+        return -1;
+    }
+    while (readdir(dir) != NULL) {
+        count++;
+    }
+    closedir(dir);
+    // Don't count ".", ".." or the directory itself
+    return count - 3;
+}
+
+// Check the framing and checksum of one sentence, and that any heading in it
+// matches the sample. Prints the first few failures.
+static void __check_sentence(const struct sample *s, const char *sentence, size_t len) {
+    bool ok = len >= 11 && len <= 82 && sentence[0] == '$' && sentence[len - 5] == '*'
+            && sentence[len - 2] == '\r' && sentence[len - 1] == '\n';
+    if (ok) {
+        int crc = 0;
+        size_t i;
+        for (i = 1; i < len - 5; i++) {
+            crc ^= sentence[i];
+        }
+        char hex[3];
+        snprintf(hex, sizeof(hex), "%02X", crc);
+        ok = memcmp(hex, sentence + len - 4, 2) == 0;
+    }
+    if (ok && (memcmp(sentence + 3, "HDT,", 4) == 0 || memcmp(sentence + 3, "THS,", 4) == 0)) {
+        double heading = atof(sentence + 7);
+        ok = heading >= 0.0 && heading < 360.0 && fabs(wrap_180(heading - s->heading_true)) <= 0.051;
+    }
+    sentencesChecked++;
+    if (!ok) {
+        sentencesBad++;
+        if (sentencesBad <= 10) {
+            fprintf(stderr, "bad sentence at sample %u: %.*s\n", s->sequence, (int) len - 2, sentence);
+        }
+    }
+}
+
+// Sink that checks everything sent, and how long it took to get here
+static void __check_send(__attribute__ ((unused)) struct sink *sink, const struct sample *s,
+        const struct iovec *iov, int iovcnt) {
+    pipeline_record(&latency, pipeline_now() - s->arrival_ns);
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        __check_sentence(s, iov[i].iov_base, iov[i].iov_len);
+    }
+    double error = fabs(wrap_180(s->heading_true - expectedHeading));
+    if (error > worstHeadingError) {
+        worstHeadingError = error;
+    }
+}
+
+int soak_run(double days, rc_mpu_data_t *data, void (*handle)(void)) {
+    struct sink *checker = sinks_add("soak checker", sinks_wanted_sentences());
+    if (checker == NULL) {
+        return -1;
+    }
+    checker->send = __check_send;
+
+    uint64_t totalSamples = (uint64_t) (days * 86400.0 * SAMPLE_RATE_HZ);
+    uint64_t samplesPerHour = 3600ULL * SAMPLE_RATE_HZ;
+    uint64_t periodNs = 1000000000ULL / ((uint64_t) SAMPLE_RATE_HZ * SOAK_SPEEDUP);
+    printf("soak test: %.1f days, %llu samples at %dx real time\n", days,
+            (unsigned long long) totalSamples, SOAK_SPEEDUP);
+    printf("%8s %12s %10s %8s %4s %10s %10s %10s %10s\n", "hour", "sentences", "bad",
+            "rss kB", "fds", "p50 ns", "p99 ns", "max ns", "err deg");
+
+    // Synthetic motion: a random walk in heading with some rolling and
+    // pitching, so every heading and sentence length gets exercised
+    uint32_t random = 12345;
+    double heading = 0.0;
+    long rssBaseline = 0;
+    long rssWorstGrowth = 0;
+    int fdBaseline = 0;
+    int fdWorstGrowth = 0;
+    uint64_t worstP99 = 0;
+    double worstError = 0.0;
+
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    uint64_t n;
+    for (n = 0; n < totalSamples; n++) {
+        random ^= random << 13;
+        random ^= random >> 17;
+        random ^= random << 5;
+        heading = wrap_180(heading + ((double) (random % 2001) - 1000.0) * 0.005);
+        data->compass_heading = heading * DEG_TO_RAD;
+        data->compass_heading_raw = data->compass_heading;
+        data->dmp_TaitBryan[TB_YAW_Z] = data->compass_heading;
+        data->mag[0] = 30.0;
+        data->mag[2] = -40.0;
+        data->dmp_TaitBryan[TB_PITCH_X] = 0.1 * sin((double) n * 0.01);
+        data->dmp_TaitBryan[TB_ROLL_Y] = 0.3 * sin((double) n * 0.003);
+        expectedHeading = wrap_360(-heading + HEADING_OFFSET + LOCAL_MAGNETIC_DECLINATION);
+        handle();
+
+        // Pace ourselves at SOAK_SPEEDUP times the real sample rate
+        next.tv_nsec += periodNs;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+
+        // Report every simulated hour, and the part hour at the end if the run
+        // doesn't end on the hour, labelled with how far into the hour it got
+        // so it isn't taken for the hour before. Memory and file baselines
+        // are taken after the first hour, once everything has warmed up.
+        bool onHour = (n + 1) % samplesPerHour == 0;
+        if (onHour || n + 1 == totalSamples) {
+            long rss = __rss_kb();
+            int fds = __fd_count();
+            if (n + 1 == samplesPerHour) {
+                rssBaseline = rss;
+                fdBaseline = fds;
+            } else if (n + 1 > samplesPerHour) {
+                if (rss - rssBaseline > rssWorstGrowth) {
+                    rssWorstGrowth = rss - rssBaseline;
+                }
+                if (fds - fdBaseline > fdWorstGrowth) {
+                    fdWorstGrowth = fds - fdBaseline;
+                }
+            }
+            uint64_t p99 = pipeline_percentile(&latency, 0.99);
+            if (p99 > worstP99) {
+                worstP99 = p99;
+            }
+            if (worstHeadingError > worstError) {
+                worstError = worstHeadingError;
+            }
+            char hour[24];
+            if (onHour) {
+                snprintf(hour, sizeof(hour), "%llu", (unsigned long long) ((n + 1) / samplesPerHour));
+            } else {
+                snprintf(hour, sizeof(hour), "%.2f", (double) (n + 1) / (double) samplesPerHour);
+            }
+            printf("%8s %12llu %10llu %8ld %4d %10llu %10llu %10llu %10.3f\n", hour,
+                    (unsigned long long) sentencesChecked, (unsigned long long) sentencesBad,
+                    rss, fds,
+                    (unsigned long long) pipeline_percentile(&latency, 0.5),
+                    (unsigned long long) p99, (unsigned long long) latency.max_ns,
+                    worstHeadingError);
+            fflush(stdout);
+            memset(&latency, 0, sizeof(latency));
+            latency.name = "latency";
+            worstHeadingError = 0.0;
+        }
+    }
+
+    // Verdict
+    bool pass = true;
+    if (sentencesChecked == 0 || sentencesBad > 0) {
+        printf("FAIL: %llu of %llu sentences bad\n", (unsigned long long) sentencesBad,
+                (unsigned long long) sentencesChecked);
+        pass = false;
+    }
+    if (rssWorstGrowth > SOAK_MAX_RSS_GROWTH_KB) {
+        printf("FAIL: memory grew by %ld kB, limit %d kB\n", rssWorstGrowth, SOAK_MAX_RSS_GROWTH_KB);
+        pass = false;
+    }
+    if (fdWorstGrowth > 0) {
+        printf("FAIL: %d more files open than after the first hour\n", fdWorstGrowth);
+        pass = false;
+    }
+    if (worstP99 > (uint64_t) SOAK_MAX_P99_LATENCY_US * 1000) {
+        printf("FAIL: p99 latency reached %llu ns, limit %d us\n", (unsigned long long) worstP99,
+                SOAK_MAX_P99_LATENCY_US);
+        pass = false;
+    }
+    if (worstError > SOAK_MAX_HEADING_ERROR) {
+        printf("FAIL: heading drifted %.3f degrees from expected, limit %.3f\n", worstError,
+                SOAK_MAX_HEADING_ERROR);
+        pass = false;
+    }
+    printf("%s\n", pass ? "PASS" : "FAIL");
+    return pass ? 0 : -1;
+}
@@ -0,0 +1,18 @@
+// Beaglebone Blue Heading NMEA UDP Sender - soak test
+//
+// Runs the whole pipeline and sinks on synthetic MPU data, SOAK_SPEEDUP times
+// faster than real time, for a given number of simulated days. Every sentence
+// sent is checked, and memory use, open files and latency are tracked over
+// time. Prints a report and a pass/fail verdict against the SOAK_ thresholds
+// in config.h.
+
+#ifndef SOAK_H
+#define SOAK_H
+
+#include <rc/mpu.h>
+
+// Run the soak test, setting *data and calling handle() for each sample.
+// Returns 0 if it passed.
+int soak_run(double days, rc_mpu_data_t *data, void (*handle)(void));
+
+#endif
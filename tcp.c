@@ -0,0 +1,122 @@
+// Beaglebone Blue Heading NMEA UDP Sender - non-blocking TCP client
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+#include "pipeline.h"
+#include "tcp.h"
+
+#define TCP_MIN_BACKOFF_NS 100000000ULL
+#define TCP_MAX_BACKOFF_NS 30000000000ULL
+
+int tcp_init(struct tcp_client *c, const char *host, int port) {
+    memset(c, 0, sizeof(*c));
+    if (inet_pton(AF_INET, host, &c->addr.sin_addr) != 1) {
+        fprintf(stderr, "bad server address %s, expected an IPv4 address\n", host);
+        return -1;
+    }
+    c->addr.sin_family = AF_INET;
+    c->addr.sin_port   = htons(port);
+    c->fd = -1;
+    c->backoff_ns = TCP_MIN_BACKOFF_NS;
+    return 0;
+}
+
+void tcp_drop(struct tcp_client *c) {
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->connected = false;
+    c->retry_ns = pipeline_now() + c->backoff_ns;
+    c->backoff_ns *= 2;
+    if (c->backoff_ns > TCP_MAX_BACKOFF_NS) {
+        c->backoff_ns = TCP_MAX_BACKOFF_NS;
+    }
+}
+
+bool tcp_ready(struct tcp_client *c) {
+    if (c->connected) {
+        return true;
+    }
+
+    // Start connecting if it's time to
+    if (c->fd < 0) {
+        if (pipeline_now() < c->retry_ns) {
+            return false;
+        }
+        if ((c->fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, IPPROTO_TCP)) < 0) {
+            tcp_drop(c);
+            return false;
+        }
+        int one = 1;
+        setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        if (connect(c->fd, (struct sockaddr *)&c->addr, sizeof(c->addr)) < 0 && errno != EINPROGRESS) {
+            tcp_drop(c);
+            return false;
+        }
+    }
+
+    // See whether the connection attempt has finished
+    struct sockaddr_in peer;
+    socklen_t len = sizeof(peer);
+    if (getpeername(c->fd, (struct sockaddr *)&peer, &len) == 0) {
+        c->connected = true;
+        c->backoff_ns = TCP_MIN_BACKOFF_NS;
+        c->connects++;
+        return true;
+    }
+    int error = 0;
+    len = sizeof(error);
+    getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &error, &len);
+    if (error != 0) {
+        tcp_drop(c);
+    }
+    return false;
+}
+
+int tcp_send(struct tcp_client *c, const struct iovec *iov, int iovcnt) {
+    size_t total = 0;
+    int i;
+    for (i = 0; i < iovcnt; i++) {
+        total += iov[i].iov_len;
+    }
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = (struct iovec *) iov;
+    msg.msg_iovlen = iovcnt;
+    ssize_t sent = sendmsg(c->fd, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if (sent < 0 || (size_t) sent != total) {
+        tcp_drop(c);
+        return -1;
+    }
+    return (int) sent;
+}
+
+int tcp_drain(struct tcp_client *c) {
+    char buf[256];
+    int total = 0;
+    ssize_t len;
+    while ((len = recv(c->fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0) {
+        total += len;
+    }
+    if (len == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+        tcp_drop(c);
+    }
+    return total;
+}
+
+void tcp_close(struct tcp_client *c) {
+    if (c->fd >= 0) {
+        close(c->fd);
+        c->fd = -1;
+    }
+    c->connected = false;
+}
@@ -0,0 +1,48 @@
+// Beaglebone Blue Heading NMEA UDP Sender - non-blocking TCP client
+//
+// A persistent TCP connection for sinks that talk to a server, which never
+// blocks the sample path. Connecting happens in the background, and if the
+// connection fails or drops it is retried with exponential backoff.
+
+#ifndef TCP_H
+#define TCP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <sys/uio.h>
+#include <netinet/in.h>
+
+struct tcp_client {
+    struct sockaddr_in addr;
+    int fd;
+    bool connected;
+    // When to next try connecting, and how long to wait after that
+    uint64_t retry_ns;
+    uint64_t backoff_ns;
+    // Times we have connected, including the first
+    uint32_t connects;
+};
+
+// Set up a client for an IPv4 address and port. Returns 0 on success, or -1
+// after printing a message if host isn't an IPv4 address.
+int tcp_init(struct tcp_client *c, const char *host, int port);
+
+// Returns true if connected and ready to send. Otherwise starts or checks on
+// a connection attempt, without waiting, and returns false.
+bool tcp_ready(struct tcp_client *c);
+
+// Send the whole of iov without blocking. If it can't all be sent the
+// connection is dropped, so a half-sent message never corrupts the stream.
+// Returns the number of bytes sent, or -1.
+int tcp_send(struct tcp_client *c, const struct iovec *iov, int iovcnt);
+
+// Discard anything the server has sent us. Drops the connection if the
+// server has closed it. Returns the number of bytes discarded.
+int tcp_drain(struct tcp_client *c);
+
+// Drop the connection, to be retried after the backoff time
+void tcp_drop(struct tcp_client *c);
+
+void tcp_close(struct tcp_client *c);
+
+#endif
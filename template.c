@@ -0,0 +1,480 @@
+// Beaglebone Blue Heading NMEA UDP Sender - sentence templates
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <strings.h>
+#include <ctype.h>
+#include <math.h>
+
+#include "config.h"
+#include "fastfmt.h"
+#include "pipeline.h"
+#include "loadshed.h"
+#include "template.h"
+
+// Most operations in one template, and values on the stack at once
+#define TEMPLATE_OPS 64
+#define TEMPLATE_STACK 8
+// Values this size or more come out empty, so every value fits in
+// VALUE_MAX_LEN plus its decimal places
+#define VALUE_LIMIT 1e12
+#define VALUE_MAX_LEN 15
+
+// What a field or expression measures, for checking units
+enum kind {
+    KIND_NONE,
+    KIND_ANGLE,     // degrees
+    KIND_SPEED,     // knots
+    KIND_PRESSURE,  // Pa
+    KIND_LENGTH,    // metres
+    KIND_MIXED
+};
+
+enum field_type {
+    FIELD_DOUBLE,
+    FIELD_INT,
+    FIELD_UINT32
+};
+
+struct template_field {
+    const char *name;
+    size_t offset;
+    enum field_type type;
+    enum kind kind;
+    // Offset of the bool saying whether the field is valid, or -1 if it always is
+    int valid;
+};
+
+#define VALID(flag) ((int) offsetof(struct sample, flag))
+
+static const struct template_field fields[] = {
+    { "sequence",           offsetof(struct sample, sequence),           FIELD_UINT32, KIND_NONE,     -1 },
+    { "heading_true",       offsetof(struct sample, heading_true),       FIELD_DOUBLE, KIND_ANGLE,    -1 },
+    { "heading_mag",        offsetof(struct sample, heading_mag),        FIELD_DOUBLE, KIND_ANGLE,    -1 },
+    { "heading_raw",        offsetof(struct sample, heading_raw),        FIELD_DOUBLE, KIND_ANGLE,    -1 },
+    { "heading_source",     offsetof(struct sample, heading_source),     FIELD_INT,    KIND_NONE,     -1 },
+    { "gnss_bias",          offsetof(struct sample, gnss_bias),          FIELD_DOUBLE, KIND_ANGLE,    -1 },
+    { "pitch",              offsetof(struct sample, pitch),              FIELD_DOUBLE, KIND_ANGLE,    -1 },
+    { "roll",               offsetof(struct sample, roll),               FIELD_DOUBLE, KIND_ANGLE,    -1 },
+    { "mag_field",          offsetof(struct sample, mag_field),          FIELD_DOUBLE, KIND_NONE,     -1 },
+    { "imu_voters",         offsetof(struct sample, imu_voters),         FIELD_INT,    KIND_NONE,     -1 },
+    { "pressure",           offsetof(struct sample, pressure),           FIELD_INT,    KIND_PRESSURE, VALID(pressure_valid) },
+    { "latitude",           offsetof(struct sample, latitude),           FIELD_DOUBLE, KIND_ANGLE,    VALID(position_valid) },
+    { "longitude",          offsetof(struct sample, longitude),          FIELD_DOUBLE, KIND_ANGLE,    VALID(position_valid) },
+    { "speed",              offsetof(struct sample, speed),              FIELD_DOUBLE, KIND_SPEED,    VALID(position_valid) },
+    { "track",              offsetof(struct sample, track),              FIELD_DOUBLE, KIND_ANGLE,    VALID(position_valid) },
+    { "satellites",         offsetof(struct sample, satellites),         FIELD_INT,    KIND_NONE,     VALID(position_valid) },
+    { "hdop",               offsetof(struct sample, hdop),               FIELD_DOUBLE, KIND_NONE,     VALID(position_valid) },
+    { "altitude",           offsetof(struct sample, altitude),           FIELD_DOUBLE, KIND_LENGTH,   VALID(position_valid) },
+    { "wind_direction",     offsetof(struct sample, wind_direction),     FIELD_DOUBLE, KIND_ANGLE,    VALID(wind_valid) },
+    { "wind_direction_mag", offsetof(struct sample, wind_direction_mag), FIELD_DOUBLE, KIND_ANGLE,    VALID(wind_valid) },
+    { "wind_angle",         offsetof(struct sample, wind_angle),         FIELD_DOUBLE, KIND_ANGLE,    VALID(wind_valid) },
+    { "wind_speed",         offsetof(struct sample, wind_speed),         FIELD_DOUBLE, KIND_SPEED,    VALID(wind_valid) },
+};
+#define FIELD_COUNT ((int) (sizeof(fields) / sizeof(fields[0])))
+
+struct template_unit {
+    const char *name;
+    enum kind kind;
+    double factor;
+};
+
+static const struct template_unit units[] = {
+    { "deg", KIND_ANGLE,    1.0 },
+    { "rad", KIND_ANGLE,    M_PI / 180.0 },
+    { "kn",  KIND_SPEED,    1.0 },
+    { "ms",  KIND_SPEED,    1852.0 / 3600.0 },
+    { "kmh", KIND_SPEED,    1.852 },
+    { "mph", KIND_SPEED,    1852.0 / 1609.344 },
+    { "pa",  KIND_PRESSURE, 1.0 },
+    { "hpa", KIND_PRESSURE, 0.01 },
+    { "bar", KIND_PRESSURE, 1e-5 },
+    { "m",   KIND_LENGTH,   1.0 },
+    { "ft",  KIND_LENGTH,   1.0 / 0.3048 },
+};
+#define UNIT_COUNT ((int) (sizeof(units) / sizeof(units[0])))
+
+enum op {
+    OP_TEXT,        // copy length bytes of the template's text from offset
+    OP_CONST,       // push value
+    OP_DOUBLE,      // push the double field at offset
+    OP_INT,         // push the int field at offset
+    OP_UINT32,      // push the uint32_t field at offset
+    OP_ADD,
+    OP_SUB,
+    OP_MUL,
+    OP_DIV,
+    OP_NEG,
+    OP_VALUE        // pop and write with decimals places, or nothing if invalid
+};
+
+struct template_op {
+    uint8_t op;
+    uint8_t decimals;
+    int16_t valid;
+    uint16_t offset;
+    uint16_t length;
+    double value;
+};
+
+struct template {
+    struct template_op ops[TEMPLATE_OPS];
+    int opCount;
+    // The literal parts of the sentence, which OP_TEXT copies from
+    char text[SLAB_BUFFER_LEN];
+    int textLen;
+    struct stage stats;
+    char name[16];
+};
+
+static struct template templates[TEMPLATE_MAX];
+static int templateCount = 0;
+
+// Compiler state for one template
+struct compiler {
+    struct template *t;
+    const char *p;
+    int depth;
+    int maxDepth;
+    const char *error;
+};
+
+static void __emit(struct compiler *c, struct template_op op) {
+    if (c->t->opCount >= TEMPLATE_OPS) {
+        c->error = "too long";
+        return;
+    }
+    c->t->ops[c->t->opCount++] = op;
+}
+
+static void __push(struct compiler *c, struct template_op op) {
+    __emit(c, op);
+    if (++c->depth > c->maxDepth) {
+        c->maxDepth = c->depth;
+    }
+}
+
+static void __skip_spaces(struct compiler *c) {
+    while (*c->p == ' ') {
+        c->p++;
+    }
+}
+
+static enum kind __expression(struct compiler *c);
+
+// primary := number | field | "(" expression ")" | "-" primary
+static enum kind __primary(struct compiler *c) {
+    __skip_spaces(c);
+    if (*c->p == '-') {
+        c->p++;
+        enum kind kind = __primary(c);
+        __emit(c, (struct template_op) { .op = OP_NEG });
+        return kind;
+    }
+    if (*c->p == '(') {
+        c->p++;
+        enum kind kind = __expression(c);
+        __skip_spaces(c);
+        if (*c->p != ')') {
+            c->error = "missing )";
+            return KIND_NONE;
+        }
+        c->p++;
+        return kind;
+    }
+    if (isdigit((unsigned char) *c->p) || *c->p == '.') {
+        char *end;
+        double value = strtod(c->p, &end);
+        c->p = end;
+        __push(c, (struct template_op) { .op = OP_CONST, .value = value });
+        return KIND_NONE;
+    }
+    const char *start = c->p;
+    while (isalnum((unsigned char) *c->p) || *c->p == '_') {
+        c->p++;
+    }
+    int i;
+    for (i = 0; i < FIELD_COUNT; i++) {
+        if ((size_t) (c->p - start) == strlen(fields[i].name) && strncmp(start, fields[i].name, c->p - start) == 0) {
+            static const uint8_t ops[] = { OP_DOUBLE, OP_INT, OP_UINT32 };
+            __push(c, (struct template_op) { .op = ops[fields[i].type], .offset = (uint16_t) fields[i].offset,
+                    .valid = (int16_t) fields[i].valid });
+            return fields[i].kind;
+        }
+    }
+    c->error = c->p == start ? "expected a number or field" : "unknown field";
+    return KIND_NONE;
+}
+
+// Adding or subtracting keeps the units if both sides agree or one is a plain
+// number. Multiplying or dividing keeps them only if the other side is a
+// plain number.
+static enum kind __combine(enum kind a, enum kind b, bool additive) {
+    if (a == KIND_NONE) {
+        return b;
+    }
+    if (b == KIND_NONE || (additive && a == b)) {
+        return a;
+    }
+    return KIND_MIXED;
+}
+
+// term := primary (("*" | "/") primary)*
+static enum kind __term(struct compiler *c) {
+    enum kind kind = __primary(c);
+    for (;;) {
+        __skip_spaces(c);
+        char op = *c->p;
+        if (op != '*' && op != '/') {
+            return kind;
+        }
+        c->p++;
+        kind = __combine(kind, __primary(c), false);
+        __emit(c, (struct template_op) { .op = op == '*' ? OP_MUL : OP_DIV });
+        c->depth--;
+    }
+}
+
+// expression := term (("+" | "-") term)*
+static enum kind __expression(struct compiler *c) {
+    enum kind kind = __term(c);
+    for (;;) {
+        __skip_spaces(c);
+        char op = *c->p;
+        if (op != '+' && op != '-') {
+            return kind;
+        }
+        c->p++;
+        kind = __combine(kind, __term(c), true);
+        __emit(c, (struct template_op) { .op = op == '+' ? OP_ADD : OP_SUB });
+        c->depth--;
+    }
+}
+
+// value := expression ["|" unit] [":" decimals] "}"
+static int __value(struct compiler *c) {
+    enum kind kind = __expression(c);
+    if (c->error != NULL) {
+        return -1;
+    }
+    __skip_spaces(c);
+    if (*c->p == '|') {
+        c->p++;
+        __skip_spaces(c);
+        const char *start = c->p;
+        while (isalpha((unsigned char) *c->p)) {
+            c->p++;
+        }
+        int i;
+        for (i = 0; i < UNIT_COUNT; i++) {
+            if ((size_t) (c->p - start) == strlen(units[i].name) && strncasecmp(start, units[i].name, c->p - start) == 0) {
+                break;
+            }
+        }
+        if (i == UNIT_COUNT) {
+            c->error = "unknown unit";
+            return -1;
+        }
+        if (units[i].kind != kind) {
+            c->error = "unit doesn't match the value";
+            return -1;
+        }
+        if (fabs(units[i].factor - 1.0) > 0.0) {
+            __push(c, (struct template_op) { .op = OP_CONST, .value = units[i].factor });
+            __emit(c, (struct template_op) { .op = OP_MUL });
+            c->depth--;
+        }
+        __skip_spaces(c);
+    }
+    int decimals = 1;
+    if (*c->p == ':') {
+        c->p++;
+        if (c->p[0] < '0' || c->p[0] > '6' || isdigit((unsigned char) c->p[1])) {
+            c->error = "decimal places must be 0 to 6";
+            return -1;
+        }
+        decimals = *c->p++ - '0';
+        __skip_spaces(c);
+    }
+    if (*c->p != '}') {
+        c->error = "expected }";
+        return -1;
+    }
+    c->p++;
+    __emit(c, (struct template_op) { .op = OP_VALUE, .decimals = (uint8_t) decimals });
+    c->depth--;
+    return VALUE_MAX_LEN + decimals;
+}
+
+int template_add(const char *text) {
+    if (templateCount >= TEMPLATE_MAX) {
+        fprintf(stderr, "too many templates, %s not added\n", text);
+        return -1;
+    }
+    struct template *t = &templates[templateCount];
+    memset(t, 0, sizeof(*t));
+    struct compiler c = { .t = t, .p = text };
+
+    // "$" and "*XX\r\n" around the sentence
+    int maxLen = 6;
+    while (*c.p != '\0' && c.error == NULL) {
+        if (*c.p == '{') {
+            c.p++;
+            maxLen += __value(&c);
+            continue;
+        }
+        const char *start = c.p;
+        while (*c.p != '\0' && *c.p != '{') {
+            if (*c.p == '$' || *c.p == '*' || *c.p == '}' || !isprint((unsigned char) *c.p)) {
+                c.error = "not allowed outside a value";
+                break;
+            }
+            c.p++;
+        }
+        int len = (int) (c.p - start);
+        if (c.error == NULL && t->textLen + len <= (int) sizeof(t->text)) {
+            memcpy(t->text + t->textLen, start, len);
+            __emit(&c, (struct template_op) { .op = OP_TEXT, .offset = (uint16_t) t->textLen,
+                    .length = (uint16_t) len });
+            t->textLen += len;
+        }
+        maxLen += len;
+    }
+    if (c.error == NULL && c.maxDepth > TEMPLATE_STACK) {
+        c.error = "too deeply nested";
+    }
+    if (c.error == NULL && maxLen > SLAB_BUFFER_LEN) {
+        c.error = "could be too long to send";
+    }
+    if (c.error != NULL) {
+        if (*c.p != '\0') {
+            fprintf(stderr, "template %s: %s at \"%.10s\"\n", text, c.error, c.p);
+        } else {
+            fprintf(stderr, "template %s: %s\n", text, c.error);
+        }
+        return -1;
+    }
+
+    // Named in stats after the sentence's address field
+    int nameLen = (int) strcspn(text, ",");
+    snprintf(t->name, sizeof(t->name), "tpl %.*s", nameLen, text);
+    t->stats.name = t->name;
+    templateCount++;
+    return 0;
+}
+
+int template_count(void) {
+    return templateCount;
+}
+
+// Run a template's operations, writing the sentence body to p. Returns the
+// end of what was written.
+static char *__run(const struct template *t, const struct sample *s, char *p) {
+    double stack[TEMPLATE_STACK];
+    int sp = 0;
+    bool valid = true;
+    const char *base = (const char *) s;
+    const struct template_op *op;
+    const struct template_op *end = t->ops + t->opCount;
+    for (op = t->ops; op < end; op++) {
+        switch (op->op) {
+        case OP_TEXT:
+            memcpy(p, t->text + op->offset, op->length);
+            p += op->length;
+            break;
+        case OP_CONST:
+            stack[sp++] = op->value;
+            break;
+        case OP_DOUBLE:
+            stack[sp++] = *(const double *) (base + op->offset);
+            valid = valid && (op->valid < 0 || *(const bool *) (base + op->valid));
+            break;
+        case OP_INT:
+            stack[sp++] = *(const int *) (base + op->offset);
+            valid = valid && (op->valid < 0 || *(const bool *) (base + op->valid));
+            break;
+        case OP_UINT32:
+            stack[sp++] = *(const uint32_t *) (base + op->offset);
+            break;
+        case OP_ADD:
+            sp--;
+            stack[sp - 1] += stack[sp];
+            break;
+        case OP_SUB:
+            sp--;
+            stack[sp - 1] -= stack[sp];
+            break;
+        case OP_MUL:
+            sp--;
+            stack[sp - 1] *= stack[sp];
+            break;
+        case OP_DIV:
+            sp--;
+            stack[sp - 1] /= stack[sp];
+            break;
+        case OP_NEG:
+            stack[sp - 1] = -stack[sp - 1];
+            break;
+        case OP_VALUE:
+            sp--;
+            if (valid && fabs(stack[sp]) < VALUE_LIMIT) {
+                p = fmt_fixed(p, stack[sp], op->decimals);
+            }
+            valid = true;
+            break;
+        }
+    }
+    return p;
+}
+
+void template_format(struct sample *s) {
+    int i;
+    for (i = 0; i < templateCount; i++) {
+        struct template *t = &templates[i];
+        if (s->extra_sentence_count >= SAMPLE_EXTRA_SENTENCES) {
+            return;
+        }
+        if (SHED_ENABLE && loadshed_drop_extra_sentence()) {
+            continue;
+        }
+        bool timed = STAGE_TIMING && pipeline_timing;
+        uint64_t start = timed ? pipeline_now() : 0;
+        struct slab_buffer *buf = slab_get();
+        if (buf == NULL) {
+            return;
+        }
+        char *p = buf->data;
+        *p++ = '$';
+        p = __run(t, s, p);
+        int crc = 0;
+        const char *c;
+        for (c = buf->data + 1; c < p; c++) {
+            crc ^= *c;
+        }
+        static const char hex[] = "0123456789ABCDEF";
+        *p++ = '*';
+        *p++ = hex[crc >> 4];
+        *p++ = hex[crc & 0xF];
+        *p++ = '\r';
+        *p++ = '\n';
+        buf->len = (int) (p - buf->data);
+        s->extra_sinks[s->extra_sentence_count] = SAMPLE_ALL_SINKS;
+        s->extra_sentences[s->extra_sentence_count++] = buf;
+        if (timed) {
+            pipeline_record(&t->stats, pipeline_now() - start);
+        }
+    }
+}
+
+void template_print_stats(FILE *f) {
+    pipeline_print_header(f, "template");
+    int i;
+    for (i = 0; i < templateCount; i++) {
+        pipeline_print_stage(f, &templates[i].stats);
+    }
+    fflush(f);
+}
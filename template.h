@@ -0,0 +1,45 @@
+// Beaglebone Blue Heading NMEA UDP Sender - sentence templates
+//
+// Custom sentences given on the command line with --template, so a
+// proprietary sentence doesn't need a new formatter. A template is the
+// sentence between the "$" and the "*", with values in braces, e.g.
+//
+//   PXHDG,{heading_true:1},{pitch - 2.5:2},{speed|ms:2},{pressure|hpa:0}
+//
+// Each value is an expression of sample fields and numbers with + - * / and
+// brackets, then optionally "|" and a unit to convert to, then optionally ":"
+// and the decimal places (0-6, 1 if not given). A value using a field that
+// isn't valid in a sample, such as the position without a fix, is left empty.
+// The checksum and line ending are added, and the sentence goes to every sink
+// that sends sentences.
+//
+// Templates are compiled once at startup into a list of operations for a small
+// stack machine, and the size of the longest sentence each can produce is
+// checked then, so formatting one per sample is a run through that list with
+// no parsing, no allocation and no bounds checks.
+
+#ifndef TEMPLATE_H
+#define TEMPLATE_H
+
+#include <stdio.h>
+
+#include "sample.h"
+
+#define TEMPLATE_MAX 4
+
+// Compile a template and add it. Returns 0 on success, or -1 after printing
+// what is wrong with it.
+int template_add(const char *text);
+
+// How many templates have been added
+int template_count(void);
+
+// Pipeline stage, after the formatters. Formats each template's sentence into
+// the sample's extra sentences, unless load shedding is dropping optional
+// sentences.
+void template_format(struct sample *s);
+
+// Print each template's formatting time
+void template_print_stats(FILE *f);
+
+#endif
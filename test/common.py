@@ -0,0 +1,99 @@
+# Beaglebone Blue Heading NMEA UDP Sender - test helpers
+#
+# Shared by the tests: reading settings from config.h, starting the sender
+# built against the stand-in librobotcontrol, and receiving what it sends.
+
+import os
+import re
+import socket
+import subprocess
+import sys
+import threading
+import time
+
+CONFIG = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..", "config.h")
+
+
+def config(name):
+    with open(CONFIG) as f:
+        m = re.search(r"^#define %s (\S+)" % name, f.read(), re.M)
+    return m.group(1).strip('"')
+
+
+RATE_HZ = float(config("SAMPLE_RATE_HZ"))
+SHM_NAMES = [config("FAILOVER_SHM_NAME"), config("BLACKBOX_SHM_NAME")]
+
+
+class Receiver:
+    """Records each datagram arriving on a loopback port, and when"""
+
+    def __init__(self):
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.bind(("127.0.0.1", 0))
+        self.sock.settimeout(0.1)
+        self.port = self.sock.getsockname()[1]
+        self.times = []
+        self.datagrams = []
+        self.running = True
+        self.thread = threading.Thread(target=self.run)
+        self.thread.start()
+
+    def run(self):
+        while self.running:
+            try:
+                data = self.sock.recv(65536)
+                self.datagrams.append(data)
+                self.times.append(time.monotonic())
+            except socket.timeout:
+                pass
+
+    def wait(self, count, timeout):
+        end = time.monotonic() + timeout
+        while len(self.times) < count and time.monotonic() < end:
+            time.sleep(0.01)
+        return len(self.times) >= count
+
+    def since(self, t):
+        return [x for x in self.times if x > t]
+
+    def stop(self):
+        self.running = False
+        self.thread.join()
+        self.sock.close()
+
+
+def sender(build, variant=None):
+    """The sender in the build directory, or one of the variants built with
+    different config.h settings (see the Makefile)"""
+    if variant is None:
+        return os.path.join(build, "heading_nmea_udp_sender")
+    return os.path.join(build, variant, "heading_nmea_udp_sender")
+
+
+def clean_shm():
+    for name in SHM_NAMES:
+        for suffix in ("", ".prev"):
+            try:
+                os.unlink("/dev/shm" + name + suffix)
+            except FileNotFoundError:
+                pass
+
+
+def start(sender, args, **env):
+    """Start the sender with its stderr piped, so tests can check messages"""
+    return subprocess.Popen([sender] + args, env=dict(os.environ, **env), stdout=subprocess.DEVNULL,
+                            stderr=subprocess.PIPE, text=True)
+
+
+def stop(procs, receivers=()):
+    for p in procs:
+        if p.poll() is None:
+            p.kill()
+        p.wait()
+    for r in receivers:
+        r.stop()
+
+
+def fail(message):
+    print("FAIL: " + message)
+    sys.exit(1)
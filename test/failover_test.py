@@ -0,0 +1,91 @@
+#!/usr/bin/env python3
+# Beaglebone Blue Heading NMEA UDP Sender - failover test
+#
+# Runs two instances with --failover against the stand-in librobotcontrol,
+# each sending to its own UDP port, and measures how long sending stops for
+# when the active one fails: killed with SIGKILL, frozen with SIGSTOP, or hung
+# starting the MPU. The standby has to be sending within
+# FAILOVER_TIMEOUT_SAMPLES + 2 sample periods of the active instance's last
+# datagram, or FAILOVER_STARTUP_S for a hung start. An instance frozen and
+# then continued has to fence itself off, exiting without sending again.
+#
+# Usage: failover_test.py BUILD
+
+import signal
+import subprocess
+import sys
+import time
+
+from common import RATE_HZ, Receiver, clean_shm, config, fail, start, stop
+from common import sender as build_sender
+
+TIMEOUT_SAMPLES = int(config("FAILOVER_TIMEOUT_SAMPLES"))
+STARTUP_S = float(config("FAILOVER_STARTUP_S"))
+LIMIT_S = (TIMEOUT_SAMPLES + 2) / RATE_HZ
+
+
+def start_instance(sender, port, **env):
+    return start(sender, ["--failover", "--udp", "127.0.0.1:%d" % port], **env)
+
+
+def run(sender, name, active_env, fault, limit_s):
+    """Start an active and a standby instance, apply fault to the active one
+    and check the standby takes over in time. Returns the two processes and
+    receivers, and when the fault was applied."""
+    clean_shm()
+    a_rx, b_rx = Receiver(), Receiver()
+    a = start_instance(sender, a_rx.port, STUB_TURN="10", **active_env)
+    if not active_env and not a_rx.wait(5, 5.0):
+        fail("%s: active instance isn't sending" % name)
+    time.sleep(0.5)
+    b = start_instance(sender, b_rx.port, STUB_DMP_DELAY_MS="1000")
+    time.sleep(1.0)
+    if b_rx.times:
+        fail("%s: standby sent while the active instance was running" % name)
+    fault_time = time.monotonic()
+    fault(a)
+    if not b_rx.wait(1, limit_s + 2.0):
+        fail("%s: standby never took over" % name)
+    last = max([t for t in a_rx.times if t <= fault_time] or [fault_time])
+    gap = b_rx.times[0] - last
+    print("%-22s %6.0f ms without sending, limit %.0f ms" % (name, gap * 1000, limit_s * 1000))
+    if gap > limit_s:
+        fail("%s: took over too slowly" % name)
+    # Predicted heading until the standby's MPU starts, then real samples
+    if not b_rx.wait(int(RATE_HZ * 2), 4.0):
+        fail("%s: standby stopped sending after taking over" % name)
+    return a, b, a_rx, b_rx, fault_time
+
+
+def main():
+    sender = build_sender(sys.argv[1])
+    try:
+        # Reap it straight away, as systemd would, so it doesn't linger as a zombie
+        a, b, a_rx, b_rx, _ = run(sender, "killed", {}, lambda p: (p.kill(), p.wait()), LIMIT_S)
+        stop([a, b], [a_rx, b_rx])
+
+        a, b, a_rx, b_rx, _ = run(sender, "stopped", {}, lambda p: p.send_signal(signal.SIGSTOP), LIMIT_S)
+        continued = time.monotonic()
+        a.send_signal(signal.SIGCONT)
+        try:
+            status = a.wait(timeout=2.0)
+        except subprocess.TimeoutExpired:
+            fail("stopped: old active instance carried on after being continued")
+        stderr = a.stderr.read()
+        if status == 0 or "another instance has taken over" not in stderr:
+            fail("stopped: old active instance didn't fence itself off")
+        if a_rx.since(continued):
+            fail("stopped: old active instance sent after being continued")
+        print("%-22s fenced itself off" % "continued")
+        stop([a, b], [a_rx, b_rx])
+
+        a, b, a_rx, b_rx, _ = run(sender, "hung starting MPU", {"STUB_DMP_HANG": "1"}, lambda p: None,
+                                  STARTUP_S + LIMIT_S)
+        stop([a, b], [a_rx, b_rx])
+    finally:
+        clean_shm()
+    print("failover test passed")
+
+
+if __name__ == "__main__":
+    main()
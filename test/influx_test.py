@@ -0,0 +1,163 @@
+#!/usr/bin/env python3
+# Beaglebone Blue Heading NMEA UDP Sender - InfluxDB sink test
+#
+# Runs the sender with --influx against a mock InfluxDB, over HTTP and over
+# UDP, and checks every write is a batch of INFLUX_BATCH_SAMPLES lines of
+# well-formed line protocol, one per sample, with nanosecond timestamps a
+# sample period apart. Prints the bytes sent per sample, request headers
+# included for HTTP.
+#
+# Usage: influx_test.py BUILD
+
+import re
+import socket
+import sys
+import threading
+import time
+
+from common import RATE_HZ, Receiver, clean_shm, config, fail, start, stop
+from common import sender as build_sender
+
+MEASUREMENT = config("INFLUX_MEASUREMENT")
+BATCH = int(config("INFLUX_BATCH_SAMPLES"))
+DATABASE = config("INFLUX_DATABASE")
+RUN_S = 3.5
+
+FIELD_PATTERNS = {
+    "heading": r"\d+\.\d",
+    "pitch": r"-?\d+\.\d",
+    "roll": r"-?\d+\.\d",
+    "gnss_bias": r"-?\d+\.\d\d",
+    "source": r"\d+i",
+    "imu_voters": r"\d+i",
+}
+
+
+class MockInflux:
+    """Accepts HTTP writes, answering each with 204 No Content as InfluxDB
+    does, and keeps each request's headers and body"""
+
+    def __init__(self):
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.bind(("127.0.0.1", 0))
+        self.listener.listen(1)
+        self.listener.settimeout(0.1)
+        self.port = self.listener.getsockname()[1]
+        self.requests = []
+        self.bytes = 0
+        self.error = None
+        self.running = True
+        self.thread = threading.Thread(target=self.run)
+        self.thread.start()
+
+    def run(self):
+        while self.running:
+            try:
+                conn, _ = self.listener.accept()
+            except socket.timeout:
+                continue
+            conn.settimeout(0.1)
+            data = b""
+            while self.running:
+                try:
+                    chunk = conn.recv(65536)
+                except socket.timeout:
+                    continue
+                except ConnectionResetError:
+                    break
+                if not chunk:
+                    break
+                data += chunk
+                self.bytes += len(chunk)
+                while b"\r\n\r\n" in data:
+                    head, rest = data.split(b"\r\n\r\n", 1)
+                    m = re.search(rb"\r\nContent-Length: (\d+)", head)
+                    if m is None:
+                        self.error = "request without Content-Length: %r" % head
+                        break
+                    length = int(m.group(1))
+                    if len(rest) < length:
+                        break
+                    self.requests.append((head.decode(), rest[:length].decode()))
+                    data = rest[length:]
+                    conn.sendall(b"HTTP/1.1 204 No Content\r\n\r\n")
+            conn.close()
+
+    def stop(self):
+        self.running = False
+        self.thread.join()
+        self.listener.close()
+
+
+def check_batches(name, batches, fields):
+    """Check each batch is BATCH lines of line protocol a sample apart, and
+    return how many lines there were"""
+    line = re.compile(r"^%s %s (\d{19})$" % (re.escape(MEASUREMENT),
+                      ",".join("%s=%s" % (f, FIELD_PATTERNS[f]) for f in fields)))
+    if len(batches) < 2:
+        fail("%s: only %d batches written" % (name, len(batches)))
+    last = None
+    lines = 0
+    for body in batches:
+        if not body.endswith("\n"):
+            fail("%s: batch doesn't end with a newline" % name)
+        rows = body[:-1].split("\n")
+        if len(rows) != BATCH:
+            fail("%s: batch of %d lines, expected %d" % (name, len(rows), BATCH))
+        for row in rows:
+            m = line.match(row)
+            if m is None:
+                fail("%s: bad line %r" % (name, row))
+            ns = int(m.group(1))
+            if abs(ns / 1e9 - time.time()) > 60:
+                fail("%s: timestamp %d isn't Unix time in ns" % (name, ns))
+            # Timestamps are from the sample clock model, so evenly spaced
+            if last is not None and abs((ns - last) / 1e9 * RATE_HZ - 1.0) > 0.2:
+                fail("%s: %d ns between samples, expected one sample period" % (name, ns - last))
+            last = ns
+            lines += 1
+    return lines
+
+
+def main():
+    sender = build_sender(sys.argv[1])
+    clean_shm()
+    sentences = Receiver()
+    try:
+        # HTTP, with the request line and headers checked too
+        influx = MockInflux()
+        fields = ["heading", "pitch", "roll", "gnss_bias", "source", "imu_voters"]
+        p = start(sender, ["--udp", "127.0.0.1:%d" % sentences.port,
+                           "--influx", "http://127.0.0.1:%d" % influx.port, "--influx-fields", ",".join(fields)])
+        time.sleep(RUN_S)
+        stop([p])
+        influx.stop()
+        if influx.error is not None:
+            fail("http: " + influx.error)
+        for head, _ in influx.requests:
+            lines = head.split("\r\n")
+            if lines[0] != "POST /write?db=%s&precision=ns HTTP/1.1" % DATABASE:
+                fail("http: bad request line %r" % lines[0])
+            if "Host: 127.0.0.1:%d" % influx.port not in lines or "Content-Type: text/plain" not in lines:
+                fail("http: bad headers %r" % lines)
+        samples = check_batches("http", [body for _, body in influx.requests], fields)
+        print("%-22s %3d batches, %5.1f bytes/sample with %d fields" % ("influx http", len(influx.requests),
+              influx.bytes / samples, len(fields)))
+
+        # UDP, one datagram per batch
+        rx = Receiver()
+        p = start(sender, ["--udp", "127.0.0.1:%d" % sentences.port, "--influx", "udp://127.0.0.1:%d" % rx.port])
+        time.sleep(RUN_S)
+        stop([p], [rx])
+        fields = config("INFLUX_DEFAULT_FIELDS").split(",")
+        samples = check_batches("udp", [d.decode() for d in rx.datagrams], fields)
+        print("%-22s %3d batches, %5.1f bytes/sample with %d fields" % ("influx udp", len(rx.datagrams),
+              sum(len(d) for d in rx.datagrams) / samples, len(fields)))
+    finally:
+        sentences.stop()
+        clean_shm()
+    print("influx test passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,254 @@
+#!/usr/bin/env python3
+# Beaglebone Blue Heading NMEA UDP Sender - MQTT sink test
+#
+# Runs the sender with --mqtt against a stand-in broker that decodes every
+# packet. Checks the CONNECT packet byte for byte, that each sample is
+# published as QoS 0 PUBLISH packets to the heading, pitch and roll topics, and
+# with the batch build, which has MQTT_BATCH_SAMPLES 5, that batches of samples
+# go to the samples topic. Then takes the broker away and checks the sender
+# waits out its backoff before reconnecting, sending a fresh CONNECT, while the
+# UDP output carries on without a gap.
+#
+# Usage: mqtt_test.py BUILD
+
+import re
+import socket
+import struct
+import sys
+import threading
+import time
+
+from common import RATE_HZ, Receiver, clean_shm, config, fail, start, stop
+from common import sender as build_sender
+
+CLIENT_ID = config("MQTT_CLIENT_ID")
+KEEPALIVE_S = int(config("MQTT_KEEPALIVE_S"))
+PREFIX = "test/boat"
+BATCH = 5
+# The broker is away long enough for the sender's retries, 0.1 s apart and
+# doubling, to get 1.6 s apart, so the next one should come about a second
+# after it is back
+AWAY_S = 2.35
+BACKOFF_MIN_S = 0.5
+BACKOFF_MAX_S = 2.0
+
+CONNECT = (bytes([0x10, 12 + len(CLIENT_ID)]) + b"\x00\x04MQTT\x04\x02"
+           + struct.pack(">HH", KEEPALIVE_S, len(CLIENT_ID)) + CLIENT_ID.encode())
+VALUE = re.compile(rb"^-?\d+\.\d$")
+
+
+class Broker:
+    """Accepts one connection at a time and records each packet as
+    (connection number, time, first byte, whole packet, fixed header length)"""
+
+    def __init__(self):
+        self.port = 0
+        self.packets = []
+        self.connections = []
+        self.error = None
+        self.listener = None
+        self.conn = None
+        self.away = False
+        self.running = True
+        self.listen()
+        self.thread = threading.Thread(target=self.run)
+        self.thread.start()
+
+    def listen(self):
+        self.listener = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.listener.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.listener.bind(("127.0.0.1", self.port))
+        self.listener.listen(1)
+        self.listener.settimeout(0.05)
+        self.port = self.listener.getsockname()[1]
+
+    def go_away(self):
+        """Close the connection and stop listening, so connecting is refused"""
+        self.away = True
+        while self.listener is not None:
+            time.sleep(0.01)
+
+    def come_back(self):
+        self.listen()
+
+    def run(self):
+        data = b""
+        while self.running:
+            if self.away:
+                if self.conn is not None:
+                    self.conn.close()
+                    self.conn = None
+                self.listener.close()
+                self.listener = None
+                self.away = False
+            if self.listener is None:
+                time.sleep(0.01)
+                continue
+            if self.conn is None:
+                try:
+                    self.conn, _ = self.listener.accept()
+                except socket.timeout:
+                    continue
+                self.conn.settimeout(0.05)
+                self.connections.append(time.monotonic())
+                data = b""
+            try:
+                chunk = self.conn.recv(65536)
+            except socket.timeout:
+                continue
+            except ConnectionResetError:
+                chunk = b""
+            if not chunk:
+                self.conn.close()
+                self.conn = None
+                continue
+            data += chunk
+            data = self.decode(data)
+
+    def decode(self, data):
+        """Take whole packets off the front of data, returning the rest"""
+        while len(data) >= 2:
+            # Remaining length, seven bits a byte, least significant first
+            length = 0
+            n = 1
+            while True:
+                if n >= len(data):
+                    return data
+                length |= (data[n] & 0x7F) << (7 * (n - 1))
+                n += 1
+                if not data[n - 1] & 0x80:
+                    break
+                if n > 4:
+                    self.error = "remaining length over four bytes"
+                    return b""
+            if len(data) < n + length:
+                return data
+            packet = data[:n + length]
+            self.packets.append((len(self.connections), time.monotonic(), packet[0], packet, n))
+            if packet[0] == 0x10:
+                self.conn.sendall(b"\x20\x02\x00\x00")
+            data = data[n + length:]
+        return data
+
+    def stop(self):
+        self.running = False
+        self.thread.join()
+        if self.conn is not None:
+            self.conn.close()
+        if self.listener is not None:
+            self.listener.close()
+
+
+def publishes(broker, connection):
+    """Check a connection's packets are CONNECT then QoS 0 PUBLISHes, and
+    return each PUBLISH's topic and payload"""
+    packets = [p for p in broker.packets if p[0] == connection]
+    if not packets or packets[0][3] != CONNECT:
+        fail("connection %d didn't start with CONNECT %s: %r" % (connection, CONNECT.hex(), packets[:1]))
+    result = []
+    for _, _, first, packet, n in packets[1:]:
+        if first != 0x30:
+            fail("expected a QoS 0 PUBLISH with no flags, got packet type 0x%02X" % first)
+        topicLen = struct.unpack(">H", packet[n:n + 2])[0]
+        topic = packet[n + 2:n + 2 + topicLen].decode()
+        result.append((topic, packet[n + 2 + topicLen:]))
+    return result
+
+
+def check_per_sample(broker):
+    """Each sample is heading, pitch and roll, in that order"""
+    topics = ["%s/%s" % (PREFIX, v) for v in ("heading", "pitch", "roll")]
+    messages = publishes(broker, 1)
+    if len(messages) < 3 * RATE_HZ:
+        fail("only %d messages published" % len(messages))
+    for i, (topic, payload) in enumerate(messages):
+        if topic != topics[i % 3]:
+            fail("message %d went to %s, expected %s" % (i, topic, topics[i % 3]))
+        if not VALUE.match(payload):
+            fail("bad %s payload %r" % (topic, payload))
+    return len(messages) // 3
+
+
+def check_batches(broker):
+    """BATCH lines of time_ms,heading,pitch,roll per message, a sample apart"""
+    line = re.compile(r"^(\d{13})(,-?\d+\.\d){3}$")
+    messages = publishes(broker, 1)
+    if len(messages) < 2:
+        fail("batch: only %d batches published" % len(messages))
+    last = None
+    for topic, payload in messages:
+        if topic != PREFIX + "/samples":
+            fail("batch: published to %s, expected %s/samples" % (topic, PREFIX))
+        rows = payload.decode().rstrip("\n").split("\n")
+        if len(rows) != BATCH:
+            fail("batch: %d samples in a batch, expected %d" % (len(rows), BATCH))
+        for row in rows:
+            m = line.match(row)
+            if m is None:
+                fail("batch: bad line %r" % row)
+            ms = int(m.group(1))
+            if abs(ms / 1e3 - time.time()) > 60:
+                fail("batch: time %d isn't Unix time in ms" % ms)
+            if last is not None and abs((ms - last) / 1e3 * RATE_HZ - 1.0) > 0.2:
+                fail("batch: %d ms between samples, expected one sample period" % (ms - last))
+            last = ms
+    return len(messages)
+
+
+def main():
+    sender, batchSender = build_sender(sys.argv[1]), build_sender(sys.argv[1], "batch")
+    clean_shm()
+    try:
+        # Per-sample messages, then the broker going away and coming back
+        broker = Broker()
+        rx = Receiver()
+        p = start(sender, ["--udp", "127.0.0.1:%d" % rx.port, "--mqtt", "127.0.0.1:%d/%s" % (broker.port, PREFIX)])
+        time.sleep(2.0)
+        samples = check_per_sample(broker)
+        print("%-22s %3d samples, %d-byte CONNECT checked" % ("mqtt per sample", samples, len(CONNECT)))
+
+        broker.go_away()
+        away = time.monotonic()
+        time.sleep(AWAY_S)
+        broker.come_back()
+        back = time.monotonic()
+        end = back + BACKOFF_MAX_S + 1.0
+        while len(broker.connections) < 2 and time.monotonic() < end:
+            time.sleep(0.01)
+        time.sleep(0.5)
+        stop([p], [rx])
+        broker.stop()
+        if broker.error is not None:
+            fail(broker.error)
+        if len(broker.connections) < 2:
+            fail("reconnect: never reconnected")
+        wait = broker.connections[1] - back
+        print("%-22s %6.0f ms after the broker came back, expected %.0f - %.0f ms" % (
+              "mqtt reconnect", wait * 1000, BACKOFF_MIN_S * 1000, BACKOFF_MAX_S * 1000))
+        if wait < BACKOFF_MIN_S:
+            fail("reconnect: retrying without backing off")
+        if wait > BACKOFF_MAX_S:
+            fail("reconnect: backed off too far")
+        if not publishes(broker, 2):
+            fail("reconnect: nothing published after reconnecting")
+        gaps = [b - a for a, b in zip(rx.times, rx.times[1:]) if a >= away]
+        if max(gaps) > 3.0 / RATE_HZ:
+            fail("reconnect: UDP output stopped for %.0f ms while the broker was away" % (max(gaps) * 1000))
+
+        # Batches
+        broker = Broker()
+        rx = Receiver()
+        p = start(batchSender, ["--udp", "127.0.0.1:%d" % rx.port,
+                                "--mqtt", "127.0.0.1:%d/%s" % (broker.port, PREFIX)])
+        time.sleep(2.0)
+        stop([p], [rx])
+        broker.stop()
+        batches = check_batches(broker)
+        print("%-22s %3d batches of %d samples" % ("mqtt batched", batches, BATCH))
+    finally:
+        clean_shm()
+    print("mqtt test passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,25 @@
+// Test stand-in for librobotcontrol's rc/bmp.h: only what the sender uses
+
+#ifndef RC_BMP_H
+#define RC_BMP_H
+
+typedef enum {
+    BMP_OVERSAMPLE_1 = 4,
+    BMP_OVERSAMPLE_16 = 20
+} rc_bmp_oversample_t;
+
+typedef enum {
+    BMP_FILTER_OFF = 0
+} rc_bmp_filter_t;
+
+typedef struct rc_bmp_data_t {
+    double temp_c;
+    double alt_m;
+    double pressure_pa;
+} rc_bmp_data_t;
+
+int rc_bmp_init(rc_bmp_oversample_t oversample, rc_bmp_filter_t filter);
+int rc_bmp_read(rc_bmp_data_t *data);
+int rc_bmp_power_off(void);
+
+#endif
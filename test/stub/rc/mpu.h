@@ -0,0 +1,68 @@
+// Test stand-in for librobotcontrol's rc/mpu.h: only what the sender uses
+
+#ifndef RC_MPU_H
+#define RC_MPU_H
+
+#include <stdint.h>
+
+#define RAD_TO_DEG 57.295779513
+#define DEG_TO_RAD 0.0174532925199
+#define TB_PITCH_X 0
+#define TB_ROLL_Y 1
+#define TB_YAW_Z 2
+
+typedef enum {
+    ORIENTATION_Z_UP = 136
+} rc_mpu_orientation_t;
+
+typedef struct rc_mpu_config_t {
+    int gpio_interrupt_pin_chip;
+    int gpio_interrupt_pin;
+    int i2c_bus;
+    uint8_t i2c_addr;
+    int show_warnings;
+    int accel_fsr;
+    int gyro_fsr;
+    int accel_dlpf;
+    int gyro_dlpf;
+    int enable_magnetometer;
+    int dmp_sample_rate;
+    int dmp_fetch_accel_gyro;
+    int dmp_auto_calibrate_gyro;
+    rc_mpu_orientation_t orient;
+    double compass_time_constant;
+    int dmp_interrupt_sched_policy;
+    int dmp_interrupt_priority;
+    int read_mag_after_callback;
+    int mag_sample_rate_div;
+    int tap_threshold;
+} rc_mpu_config_t;
+
+typedef struct rc_mpu_data_t {
+    double accel[3];
+    double gyro[3];
+    double mag[3];
+    double temp;
+    int16_t raw_gyro[3];
+    int16_t raw_accel[3];
+    double accel_to_ms2;
+    double gyro_to_degs;
+    double dmp_quat[4];
+    double dmp_TaitBryan[3];
+    int tap_detected;
+    int last_tap_direction;
+    int last_tap_count;
+    double fused_quat[4];
+    double fused_TaitBryan[3];
+    double compass_heading;
+    double compass_heading_raw;
+} rc_mpu_data_t;
+
+rc_mpu_config_t rc_mpu_default_config(void);
+int rc_mpu_initialize(rc_mpu_data_t *data, rc_mpu_config_t conf);
+int rc_mpu_initialize_dmp(rc_mpu_data_t *data, rc_mpu_config_t conf);
+int rc_mpu_set_dmp_callback(void (*func)(void));
+int rc_mpu_power_off(void);
+int rc_mpu_read_temp(rc_mpu_data_t *data);
+
+#endif
@@ -0,0 +1,8 @@
+// Test stand-in for librobotcontrol's rc/time.h: only what the sender uses
+
+#ifndef RC_TIME_H
+#define RC_TIME_H
+
+void rc_usleep(unsigned int us);
+
+#endif
@@ -0,0 +1,129 @@
+// Beaglebone Blue Heading NMEA UDP Sender - test stand-in for librobotcontrol
+//
+// Just enough of librobotcontrol for the tests to run the sender on any Linux
+// machine. The DMP is a thread that calls back at the configured rate, with a
+// heading turning at STUB_TURN degrees per second. It starts STUB_DMP_DELAY_MS
+// after rc_mpu_initialize_dmp() is called, as the real one takes a while, or
+// never with STUB_DMP_HANG set. The barometer reads STUB_PRESSURE_PA, or
+// standard pressure.
+
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <rc/mpu.h>
+#include <rc/bmp.h>
+#include <rc/time.h>
+
+static rc_mpu_data_t *dmpData = NULL;
+static void (*dmpCallback)(void) = NULL;
+static int dmpRateHz = 100;
+static pthread_t dmpThread;
+static volatile bool dmpRunning = false;
+
+static double __env(const char *name, double fallback) {
+    const char *value = getenv(name);
+    return value != NULL ? atof(value) : fallback;
+}
+
+static void *__dmp(__attribute__ ((unused)) void *arg) {
+    double turn = __env("STUB_TURN", 0.0) * DEG_TO_RAD;
+    long periodNs = 1000000000L / dmpRateHz;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+    double heading = 0.0;
+    long n = 0;
+    while (dmpRunning) {
+        next.tv_nsec += periodNs;
+        while (next.tv_nsec >= 1000000000L) {
+            next.tv_nsec -= 1000000000L;
+            next.tv_sec++;
+        }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+        heading = remainder(heading + turn / dmpRateHz, 2.0 * M_PI);
+        dmpData->compass_heading = heading;
+        dmpData->compass_heading_raw = heading;
+        dmpData->dmp_TaitBryan[TB_YAW_Z] = heading;
+        dmpData->dmp_TaitBryan[TB_PITCH_X] = 0.05 * sin(n * 0.01);
+        dmpData->dmp_TaitBryan[TB_ROLL_Y] = 0.1 * sin(n * 0.003);
+        dmpData->mag[0] = 30.0;
+        dmpData->mag[1] = 0.0;
+        dmpData->mag[2] = -40.0;
+        n++;
+        if (dmpCallback != NULL) {
+            dmpCallback();
+        }
+    }
+    return NULL;
+}
+
+rc_mpu_config_t rc_mpu_default_config(void) {
+    rc_mpu_config_t conf;
+    memset(&conf, 0, sizeof(conf));
+    conf.dmp_sample_rate = 100;
+    conf.compass_time_constant = 20.0;
+    return conf;
+}
+
+int rc_mpu_initialize(__attribute__ ((unused)) rc_mpu_data_t *data, __attribute__ ((unused)) rc_mpu_config_t conf) {
+    return -1;
+}
+
+int rc_mpu_initialize_dmp(rc_mpu_data_t *data, rc_mpu_config_t conf) {
+    if (getenv("STUB_DMP_HANG") != NULL) {
+        for (;;) {
+            pause();
+        }
+    }
+    usleep((useconds_t) (__env("STUB_DMP_DELAY_MS", 0.0) * 1000.0));
+    dmpData = data;
+    dmpRateHz = conf.dmp_sample_rate > 0 ? conf.dmp_sample_rate : 100;
+    dmpRunning = true;
+    if (pthread_create(&dmpThread, NULL, __dmp, NULL)) {
+        dmpRunning = false;
+        return -1;
+    }
+    return 0;
+}
+
+int rc_mpu_set_dmp_callback(void (*func)(void)) {
+    dmpCallback = func;
+    return 0;
+}
+
+int rc_mpu_power_off(void) {
+    if (dmpRunning) {
+        dmpRunning = false;
+        pthread_join(dmpThread, NULL);
+    }
+    return 0;
+}
+
+int rc_mpu_read_temp(rc_mpu_data_t *data) {
+    data->temp = 25.0;
+    return 0;
+}
+
+void rc_usleep(unsigned int us) {
+    usleep(us);
+}
+
+int rc_bmp_init(__attribute__ ((unused)) rc_bmp_oversample_t oversample,
+        __attribute__ ((unused)) rc_bmp_filter_t filter) {
+    return 0;
+}
+
+int rc_bmp_read(rc_bmp_data_t *data) {
+    data->pressure_pa = __env("STUB_PRESSURE_PA", 101325.0);
+    data->temp_c = 20.0;
+    data->alt_m = 0.0;
+    return 0;
+}
+
+int rc_bmp_power_off(void) {
+    return 0;
+}
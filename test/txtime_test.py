@@ -0,0 +1,141 @@
+#!/usr/bin/env python3
+# Beaglebone Blue Heading NMEA UDP Sender - scheduled transmission test
+#
+# Sends across a veth pair into a network namespace, where the receiver takes
+# a kernel timestamp as each datagram arrives, and measures the spread of
+# departure times around the sample grid: first sending immediately, then
+# with TXTIME_ENABLE through the etf qdisc. With etf, every datagram has to
+# leave within SPREAD_LIMIT_US of the same point in the sample period.
+#
+# Needs root, ip and tc, and a kernel with etf (sch_etf). Without them it says
+# so and passes, so make test still works anywhere.
+#
+# Usage: txtime_test.py BUILD
+
+import os
+import shutil
+import socket
+import struct
+import subprocess
+import sys
+import time
+
+from common import RATE_HZ, clean_shm, fail, start, stop
+from common import sender as build_sender
+
+NAMESPACE = "hnus%d" % os.getpid()
+OUTSIDE = NAMESPACE + "a"
+INSIDE = NAMESPACE + "b"
+OUTSIDE_IP = "10.213.83.1"
+INSIDE_IP = "10.213.83.2"
+PORT = 10110
+RUN_S = 6.0
+# Samples left out at the start, while the sample clock model settles
+SETTLE = 5
+SPREAD_LIMIT_US = 200
+ETF_DELTA_NS = 300000
+SO_TIMESTAMPNS = 35
+
+
+def receive():
+    """Run inside the namespace: print the kernel's arrival time in ns of each
+    datagram for RUN_S seconds"""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.setsockopt(socket.SOL_SOCKET, SO_TIMESTAMPNS, 1)
+    sock.bind((INSIDE_IP, PORT))
+    sock.settimeout(0.1)
+    end = time.monotonic() + RUN_S
+    while time.monotonic() < end:
+        try:
+            _, ancdata, _, _ = sock.recvmsg(4096, socket.CMSG_SPACE(16))
+        except socket.timeout:
+            continue
+        for level, kind, data in ancdata:
+            if level == socket.SOL_SOCKET and kind == SO_TIMESTAMPNS:
+                seconds, ns = struct.unpack("qq", data[:16])
+                print(seconds * 1000000000 + ns, flush=True)
+
+
+def run(args, check=True):
+    return subprocess.run(args, check=check, stdout=subprocess.DEVNULL, stderr=subprocess.DEVNULL).returncode
+
+
+def set_up():
+    run(["ip", "netns", "add", NAMESPACE])
+    run(["ip", "link", "add", OUTSIDE, "type", "veth", "peer", "name", INSIDE, "netns", NAMESPACE])
+    run(["ip", "addr", "add", OUTSIDE_IP + "/30", "dev", OUTSIDE])
+    run(["ip", "link", "set", OUTSIDE, "up"])
+    run(["ip", "netns", "exec", NAMESPACE, "ip", "addr", "add", INSIDE_IP + "/30", "dev", INSIDE])
+    run(["ip", "netns", "exec", NAMESPACE, "ip", "link", "set", INSIDE, "up"])
+    run(["ip", "netns", "exec", NAMESPACE, "ip", "link", "set", "lo", "up"])
+    # etf drops anything without a launch time, ARP included, so the
+    # neighbour has to be known already
+    mac = subprocess.run(["ip", "netns", "exec", NAMESPACE, "cat", "/sys/class/net/%s/address" % INSIDE],
+                         check=True, capture_output=True, text=True).stdout.strip()
+    run(["ip", "neigh", "replace", INSIDE_IP, "lladdr", mac, "dev", OUTSIDE, "nud", "permanent"])
+
+
+def etf(command):
+    return run(["tc", "qdisc", command, "dev", OUTSIDE, "root", "etf", "clockid", "CLOCK_TAI",
+                "delta", str(ETF_DELTA_NS)], check=False) == 0
+
+
+def tear_down():
+    run(["ip", "link", "del", OUTSIDE], check=False)
+    run(["ip", "netns", "del", NAMESPACE], check=False)
+
+
+def measure(name, path):
+    """Run the sender at path into the namespace and return the spread in us
+    of arrival times around the sample grid"""
+    receiver = subprocess.Popen(["ip", "netns", "exec", NAMESPACE, sys.executable, os.path.abspath(__file__),
+                                 "--receive"], stdout=subprocess.PIPE, text=True)
+    time.sleep(0.5)
+    p = start(path, ["--udp", "%s:%d" % (INSIDE_IP, PORT)])
+    out, _ = receiver.communicate(timeout=RUN_S + 5.0)
+    stop([p])
+    stderr = p.stderr.read()
+    if "sending immediately" in stderr:
+        fail("%s: the sender didn't use the qdisc: %s" % (name, stderr.strip()))
+    times = [int(line) for line in out.split()][SETTLE:]
+    if len(times) < RUN_S * RATE_HZ / 2:
+        fail("%s: only %d datagrams arrived" % (name, len(times)))
+
+    # Where in the sample period each one arrived, relative to the first,
+    # wrapped to within half a period either side
+    period = int(1e9 / RATE_HZ)
+    phases = [((t - times[0]) + period // 2) % period - period // 2 for t in times]
+    spread = (max(phases) - min(phases)) / 1000.0
+    print("%-22s %8.1f us spread over %d datagrams" % (name, spread, len(times)))
+    return spread
+
+
+def main():
+    if sys.argv[1:] == ["--receive"]:
+        receive()
+        return
+    build = sys.argv[1]
+    if os.geteuid() != 0 or shutil.which("ip") is None or shutil.which("tc") is None:
+        print("txtime test skipped: needs root, ip and tc")
+        return
+    clean_shm()
+    try:
+        set_up()
+        if not etf("add"):
+            print("txtime test skipped: no etf qdisc in this kernel")
+            return
+        # etf would drop datagrams without a launch time
+        etf("del")
+        measure("sent immediately", build_sender(build))
+        etf("add")
+        spread = measure("scheduled by etf", build_sender(build, "txtime"))
+        if spread > SPREAD_LIMIT_US:
+            fail("etf: departures spread over %.1f us, limit %d us" % (spread, SPREAD_LIMIT_US))
+    finally:
+        tear_down()
+        clean_shm()
+    print("txtime test passed")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,177 @@
+// Beaglebone Blue Heading NMEA UDP Sender - scheduled transmission
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/net_tstamp.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <linux/pkt_sched.h>
+
+#include "config.h"
+#include "txtime.h"
+
+#ifndef SO_TXTIME
+#define SO_TXTIME 61
+#endif
+
+#define NETLINK_BUFFER_LEN 16384
+
+// Send a netlink request and pass each reply message to handle(), until the
+// reply is complete. Returns 0 on success.
+static int __netlink(struct nlmsghdr *request, void (*handle)(struct nlmsghdr *reply, void *arg), void *arg) {
+    int fd = socket(AF_NETLINK, SOCK_RAW | SOCK_CLOEXEC, NETLINK_ROUTE);
+    if (fd < 0) {
+        return -1;
+    }
+    struct timeval timeout = { .tv_sec = 1, .tv_usec = 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    if (send(fd, request, request->nlmsg_len, 0) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    static char buf[NETLINK_BUFFER_LEN];
+    bool done = false;
+    int result = 0;
+    while (!done) {
+        ssize_t len = recv(fd, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            result = -1;
+            break;
+        }
+        struct nlmsghdr *reply;
+        for (reply = (struct nlmsghdr *) buf; NLMSG_OK(reply, len); reply = NLMSG_NEXT(reply, len)) {
+            if (reply->nlmsg_type == NLMSG_DONE) {
+                done = true;
+            } else if (reply->nlmsg_type == NLMSG_ERROR) {
+                struct nlmsgerr *err = NLMSG_DATA(reply);
+                result = err->error == 0 ? 0 : -1;
+                done = true;
+            } else {
+                handle(reply, arg);
+                if (!(reply->nlmsg_flags & NLM_F_MULTI)) {
+                    done = true;
+                }
+            }
+        }
+    }
+    close(fd);
+    return result;
+}
+
+// Route lookup reply: pick out the output interface
+static void __route_reply(struct nlmsghdr *reply, void *arg) {
+    if (reply->nlmsg_type != RTM_NEWROUTE) {
+        return;
+    }
+    struct rtmsg *rt = NLMSG_DATA(reply);
+    int len = RTM_PAYLOAD(reply);
+    struct rtattr *attr;
+    for (attr = RTM_RTA(rt); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        if (attr->rta_type == RTA_OIF) {
+            *(int *) arg = *(int *) RTA_DATA(attr);
+        }
+    }
+}
+
+struct qdisc_search {
+    int ifindex;
+    int clock;
+};
+
+// Qdisc dump reply: look for etf or fq on the interface we want
+static void __qdisc_reply(struct nlmsghdr *reply, void *arg) {
+    struct qdisc_search *search = arg;
+    if (reply->nlmsg_type != RTM_NEWQDISC) {
+        return;
+    }
+    struct tcmsg *tc = NLMSG_DATA(reply);
+    if (tc->tcm_ifindex != search->ifindex) {
+        return;
+    }
+    int len = reply->nlmsg_len - NLMSG_LENGTH(sizeof(*tc));
+    struct rtattr *attr;
+    for (attr = (struct rtattr *) ((char *) tc + NLMSG_ALIGN(sizeof(*tc))); RTA_OK(attr, len); attr = RTA_NEXT(attr, len)) {
+        if (attr->rta_type == TCA_KIND) {
+            const char *kind = RTA_DATA(attr);
+            if (strcmp(kind, "etf") == 0) {
+                search->clock = CLOCK_TAI;
+            } else if (strcmp(kind, "fq") == 0 && search->clock < 0) {
+                search->clock = CLOCK_MONOTONIC;
+            }
+        }
+    }
+}
+
+int txtime_clock_for(const struct sockaddr_in *addr) {
+    struct {
+        struct nlmsghdr header;
+        struct rtmsg rt;
+        char attrs[64];
+    } routeRequest;
+    memset(&routeRequest, 0, sizeof(routeRequest));
+    routeRequest.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct rtmsg));
+    routeRequest.header.nlmsg_type = RTM_GETROUTE;
+    routeRequest.header.nlmsg_flags = NLM_F_REQUEST;
+    routeRequest.rt.rtm_family = AF_INET;
+    routeRequest.rt.rtm_dst_len = 32;
+    struct rtattr *dst = (struct rtattr *) ((char *) &routeRequest + NLMSG_ALIGN(routeRequest.header.nlmsg_len));
+    dst->rta_type = RTA_DST;
+    dst->rta_len = RTA_LENGTH(sizeof(addr->sin_addr));
+    memcpy(RTA_DATA(dst), &addr->sin_addr, sizeof(addr->sin_addr));
+    routeRequest.header.nlmsg_len = NLMSG_ALIGN(routeRequest.header.nlmsg_len) + dst->rta_len;
+
+    int ifindex = 0;
+    if (__netlink(&routeRequest.header, __route_reply, &ifindex) || ifindex == 0) {
+        return -1;
+    }
+
+    struct {
+        struct nlmsghdr header;
+        struct tcmsg tc;
+    } qdiscRequest;
+    memset(&qdiscRequest, 0, sizeof(qdiscRequest));
+    qdiscRequest.header.nlmsg_len = NLMSG_LENGTH(sizeof(struct tcmsg));
+    qdiscRequest.header.nlmsg_type = RTM_GETQDISC;
+    qdiscRequest.header.nlmsg_flags = NLM_F_REQUEST | NLM_F_DUMP;
+    qdiscRequest.tc.tcm_family = AF_UNSPEC;
+
+    struct qdisc_search search = { .ifindex = ifindex, .clock = -1 };
+    if (__netlink(&qdiscRequest.header, __qdisc_reply, &search)) {
+        return -1;
+    }
+    return search.clock;
+}
+
+int txtime_enable(int fd, clockid_t clock) {
+    struct sock_txtime config;
+    memset(&config, 0, sizeof(config));
+    config.clockid = clock;
+    config.flags = 0;
+    return setsockopt(fd, SOL_SOCKET, SO_TXTIME, &config, sizeof(config));
+}
+
+uint64_t txtime_launch(clockid_t clock) {
+    static uint64_t lastLaunch = 0;
+    const uint64_t period = 1000000000ULL / SAMPLE_RATE_HZ;
+    const uint64_t phase = (uint64_t) TXTIME_PHASE_US * 1000ULL % period;
+
+    struct timespec now;
+    clock_gettime(clock, &now);
+    uint64_t earliest = (uint64_t) now.tv_sec * 1000000000ULL + (uint64_t) now.tv_nsec
+            + (uint64_t) TXTIME_LEAD_US * 1000ULL;
+    uint64_t launch = (earliest - phase + period - 1) / period * period + phase;
+
+    // If the MPU's clock runs a little fast, two samples can land on the same
+    // grid point. Push the second one to the next point, but only by one, so
+    // a persistent difference can't build up into extra latency.
+    if (launch == lastLaunch) {
+        launch = lastLaunch + period;
+    }
+    lastLaunch = launch;
+    return launch;
+}
@@ -0,0 +1,28 @@
+// Beaglebone Blue Heading NMEA UDP Sender - scheduled transmission
+//
+// Rather than sending each datagram the moment a sample is ready, so that its
+// departure time wobbles with scheduling jitter, hand it to the kernel early
+// with an SO_TXTIME launch time on a fixed grid. The etf or fq qdisc on the
+// outgoing interface then sends it at exactly that time.
+
+#ifndef TXTIME_H
+#define TXTIME_H
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+
+// Work out whether packets to addr leave through an interface whose qdisc can
+// schedule them. Returns the clock launch times must use (CLOCK_TAI for etf,
+// CLOCK_MONOTONIC for fq), or -1 if there is no such qdisc.
+int txtime_clock_for(const struct sockaddr_in *addr);
+
+// Turn on SO_TXTIME for a socket. Returns 0 on success.
+int txtime_enable(int fd, clockid_t clock);
+
+// Launch time, in ns on the given clock, for a sample arriving now: the next
+// point on a grid of one sample period (plus TXTIME_PHASE_US) that is at least
+// TXTIME_LEAD_US away, and never the same point as the last sample.
+uint64_t txtime_launch(clockid_t clock);
+
+#endif
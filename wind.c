@@ -0,0 +1,256 @@
+// Beaglebone Blue Heading NMEA UDP Sender - true wind
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <math.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "angles.h"
+#include "nmea.h"
+#include "pipeline.h"
+#include "wind.h"
+
+// Sample history, one entry per sample, long enough to look back past
+// WIND_LATENCY_MS at the highest sample rate
+#define HISTORY_LEN 256
+
+#define DEG_RAD (M_PI / 180.0)
+
+struct history_entry {
+    uint64_t timestamp_ns;
+    double heading_true;
+    double heading_mag;
+};
+
+// Latest readings from the receiver thread, protected by readingLock
+static pthread_mutex_t readingLock = PTHREAD_MUTEX_INITIALIZER;
+static uint32_t windSequence = 0;
+static double apparentAngle;
+static double apparentSpeed;
+static uint64_t windMeasuredNs;
+static double waterSpeed;
+static uint64_t waterSpeedNs = 0;
+static double groundSpeed;
+static uint64_t groundSpeedNs = 0;
+
+static int windSocket = -1;
+static pthread_t receiverThread;
+static volatile bool receiving = false;
+
+// Only touched by the sample path
+static struct history_entry history[HISTORY_LEN];
+static uint32_t historyCount = 0;
+static uint32_t lastWindSequence = 0;
+
+// Statistics, written by the sample path
+static unsigned int readings = 0;
+static unsigned int noSpeed = 0;
+static unsigned int outOfHistory = 0;
+static double totalOffsetNs = 0.0;
+static double maxOffsetNs = 0.0;
+
+// Apparent wind angle and speed in knots from an MWV, if it is a valid
+// relative one
+static bool __parse_apparent(const struct nmea_sentence *sentence, double *angle, double *speed) {
+    if (nmea_char(nmea_field(sentence, 2)) != 'R' || nmea_char(nmea_field(sentence, 5)) != 'A'
+            || !nmea_decimal(nmea_field(sentence, 1), angle) || !nmea_decimal(nmea_field(sentence, 3), speed)) {
+        return false;
+    }
+    switch (nmea_char(nmea_field(sentence, 4))) {
+        case 'N':
+            return true;
+        case 'M':
+            *speed *= 3600.0 / 1852.0;
+            return true;
+        case 'K':
+            *speed *= 1000.0 / 1852.0;
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Receiver thread. Takes the apparent wind from MWV, speed through the water
+// from VHW and speed over ground from VTG. The socket has a receive timeout
+// so this notices when it has been asked to stop.
+static void *__receive(__attribute__ ((unused)) void *arg) {
+    char buf[512];
+    struct nmea_parser parser;
+    nmea_init(&parser);
+    while (receiving) {
+        ssize_t len = recv(windSocket, buf, sizeof(buf), 0);
+        if (len < 0) {
+            continue;
+        }
+        uint64_t now = pipeline_now();
+        nmea_feed(&parser, buf, len);
+        struct nmea_sentence sentence;
+        while (nmea_next(&parser, &sentence)) {
+            double angle, speed;
+            if (nmea_is(&sentence, "MWV")) {
+                if (__parse_apparent(&sentence, &angle, &speed)) {
+                    pthread_mutex_lock(&readingLock);
+                    apparentAngle = angle;
+                    apparentSpeed = speed;
+                    windMeasuredNs = now - (uint64_t) WIND_LATENCY_MS * 1000000ULL;
+                    windSequence++;
+                    pthread_mutex_unlock(&readingLock);
+                }
+            } else if (nmea_is(&sentence, "VHW")) {
+                if (nmea_decimal(nmea_field(&sentence, 5), &speed)) {
+                    pthread_mutex_lock(&readingLock);
+                    waterSpeed = speed;
+                    waterSpeedNs = now;
+                    pthread_mutex_unlock(&readingLock);
+                }
+            } else if (nmea_is(&sentence, "VTG")) {
+                if (nmea_decimal(nmea_field(&sentence, 5), &speed)) {
+                    pthread_mutex_lock(&readingLock);
+                    groundSpeed = speed;
+                    groundSpeedNs = now;
+                    pthread_mutex_unlock(&readingLock);
+                }
+            }
+        }
+    }
+    return NULL;
+}
+
+int wind_start(void) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family      = AF_INET;
+    addr.sin_port        = htons(WIND_INPUT_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if ((windSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP)) < 0
+            || bind(windSocket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        fprintf(stderr, "create wind input socket failed\n");
+        return -1;
+    }
+    struct timeval timeout = { .tv_sec = 0, .tv_usec = 100000 };
+    setsockopt(windSocket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    receiving = true;
+    if (pthread_create(&receiverThread, NULL, __receive, NULL)) {
+        fprintf(stderr, "create wind receiver thread failed\n");
+        close(windSocket);
+        return -1;
+    }
+    return 0;
+}
+
+void wind_stop(void) {
+    if (windSocket >= 0) {
+        receiving = false;
+        pthread_join(receiverThread, NULL);
+        close(windSocket);
+        windSocket = -1;
+    }
+}
+
+static bool __fresh(uint64_t then, uint64_t now) {
+    return then != 0 && (int64_t) (now - then) < (int64_t) (WIND_SPEED_TIMEOUT_S * 1e9);
+}
+
+// The history entry with the timestamp closest to t. The history is in time
+// order, so search it by halves.
+static const struct history_entry *__closest(uint64_t t) {
+    uint32_t first = historyCount > HISTORY_LEN ? historyCount - HISTORY_LEN : 0;
+    uint32_t low = first;
+    uint32_t high = historyCount - 1;
+    while (low < high) {
+        uint32_t mid = low + (high - low) / 2;
+        if (history[mid % HISTORY_LEN].timestamp_ns < t) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    // If t is newer than every entry, the search stops on the newest, which
+    // is then the closest
+    const struct history_entry *after = &history[low % HISTORY_LEN];
+    if (low > first && after->timestamp_ns >= t) {
+        const struct history_entry *before = &history[(low - 1) % HISTORY_LEN];
+        if (t - before->timestamp_ns < after->timestamp_ns - t) {
+            return before;
+        }
+    }
+    return after;
+}
+
+void wind_true(struct sample *s) {
+    struct history_entry *entry = &history[historyCount % HISTORY_LEN];
+    entry->timestamp_ns = s->timestamp_ns;
+    entry->heading_true = s->heading_true;
+    entry->heading_mag = s->heading_mag;
+    historyCount++;
+    s->wind_valid = false;
+
+    uint32_t sequence;
+    double angle, speed, water, ground;
+    uint64_t measuredNs, waterNs, groundNs;
+    pthread_mutex_lock(&readingLock);
+    sequence = windSequence;
+    angle = apparentAngle;
+    speed = apparentSpeed;
+    measuredNs = windMeasuredNs;
+    water = waterSpeed;
+    waterNs = waterSpeedNs;
+    ground = groundSpeed;
+    groundNs = groundSpeedNs;
+    pthread_mutex_unlock(&readingLock);
+
+    if (sequence == lastWindSequence) {
+        return;
+    }
+    lastWindSequence = sequence;
+    readings++;
+
+    // True wind is relative to the water, so prefer the log, but speed over
+    // ground is close enough without one
+    double boatSpeed;
+    if (__fresh(waterNs, s->timestamp_ns)) {
+        boatSpeed = water;
+    } else if (__fresh(groundNs, s->timestamp_ns)) {
+        boatSpeed = ground;
+    } else {
+        noSpeed++;
+        return;
+    }
+
+    const struct history_entry *closest = __closest(measuredNs);
+    double offsetNs = fabs((double) (int64_t) (closest->timestamp_ns - measuredNs));
+    if (offsetNs > 1e9 / SAMPLE_RATE_HZ) {
+        outOfHistory++;
+        return;
+    }
+    totalOffsetNs += offsetNs;
+    if (offsetNs > maxOffsetNs) {
+        maxOffsetNs = offsetNs;
+    }
+
+    // Take the boat's own motion out of the apparent wind. Both are in the
+    // boat's frame: x forward and y to starboard, the wind given as where it
+    // comes from.
+    double x = speed * cos(angle * DEG_RAD) - boatSpeed;
+    double y = speed * sin(angle * DEG_RAD);
+    s->wind_speed = sqrt(x * x + y * y);
+    s->wind_angle = wrap_360(atan2(y, x) / DEG_RAD);
+    s->wind_direction = wrap_360(closest->heading_true + s->wind_angle);
+    s->wind_direction_mag = wrap_360(closest->heading_mag + s->wind_angle);
+    s->wind_valid = true;
+}
+
+void wind_print_stats(FILE *f) {
+    unsigned int used = readings - noSpeed - outOfHistory;
+    fprintf(f, "true wind: %u readings, %u without boat speed, %u outside history, "
+            "matched to samples %.1f ms mean %.1f ms max\n",
+            readings, noSpeed, outOfHistory, used > 0 ? totalOffsetNs / used / 1e6 : 0.0, maxOffsetNs / 1e6);
+    fflush(f);
+}
@@ -0,0 +1,31 @@
+// Beaglebone Blue Heading NMEA UDP Sender - true wind
+//
+// Receives apparent wind (MWV) from a wind instrument and boat speed (VHW or
+// VTG) over UDP, and works out the true wind with our own heading, so it can
+// go out with the heading rather than through other boxes that each add their
+// own delay. Each wind reading is matched with the sample whose timestamp is
+// closest to when the wind was measured, from a history of recent samples, so
+// a turning boat doesn't smear the true wind direction.
+
+#ifndef WIND_H
+#define WIND_H
+
+#include <stdio.h>
+
+#include "sample.h"
+
+// Start listening for wind and speed on WIND_INPUT_PORT. Returns 0 on success.
+int wind_start(void);
+
+// Stop listening
+void wind_stop(void);
+
+// Pipeline stage. Adds the sample to the history and, if a wind reading has
+// arrived since the last sample, fills in the sample's true wind.
+void wind_true(struct sample *s);
+
+// Print how many readings have been used, and how closely they were matched
+// to samples
+void wind_print_stats(FILE *f);
+
+#endif